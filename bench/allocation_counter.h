@@ -0,0 +1,41 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Every allocation of the process is counted, benchmarks report the ones
+// made while timing is running. Global operator new is replaced here, so
+// header is included by one source file of benchmark executable.
+static uint64_t allocation_count = 0;
+
+void* operator new(size_t size) {
+    ++allocation_count;
+    if (void* pointer = std::malloc(size == 0 ? 1 : size)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+
+void operator delete(void* pointer, size_t) noexcept { std::free(pointer); }
+
+// Counts allocations of timed part of benchmark loop
+class AllocationCounter {
+   public:
+    void Start() { start_ = allocation_count; }
+
+    void Stop() { count_ += allocation_count - start_; }
+
+    void Report(benchmark::State& state) const {
+        state.counters["allocs/op"] = benchmark::Counter(
+            static_cast<double>(count_), benchmark::Counter::kAvgIterations);
+    }
+
+   private:
+    uint64_t start_ = 0;
+    uint64_t count_ = 0;
+};
@@ -0,0 +1,190 @@
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../src/market.h"
+#include "allocation_counter.h"
+
+std::atomic<uint64_t> Offer::offer_id_ = 0;
+std::atomic<uint64_t> Deal::deal_id_ = 0;
+std::atomic<uint64_t> UserData::user_id_ = 0;
+
+static constexpr int mid_price = 100'000;
+
+// Market is driven directly, events go to null sink, so neither database
+// nor journal is involved
+static std::vector<uint64_t> RegisterUsers(Market& market, size_t count) {
+    std::vector<uint64_t> user_ids;
+    user_ids.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        user_ids.push_back(
+            *market.RegisterUser("user" + std::to_string(i), i));
+    }
+    return user_ids;
+}
+
+// Rests offer_count offers on each side, spread over levels next to
+// mid_price
+static void FillBook(Market& market, const std::vector<uint64_t>& user_ids,
+                     size_t offer_count, int levels) {
+    for (size_t i = 0; i < offer_count; ++i) {
+        uint64_t user_id = user_ids[i % user_ids.size()];
+        int level = static_cast<int>(i % levels);
+        market.PostOffer(user_id, OfferType::SELL, mid_price + 1 + level, 10);
+        market.PostOffer(user_id, OfferType::BUY, mid_price - 1 - level, 10);
+    }
+}
+
+// Offers that do not cross the spread and rest in book of given depth. They
+// are canceled in batches outside of timed region, so depth grows by less
+// than remove_batch_size and pausing timer costs little per offer.
+static void BM_PassiveInsert(benchmark::State& state) {
+    static constexpr size_t remove_batch_size = 64;
+
+    Market market;
+    auto user_ids = RegisterUsers(market, 100);
+    FillBook(market, user_ids, state.range(0), 1000);
+    std::mt19937 random(42);
+    std::vector<int> levels(1 << 16);
+    for (int& level : levels) {
+        level = static_cast<int>(random() % 1000);
+    }
+
+    AllocationCounter allocations;
+    std::vector<std::pair<uint64_t, uint64_t>> posted_offers;
+    posted_offers.reserve(remove_batch_size);
+    size_t i = 0;
+    allocations.Start();
+    for (auto _ : state) {
+        OfferType type = i % 2 == 0 ? OfferType::SELL : OfferType::BUY;
+        int level = levels[i % levels.size()];
+        int price = type == OfferType::SELL ? mid_price + 1 + level
+                                            : mid_price - 1 - level;
+        uint64_t user_id = user_ids[i % user_ids.size()];
+
+        posted_offers.emplace_back(user_id,
+                                   market.PostOffer(user_id, type, price, 10));
+
+        if (posted_offers.size() == remove_batch_size) {
+            state.PauseTiming();
+            allocations.Stop();
+            for (auto [owner_id, offer_id] : posted_offers) {
+                market.RemoveOffer(owner_id, offer_id);
+            }
+            posted_offers.clear();
+            allocations.Start();
+            state.ResumeTiming();
+        }
+        ++i;
+    }
+    allocations.Stop();
+    allocations.Report(state);
+}
+
+// Single aggressive offer that fills one offer on each of range(0) levels.
+// Book is rebuilt before every sweep, only the sweep is timed manually, as
+// pausing timer twice per iteration costs as much as a short sweep.
+static void BM_AggressiveSweep(benchmark::State& state) {
+    int levels = static_cast<int>(state.range(0));
+    Market market;
+    auto user_ids = RegisterUsers(market, 100);
+
+    AllocationCounter allocations;
+    for (auto _ : state) {
+        for (int level = 0; level < levels; ++level) {
+            market.PostOffer(user_ids[level % user_ids.size()],
+                             OfferType::SELL, mid_price + level, 1);
+        }
+        allocations.Start();
+        auto start = std::chrono::steady_clock::now();
+
+        market.PostOffer(user_ids.back(), OfferType::BUY,
+                         mid_price + levels - 1, levels);
+
+        auto end = std::chrono::steady_clock::now();
+        allocations.Stop();
+        state.SetIterationTime(
+            std::chrono::duration<double>(end - start).count());
+    }
+    allocations.Report(state);
+    state.SetItemsProcessed(state.iterations() * levels);
+}
+
+// Offer is posted to book of given depth and canceled right away
+static void BM_CancelChurn(benchmark::State& state) {
+    Market market;
+    auto user_ids = RegisterUsers(market, 100);
+    FillBook(market, user_ids, state.range(0), 1000);
+
+    AllocationCounter allocations;
+    size_t i = 0;
+    allocations.Start();
+    for (auto _ : state) {
+        uint64_t user_id = user_ids[i % user_ids.size()];
+        int level = static_cast<int>(i % 1000);
+        uint64_t offer_id = market.PostOffer(user_id, OfferType::SELL,
+                                             mid_price + 1 + level, 10);
+        benchmark::DoNotOptimize(market.RemoveOffer(user_id, offer_id));
+        ++i;
+    }
+    allocations.Stop();
+    allocations.Report(state);
+}
+
+// Marketable offer for one unit in book of given depth. Each iteration
+// rests one unit at a new best ask level inside the spread first and the
+// offer takes exactly it, so the book is the same before every iteration.
+static void BM_DeepBookMatch(benchmark::State& state) {
+    Market market;
+    auto user_ids = RegisterUsers(market, 1000);
+    FillBook(market, user_ids, state.range(0), 1000);
+
+    AllocationCounter allocations;
+    size_t i = 0;
+    allocations.Start();
+    for (auto _ : state) {
+        market.PostOffer(user_ids[i % user_ids.size()], OfferType::SELL,
+                         mid_price, 1);
+        market.PostOffer(user_ids[(i + 1) % user_ids.size()], OfferType::BUY,
+                         mid_price, 1);
+        ++i;
+    }
+    allocations.Stop();
+    allocations.Report(state);
+}
+
+// Crossing offers of random pairs among range(0) users
+static void BM_ManyUsersTrade(benchmark::State& state) {
+    Market market;
+    auto user_ids = RegisterUsers(market, state.range(0));
+    std::mt19937 random(42);
+    std::vector<uint64_t> traders(1 << 16);
+    for (uint64_t& trader : traders) {
+        trader = user_ids[random() % user_ids.size()];
+    }
+
+    AllocationCounter allocations;
+    size_t i = 0;
+    allocations.Start();
+    for (auto _ : state) {
+        market.PostOffer(traders[i % traders.size()], OfferType::SELL,
+                         mid_price, 10);
+        market.PostOffer(traders[(i + 1) % traders.size()], OfferType::BUY,
+                         mid_price, 10);
+        i += 2;
+    }
+    allocations.Stop();
+    allocations.Report(state);
+}
+
+BENCHMARK(BM_PassiveInsert)->Arg(1'000)->Arg(100'000);
+BENCHMARK(BM_AggressiveSweep)->Arg(10)->Arg(100)->Arg(1'000)->UseManualTime();
+BENCHMARK(BM_CancelChurn)->Arg(1'000)->Arg(100'000);
+BENCHMARK(BM_DeepBookMatch)->Arg(1'000)->Arg(100'000)->Arg(1'000'000);
+BENCHMARK(BM_ManyUsersTrade)->Arg(100)->Arg(10'000)->Arg(1'000'000);
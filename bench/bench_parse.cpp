@@ -0,0 +1,86 @@
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <string>
+#include <string_view>
+
+#include "../src/binary_protocol.h"
+#include "../src/json.h"
+#include "../src/request.h"
+#include "allocation_counter.h"
+
+// Hot requests as load generator sends them
+static const std::array<std::string, 3> json_messages = {
+    R"({"AMOUNT":7,"OFFER_SIDE":"BUY","PRICE":1003,"TYPE":"PostOffer"})",
+    R"({"OFFER_ID":987654,"TYPE":"Cancel"})",
+    R"({"TYPE":"Quotes"})",
+};
+
+static std::string MakeBinaryMessage(size_t index) {
+    std::string message;
+    AppendBinaryRequest(nlohmann::json::parse(json_messages[index]), message);
+    return message;
+}
+
+static void SetLabel(benchmark::State& state) {
+    state.SetLabel(nlohmann::json::parse(json_messages[state.range(0)])
+                       .at("TYPE")
+                       .get<std::string>());
+}
+
+// Json document is built and then read into Request, as for requests that
+// are not hot
+static void BM_ParseJsonDocument(benchmark::State& state) {
+    const std::string& message = json_messages[state.range(0)];
+    AllocationCounter allocations;
+    Request request;
+    for (auto _ : state) {
+        allocations.Start();
+        RequestError error =
+            ParseRequest(nlohmann::json::parse(message), request);
+        allocations.Stop();
+        benchmark::DoNotOptimize(error);
+        benchmark::DoNotOptimize(request);
+    }
+    allocations.Report(state);
+    SetLabel(state);
+}
+
+BENCHMARK(BM_ParseJsonDocument)->DenseRange(0, 2);
+
+static void BM_ParseHotRequest(benchmark::State& state) {
+    const std::string& message = json_messages[state.range(0)];
+    AllocationCounter allocations;
+    Request request;
+    for (auto _ : state) {
+        allocations.Start();
+        bool is_parsed = ParseHotRequest(message, request);
+        allocations.Stop();
+        benchmark::DoNotOptimize(is_parsed);
+        benchmark::DoNotOptimize(request);
+    }
+    allocations.Report(state);
+    SetLabel(state);
+}
+
+BENCHMARK(BM_ParseHotRequest)->DenseRange(0, 2);
+
+static void BM_DecodeBinaryRequest(benchmark::State& state) {
+    std::string message = MakeBinaryMessage(state.range(0));
+    AllocationCounter allocations;
+    Request request;
+    for (auto _ : state) {
+        allocations.Start();
+        RequestKind kind;
+        std::string_view payload;
+        DecodeBinaryMessage(message, kind, payload);
+        RequestError error = DecodeBinaryRequest(kind, payload, request);
+        allocations.Stop();
+        benchmark::DoNotOptimize(error);
+        benchmark::DoNotOptimize(request);
+    }
+    allocations.Report(state);
+    SetLabel(state);
+}
+
+BENCHMARK(BM_DecodeBinaryRequest)->DenseRange(0, 2);
@@ -0,0 +1,157 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "../src/market.h"
+#include "../src/snapshot.h"
+
+std::atomic<uint64_t> Offer::offer_id_ = 0;
+std::atomic<uint64_t> Deal::deal_id_ = 0;
+std::atomic<uint64_t> UserData::user_id_ = 0;
+
+static constexpr uint64_t user_count = 100'000;
+static constexpr uint64_t deal_count = 1'000'000;
+static constexpr int price_levels = 1000;
+
+// Builds state of market with given number of resting offers: buy offers
+// below 1000, sell offers above it, spread evenly over price levels and
+// users.
+static MarketSnapshot MakeMarketSnapshot(uint64_t offer_count) {
+    MarketSnapshot snapshot;
+    snapshot.header.has_quote = true;
+    snapshot.header.quote = price_levels;
+
+    for (uint64_t id = 0; id < user_count; ++id) {
+        std::string username = "user" + std::to_string(id);
+        snapshot.users.push_back({.id = id,
+                                  .pw_hash = std::hash<std::string>{}(username),
+                                  .usd = 1000,
+                                  .rub = 1'000'000,
+                                  .username_offset = snapshot.usernames.size(),
+                                  .username_size = username.size()});
+        snapshot.usernames += username;
+    }
+
+    snapshot.offers.reserve(offer_count);
+    uint64_t per_level = offer_count / (2 * price_levels);
+    uint64_t offer_id = 0;
+    for (uint8_t type : {static_cast<uint8_t>(OfferType::SELL),
+                         static_cast<uint8_t>(OfferType::BUY)}) {
+        int first_price = type == static_cast<uint8_t>(OfferType::SELL)
+                              ? price_levels + 1
+                              : 0;
+        for (int price = first_price; price < first_price + price_levels;
+             ++price) {
+            for (uint64_t i = 0; i < per_level; ++i, ++offer_id) {
+                snapshot.offers.push_back({.id = offer_id,
+                                           .owner_id = offer_id % user_count,
+                                           .amount = 10,
+                                           .price = price,
+                                           .type = type});
+            }
+        }
+    }
+
+    snapshot.deals.reserve(deal_count);
+    for (uint64_t id = 0; id < deal_count; ++id) {
+        snapshot.deals.push_back({.id = id,
+                                  .seller_id = id % user_count,
+                                  .buyer_id = (id + 1) % user_count,
+                                  .amount = 10,
+                                  .price = price_levels});
+    }
+
+    snapshot.header.next_user_id = user_count;
+    snapshot.header.next_offer_id = offer_id;
+    snapshot.header.next_deal_id = deal_count;
+
+    return snapshot;
+}
+
+// Snapshot files are generated once per size and reused by all benchmarks
+static const std::string& GetSnapshotPath(uint64_t offer_count) {
+    static std::map<uint64_t, std::string> paths;
+    auto path = paths.find(offer_count);
+    if (path == paths.end()) {
+        std::string file = std::filesystem::temp_directory_path() /
+                           ("bench_" + std::to_string(offer_count) +
+                            ".snapshot");
+        WriteSnapshot(MakeMarketSnapshot(offer_count).GetView(), file);
+        path = paths.emplace(offer_count, file).first;
+    }
+    return path->second;
+}
+
+static void BM_MapSnapshot(benchmark::State& state) {
+    const std::string& path = GetSnapshotPath(state.range(0));
+    for (auto _ : state) {
+        MappedSnapshot snapshot(path);
+        benchmark::DoNotOptimize(snapshot.GetView().offers.data());
+    }
+}
+
+// Full startup path: map file and build order books and user tables
+static void BM_RestoreFromSnapshot(benchmark::State& state) {
+    const std::string& path = GetSnapshotPath(state.range(0));
+    for (auto _ : state) {
+        auto market = std::make_unique<Market>();
+        {
+            MappedSnapshot snapshot(path);
+            market->RestoreSnapshot(snapshot.GetView());
+        }
+        state.PauseTiming();
+        market.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Row by row restore used for database warm restart, without cost of
+// reading rows from database
+static void BM_RestoreByRows(benchmark::State& state) {
+    const std::string& path = GetSnapshotPath(state.range(0));
+    MappedSnapshot snapshot(path);
+    const SnapshotView& view = snapshot.GetView();
+    for (auto _ : state) {
+        auto market = std::make_unique<Market>();
+        for (const SnapshotUser& user : view.users) {
+            market->RestoreUser(
+                user.id,
+                std::string(view.usernames.substr(user.username_offset,
+                                                  user.username_size)),
+                user.pw_hash);
+        }
+        for (const SnapshotDeal& deal : view.deals) {
+            market->RestoreDeal(deal.id, deal.seller_id, deal.buyer_id,
+                                deal.price, deal.amount);
+        }
+        for (const SnapshotOffer& offer : view.offers) {
+            market->RestoreOffer(offer.id, offer.owner_id,
+                                 static_cast<OfferType>(offer.type),
+                                 offer.price, offer.amount);
+        }
+        state.PauseTiming();
+        market.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_MapSnapshot)
+    ->Arg(1'000'000)
+    ->Arg(10'000'000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_RestoreFromSnapshot)
+    ->Arg(1'000'000)
+    ->Arg(10'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_RestoreByRows)
+    ->Arg(1'000'000)
+    ->Arg(10'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Helpers for fixed layout binary formats (journal, snapshots, wire
+// protocol). All values are stored little-endian.
+static_assert(std::endian::native == std::endian::little,
+              "Binary formats assume little-endian host");
+
+class BinaryWriter {
+   public:
+    explicit BinaryWriter(std::string& buffer) : buffer_(buffer) {}
+
+    template <typename T>
+        requires std::is_arithmetic_v<T> || std::is_enum_v<T>
+    void Write(T value) {
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        buffer_.append(bytes, sizeof(T));
+    }
+
+    void WriteString(std::string_view str) {
+        Write(static_cast<uint32_t>(str.size()));
+        buffer_.append(str);
+    }
+
+   private:
+    std::string& buffer_;
+};
+
+// Reads values written by BinaryWriter. Every read returns false if there
+// is not enough data left, in which case output is left untouched.
+class BinaryReader {
+   public:
+    explicit BinaryReader(std::string_view data) : data_(data) {}
+
+    template <typename T>
+        requires std::is_arithmetic_v<T> || std::is_enum_v<T>
+    bool Read(T& value) {
+        if (data_.size() < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, data_.data(), sizeof(T));
+        data_.remove_prefix(sizeof(T));
+
+        return true;
+    }
+
+    bool ReadString(std::string& str) {
+        uint32_t size;
+        if (!Read(size) || data_.size() < size) {
+            return false;
+        }
+        str.assign(data_.data(), size);
+        data_.remove_prefix(size);
+
+        return true;
+    }
+
+    size_t Remaining() const { return data_.size(); }
+
+   private:
+    std::string_view data_;
+};
+
+// FNV-1a hash used to detect torn and corrupted records
+inline uint32_t Checksum(std::string_view data) {
+    uint32_t hash = 2166136261u;
+    for (char byte : data) {
+        hash ^= static_cast<uint8_t>(byte);
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
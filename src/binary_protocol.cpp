@@ -0,0 +1,417 @@
+#include "binary_protocol.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "binary_io.h"
+#include "common.h"
+#include "lz4.h"
+
+using nlohmann::json;
+
+std::optional<Protocol> GetProtocol(const std::string& name) {
+    if (name == protocols::JSON) {
+        return Protocol::JSON;
+    }
+    if (name == protocols::BINARY) {
+        return Protocol::BINARY;
+    }
+    return std::nullopt;
+}
+
+void AppendBinaryMessage(RequestKind kind, std::string_view payload,
+                         std::string& buffer) {
+    BinaryWriter writer(buffer);
+    writer.Write(kind);
+    writer.Write(static_cast<uint32_t>(payload.size()));
+    buffer.append(payload);
+}
+
+size_t BeginBinaryMessage(std::string& buffer) {
+    size_t offset = buffer.size();
+    buffer.append(binary_header_size, '\0');
+    return offset;
+}
+
+void EndBinaryMessage(RequestKind kind, size_t offset, std::string& buffer) {
+    auto size =
+        static_cast<uint32_t>(buffer.size() - offset - binary_header_size);
+    std::memcpy(buffer.data() + offset, &kind, sizeof(kind));
+    std::memcpy(buffer.data() + offset + sizeof(kind), &size, sizeof(size));
+}
+
+bool AppendCompressedMessage(RequestKind kind, std::string_view payload,
+                             std::string& buffer) {
+    size_t offset = BeginBinaryMessage(buffer);
+    BinaryWriter(buffer).Write(static_cast<uint32_t>(payload.size()));
+    Lz4Compress(payload, buffer);
+    if (buffer.size() - offset >= payload.size()) {
+        buffer.resize(offset);
+        return false;
+    }
+    EndBinaryMessage(static_cast<RequestKind>(static_cast<uint8_t>(kind) |
+                                              compressed_message_flag),
+                     offset, buffer);
+    return true;
+}
+
+bool TakeCompressionFlag(RequestKind& kind) {
+    auto value = static_cast<uint8_t>(kind);
+    kind = static_cast<RequestKind>(value & ~compressed_message_flag);
+    return (value & compressed_message_flag) != 0;
+}
+
+bool DecompressPayload(std::string_view payload, std::string& output) {
+    BinaryReader reader(payload);
+    uint32_t size;
+    return reader.Read(size) &&
+           Lz4Decompress(payload.substr(sizeof(size)), size, output);
+}
+
+size_t DecodeBinaryMessage(std::string_view data, RequestKind& kind,
+                           std::string_view& payload) {
+    BinaryReader reader(data);
+    uint32_t size;
+    if (!reader.Read(kind) || !reader.Read(size) ||
+        reader.Remaining() < size) {
+        return 0;
+    }
+    payload = data.substr(binary_header_size, size);
+
+    return binary_header_size + size;
+}
+
+bool ExceedsBinaryMessageSize(std::string_view data) {
+    BinaryReader reader(data);
+    RequestKind kind;
+    uint32_t size;
+    return reader.Read(kind) && reader.Read(size) &&
+           size > max_binary_message_size;
+}
+
+void AppendBinaryRequest(const Request& request, std::string& buffer) {
+    std::string payload;
+    BinaryWriter writer(payload);
+    switch (request.kind) {
+        case RequestKind::REGISTRATION:
+        case RequestKind::LOGIN:
+            writer.Write(static_cast<uint64_t>(request.pw_hash));
+            writer.WriteString(request.username);
+            if (!request.compression.empty()) {
+                writer.WriteString(request.compression);
+            }
+            break;
+        case RequestKind::POST_OFFER:
+            writer.Write(static_cast<uint8_t>(request.offer_type));
+            writer.Write(static_cast<int32_t>(request.price));
+            writer.Write(static_cast<uint64_t>(request.amount));
+            break;
+        case RequestKind::CANCEL:
+            writer.Write(request.offer_id);
+            break;
+        case RequestKind::BALANCE:
+        case RequestKind::ACTIVE_OFFERS:
+        case RequestKind::CLOSED_DEALS:
+        case RequestKind::QUOTES:
+        case RequestKind::METRICS:
+            break;
+        default:
+            throw std::invalid_argument(
+                "Request has no binary form: " +
+                GetRequestKindName(request.kind));
+    }
+    AppendBinaryMessage(request.kind, payload, buffer);
+}
+
+void AppendBinaryRequest(const json& request, std::string& buffer) {
+    Request parsed;
+    RequestError error = ParseRequest(request, parsed);
+    if (error != RequestError::NONE) {
+        throw std::invalid_argument(GetRequestErrorText(error));
+    }
+    AppendBinaryRequest(parsed, buffer);
+}
+
+static bool ReadOfferType(BinaryReader& reader, OfferType& type) {
+    uint8_t value;
+    if (!reader.Read(value) ||
+        value > static_cast<uint8_t>(OfferType::SELL)) {
+        return false;
+    }
+    type = static_cast<OfferType>(value);
+    return true;
+}
+
+// Strings of json protocol are utf-8, so binary ones must be as well to be
+// captured and logged. Rejects overlong forms, surrogates and code points
+// above U+10FFFF.
+static bool IsValidUtf8(std::string_view str) {
+    size_t i = 0;
+    while (i < str.size()) {
+        auto byte = static_cast<uint8_t>(str[i]);
+        size_t length;
+        uint32_t code_point;
+        if (byte < 0x80) {
+            ++i;
+            continue;
+        } else if ((byte & 0xE0) == 0xC0) {
+            length = 2;
+            code_point = byte & 0x1F;
+        } else if ((byte & 0xF0) == 0xE0) {
+            length = 3;
+            code_point = byte & 0x0F;
+        } else if ((byte & 0xF8) == 0xF0) {
+            length = 4;
+            code_point = byte & 0x07;
+        } else {
+            return false;
+        }
+        if (str.size() - i < length) {
+            return false;
+        }
+        for (size_t j = 1; j < length; ++j) {
+            auto next = static_cast<uint8_t>(str[i + j]);
+            if ((next & 0xC0) != 0x80) {
+                return false;
+            }
+            code_point = (code_point << 6) | (next & 0x3F);
+        }
+        static constexpr uint32_t min_code_point[] = {0, 0, 0x80, 0x800,
+                                                      0x10000};
+        if (code_point < min_code_point[length] || code_point > 0x10FFFF ||
+            (code_point >= 0xD800 && code_point <= 0xDFFF)) {
+            return false;
+        }
+        i += length;
+    }
+    return true;
+}
+
+RequestError DecodeBinaryRequest(RequestKind kind, std::string_view payload,
+                                 Request& request) {
+    BinaryReader reader(payload);
+    Request parsed{.kind = kind};
+    bool is_valid = true;
+    switch (kind) {
+        case RequestKind::REGISTRATION:
+        case RequestKind::LOGIN: {
+            uint64_t pw_hash = 0;
+            is_valid =
+                reader.Read(pw_hash) && reader.ReadString(parsed.username) &&
+                (reader.Remaining() == 0 ||
+                 reader.ReadString(parsed.compression)) &&
+                IsValidUtf8(parsed.username) &&
+                IsValidUtf8(parsed.compression);
+            parsed.pw_hash = pw_hash;
+            break;
+        }
+        case RequestKind::POST_OFFER: {
+            int32_t price = 0;
+            uint64_t amount = 0;
+            is_valid = ReadOfferType(reader, parsed.offer_type) &&
+                       reader.Read(price) && reader.Read(amount);
+            parsed.price = price;
+            parsed.amount = amount;
+            break;
+        }
+        case RequestKind::CANCEL:
+            is_valid = reader.Read(parsed.offer_id);
+            break;
+        case RequestKind::BALANCE:
+        case RequestKind::ACTIVE_OFFERS:
+        case RequestKind::CLOSED_DEALS:
+        case RequestKind::QUOTES:
+        case RequestKind::METRICS:
+            break;
+        default:
+            return RequestError::UNKNOWN_TYPE;
+    }
+    if (!is_valid || reader.Remaining() != 0) {
+        return RequestError::MALFORMED;
+    }
+
+    RequestError error = ValidateRequest(parsed);
+    if (error == RequestError::NONE) {
+        request = std::move(parsed);
+    }
+    return error;
+}
+
+void EncodeAuthReply(const std::optional<uint64_t>& user_id,
+                     const std::optional<bool>& compression,
+                     std::string& payload) {
+    BinaryWriter writer(payload);
+    writer.Write(static_cast<uint8_t>(user_id.has_value()));
+    writer.Write(user_id.value_or(0));
+    if (compression.has_value()) {
+        writer.Write(static_cast<uint8_t>(*compression));
+    }
+}
+
+void EncodeBalanceReply(int usd, int rub, std::string& payload) {
+    BinaryWriter writer(payload);
+    writer.Write(static_cast<int32_t>(usd));
+    writer.Write(static_cast<int32_t>(rub));
+}
+
+void EncodeListSize(size_t size, std::string& payload) {
+    BinaryWriter(payload).Write(static_cast<uint32_t>(size));
+}
+
+void EncodeOfferEntry(uint64_t offer_id, OfferType type, int price,
+                      size_t amount, std::string& payload) {
+    BinaryWriter writer(payload);
+    writer.Write(offer_id);
+    writer.Write(static_cast<uint8_t>(type));
+    writer.Write(static_cast<int32_t>(price));
+    writer.Write(static_cast<uint64_t>(amount));
+}
+
+void EncodeDealEntry(DealSide side, int price, size_t amount,
+                     std::string& payload) {
+    BinaryWriter writer(payload);
+    writer.Write(side);
+    writer.Write(static_cast<int32_t>(price));
+    writer.Write(static_cast<uint64_t>(amount));
+}
+
+static void EncodeOptional(const std::optional<int>& value,
+                           BinaryWriter& writer) {
+    writer.Write(static_cast<uint8_t>(value.has_value()));
+    writer.Write(static_cast<int32_t>(value.value_or(0)));
+}
+
+void EncodeQuotesReply(const std::optional<int>& quote,
+                       const std::optional<int>& ask_quote,
+                       const std::optional<int>& bid_quote,
+                       const std::optional<int>& spread, std::string& payload) {
+    BinaryWriter writer(payload);
+    EncodeOptional(quote, writer);
+    EncodeOptional(ask_quote, writer);
+    EncodeOptional(bid_quote, writer);
+    EncodeOptional(spread, writer);
+}
+
+void EncodeSuccessReply(bool success, std::string& payload) {
+    BinaryWriter(payload).Write(static_cast<uint8_t>(success));
+}
+
+// Reads values of reply and throws if payload ends early
+class ReplyReader {
+   public:
+    explicit ReplyReader(std::string_view payload) : reader_(payload) {}
+
+    template <typename T>
+    T Read() {
+        T value;
+        if (!reader_.Read(value)) {
+            throw std::runtime_error("Malformed binary reply");
+        }
+        return value;
+    }
+
+    json ReadOptional() {
+        bool has_value = Read<uint8_t>() != 0;
+        int32_t value = Read<int32_t>();
+        return has_value ? json(value) : json(nullptr);
+    }
+
+    bool AtEnd() const { return reader_.Remaining() == 0; }
+
+    void ExpectEnd() const {
+        if (!AtEnd()) {
+            throw std::runtime_error("Malformed binary reply");
+        }
+    }
+
+   private:
+    BinaryReader reader_;
+};
+
+json DecodeBinaryReply(RequestKind kind, std::string_view payload) {
+    ReplyReader reader(payload);
+    json reply;
+    switch (kind) {
+        case RequestKind::REGISTRATION:
+        case RequestKind::LOGIN: {
+            bool success = reader.Read<uint8_t>() != 0;
+            uint64_t user_id = reader.Read<uint64_t>();
+            reply[json_field::TYPE] = kind == RequestKind::REGISTRATION
+                                          ? requests::REG_CONFIRMATION
+                                          : requests::LOGIN;
+            reply[json_field::SUCCESS] = success;
+            reply[json_field::USER_ID] =
+                success ? json(user_id) : json(nullptr);
+            if (!reader.AtEnd()) {
+                reply[json_field::COMPRESSION] = reader.Read<uint8_t>() != 0;
+            }
+            break;
+        }
+        case RequestKind::BALANCE:
+            reply[json_field::TYPE] = requests::BALANCE;
+            reply[json_field::USD] = reader.Read<int32_t>();
+            reply[json_field::RUB] = reader.Read<int32_t>();
+            break;
+        case RequestKind::ACTIVE_OFFERS: {
+            reply[json_field::TYPE] = requests::ACTIVE_OFFERS;
+            reply[json_field::BUY] = json::array();
+            reply[json_field::SELL] = json::array();
+            uint32_t count = reader.Read<uint32_t>();
+            for (uint32_t i = 0; i < count; ++i) {
+                uint64_t offer_id = reader.Read<uint64_t>();
+                uint8_t side = reader.Read<uint8_t>();
+                int32_t price = reader.Read<int32_t>();
+                uint64_t amount = reader.Read<uint64_t>();
+                reply[side == static_cast<uint8_t>(OfferType::BUY)
+                          ? json_field::BUY
+                          : json_field::SELL]
+                    .push_back({{json_field::OFFER_ID, offer_id},
+                                {json_field::PRICE, price},
+                                {json_field::AMOUNT, amount}});
+            }
+            break;
+        }
+        case RequestKind::CLOSED_DEALS: {
+            reply[json_field::TYPE] = requests::CLOSED_DEALS;
+            reply[json_field::BUY] = json::array();
+            reply[json_field::SELL] = json::array();
+            reply[json_field::BUY_SELL] = json::array();
+            uint32_t count = reader.Read<uint32_t>();
+            for (uint32_t i = 0; i < count; ++i) {
+                auto side = static_cast<DealSide>(reader.Read<uint8_t>());
+                int32_t price = reader.Read<int32_t>();
+                uint64_t amount = reader.Read<uint64_t>();
+                const std::string& field =
+                    side == DealSide::BUY    ? json_field::BUY
+                    : side == DealSide::SELL ? json_field::SELL
+                                             : json_field::BUY_SELL;
+                reply[field].push_back({{json_field::PRICE, price},
+                                        {json_field::AMOUNT, amount}});
+            }
+            break;
+        }
+        case RequestKind::POST_OFFER:
+            reply = "Offer was posted.";
+            break;
+        case RequestKind::QUOTES:
+            reply[json_field::TYPE] = requests::QUOTES;
+            reply[json_field::QUOTE] = reader.ReadOptional();
+            reply[json_field::ASK_QUOTE] = reader.ReadOptional();
+            reply[json_field::BID_QUOTE] = reader.ReadOptional();
+            reply[json_field::SPREAD] = reader.ReadOptional();
+            break;
+        case RequestKind::CANCEL:
+            reply[json_field::TYPE] = requests::CANCEL;
+            reply[json_field::SUCCESS] = reader.Read<uint8_t>() != 0;
+            break;
+        case RequestKind::METRICS:
+        case RequestKind::UNKNOWN:
+            return std::string(payload);
+        default:
+            throw std::runtime_error("Malformed binary reply");
+    }
+    reader.ExpectEnd();
+
+    return reply;
+}
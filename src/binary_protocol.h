@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "json.h"
+#include "offer.h"
+#include "request.h"
+
+// Compact alternative to json for programs talking to server. Connection
+// starts in json and switches to binary after json request
+// {"TYPE":"Protocol","PROTOCOL":"binary"} is confirmed by server.
+//
+// Every message is uint8 RequestKind, uint32 payload size and payload
+// (little-endian). Strings are uint32 size and bytes, sides of offers are
+// OfferType and optional values are uint8 flag and value.
+//
+// Requests:
+//   Reg, Log:            pw_hash u64, username string, optionally name of
+//                        compression string
+//   PostOffer:           side u8, price i32, amount u64
+//   Cancel:              offer_id u64
+//   Balance, Active,
+//   Deal, Quotes,
+//   Metrics:             empty
+//
+// Replies have kind of request:
+//   Reg, Log:            success u8, user_id u64, if compression was
+//                        requested u8 whether it is used
+//   Balance:             usd i32, rub i32
+//   Active:              count u32, count times offer_id u64, side u8,
+//                        price i32, amount u64
+//   Deal:                count u32, count times DealSide u8, price i32,
+//                        amount u64
+//   PostOffer:           empty
+//   Quotes:              quote, ask, bid and spread as optional i32
+//   Cancel:              success u8
+//   Metrics:             text as in json protocol
+// Request that can not be handled is answered with UNKNOWN message holding
+// error text, see GetRequestErrorText. Requests act on behalf of user
+// registered or logged in on the connection.
+//
+// Once compression is accepted, replies of at least the threshold size are
+// sent compressed in both protocols, unless that does not make them smaller.
+// Compressed message has kind of reply with compressed_message_flag set and
+// payload of uint32 size of original payload and its LZ4 block. Original
+// payload of json reply is its text, json never starts with such byte.
+
+enum class Protocol : uint8_t {
+    JSON,
+    BINARY,
+};
+
+std::optional<Protocol> GetProtocol(const std::string& name);
+
+// Side of closed deal from the point of view of user who requested it
+enum class DealSide : uint8_t {
+    BUY,
+    SELL,
+    BUY_SELL,
+};
+
+// Messages above this size are not accepted
+static constexpr uint32_t max_binary_message_size = 1 << 20;
+
+static constexpr size_t binary_header_size =
+    sizeof(RequestKind) + sizeof(uint32_t);
+
+static constexpr uint8_t compressed_message_flag = 0x80;
+
+void AppendBinaryMessage(RequestKind kind, std::string_view payload,
+                         std::string& buffer);
+
+// Reserves header of message whose payload is appended to buffer afterwards
+// and returns its offset. EndBinaryMessage fills the header once kind and
+// size of payload are known.
+size_t BeginBinaryMessage(std::string& buffer);
+
+void EndBinaryMessage(RequestKind kind, size_t offset, std::string& buffer);
+
+// Decodes message from beginning of data. Returns number of consumed bytes or
+// 0 if data holds incomplete message.
+size_t DecodeBinaryMessage(std::string_view data, RequestKind& kind,
+                           std::string_view& payload);
+
+// Returns true if data starts with header of message larger than
+// max_binary_message_size
+bool ExceedsBinaryMessageSize(std::string_view data);
+
+// Appends compressed message with given payload. Returns false and leaves
+// buffer untouched if message would not be smaller than payload.
+bool AppendCompressedMessage(RequestKind kind, std::string_view payload,
+                             std::string& buffer);
+
+// Returns true if kind of message has compressed_message_flag, which is
+// cleared
+bool TakeCompressionFlag(RequestKind& kind);
+
+// Appends original payload of compressed message to output. Returns false if
+// payload is malformed.
+bool DecompressPayload(std::string_view payload, std::string& output);
+
+// Appends whole message. Throws std::invalid_argument for kinds that have no
+// binary form.
+void AppendBinaryRequest(const Request& request, std::string& buffer);
+
+// Same for request in json form, also throws std::invalid_argument if it is
+// not valid
+void AppendBinaryRequest(const nlohmann::json& request, std::string& buffer);
+
+// Never throws. Request is set only if payload matches layout of kind and
+// its fields are valid.
+RequestError DecodeBinaryRequest(RequestKind kind, std::string_view payload,
+                                 Request& request);
+
+// Reply payloads, see layouts above
+// Compression is set if it was requested
+void EncodeAuthReply(const std::optional<uint64_t>& user_id,
+                     const std::optional<bool>& compression,
+                     std::string& payload);
+
+void EncodeBalanceReply(int usd, int rub, std::string& payload);
+
+void EncodeListSize(size_t size, std::string& payload);
+
+void EncodeOfferEntry(uint64_t offer_id, OfferType type, int price,
+                      size_t amount, std::string& payload);
+
+void EncodeDealEntry(DealSide side, int price, size_t amount,
+                     std::string& payload);
+
+void EncodeQuotesReply(const std::optional<int>& quote,
+                       const std::optional<int>& ask_quote,
+                       const std::optional<int>& bid_quote,
+                       const std::optional<int>& spread, std::string& payload);
+
+void EncodeSuccessReply(bool success, std::string& payload);
+
+// Converts reply to json server would send in json protocol, so that clients
+// handle replies the same way in both protocols. Throws std::runtime_error if
+// payload is malformed.
+nlohmann::json DecodeBinaryReply(RequestKind kind, std::string_view payload);
@@ -0,0 +1,75 @@
+#include "capture.h"
+
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+
+#include "common.h"
+#include "server_options.h"
+
+using nlohmann::json;
+
+RequestCapture::RequestCapture(const std::string& path)
+    : file_(std::fopen(path.c_str(), "w")),
+      start_(std::chrono::steady_clock::now()) {
+    if (file_ == nullptr) {
+        throw std::runtime_error("Unable to open capture " + path);
+    }
+}
+
+RequestCapture::~RequestCapture() { std::fclose(file_); }
+
+void RequestCapture::Write(json request) {
+    request[json_field::TIME_US] =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_)
+            .count();
+    // Requests are validated to be utf-8, replace is a last line of defence
+    // against dump throwing on request path
+    std::string line =
+        request.dump(-1, ' ', false, json::error_handler_t::replace);
+    line += '\n';
+    std::fwrite(line.data(), 1, line.size(), file_);
+}
+
+void RequestCapture::Flush() { std::fflush(file_); }
+
+RequestCapture* GetRequestCapture() {
+    static std::unique_ptr<RequestCapture> capture =
+        GetServerOptions().capture_path.empty()
+            ? nullptr
+            : std::make_unique<RequestCapture>(GetServerOptions().capture_path);
+    return capture.get();
+}
+
+void ReadCapture(
+    const std::string& path,
+    const std::function<void(std::chrono::microseconds time,
+                             json& request)>& handler) {
+    std::ifstream input(path);
+    if (!input) {
+        throw std::runtime_error("Unable to open capture " + path);
+    }
+
+    std::string line;
+    size_t line_number = 0;
+    std::chrono::microseconds time(0);
+    while (std::getline(input, line)) {
+        ++line_number;
+        if (line.empty()) {
+            continue;
+        }
+        json request = json::parse(line, nullptr, false);
+        if (!request.is_object() || !request.contains(json_field::TYPE)) {
+            throw std::runtime_error("Invalid request at line " +
+                                     std::to_string(line_number));
+        }
+        // Requests without time are sent right after previous one
+        if (request.contains(json_field::TIME_US)) {
+            time = std::chrono::microseconds(
+                request[json_field::TIME_US].get<int64_t>());
+            request.erase(json_field::TIME_US);
+        }
+        handler(time, request);
+    }
+}
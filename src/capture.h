@@ -0,0 +1,41 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+#include "json.h"
+
+// Capture is a JSONL file with one request per line, as received by server,
+// with TIME_US field added: microseconds since capture was started.
+
+class RequestCapture {
+   public:
+    explicit RequestCapture(const std::string& path);
+
+    ~RequestCapture();
+
+    RequestCapture(const RequestCapture&) = delete;
+
+    RequestCapture& operator=(const RequestCapture&) = delete;
+
+    void Write(nlohmann::json request);
+
+    void Flush();
+
+   private:
+    std::FILE* file_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Capture of server.out, nullptr unless it was started with --capture
+RequestCapture* GetRequestCapture();
+
+// Calls handler for every request of capture with its time, TIME_US field
+// is removed from request. Throws if file can not be read or has invalid
+// line.
+void ReadCapture(
+    const std::string& path,
+    const std::function<void(std::chrono::microseconds time,
+                             nlohmann::json& request)>& handler);
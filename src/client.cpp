@@ -1,8 +1,5 @@
 #include "client.h"
 
-#include <boost/asio/buffer.hpp>
-#include <boost/asio/streambuf.hpp>
-#include <boost/asio/write.hpp>
 #include <cstdint>
 #include <iostream>
 #include <ostream>
@@ -15,8 +12,14 @@
 using namespace boost::asio;
 using nlohmann::json;
 
-Client::Client(ip::tcp::socket&& socket) : socket_(std::move(socket)) {
+Client::Client(ip::tcp::socket&& socket, bool use_binary_protocol,
+               bool use_compression)
+    : use_compression_(use_compression), connection_(std::move(socket)) {
     std::cout << "Welcome to StepStock Market!\n" << std::endl;
+    if (use_binary_protocol && !connection_.UseBinaryProtocol()) {
+        std::cout << "Server does not support binary protocol, using json."
+                  << std::endl;
+    }
     ProcessAuthentication();
     Poll();
 }
@@ -43,55 +46,39 @@ void Client::ProcessAuthentication() {
 }
 
 void Client::Register() {
-    AuthInfo auth_info = GetAuthInfo();
-
-    json request;
-    request[json_field::TYPE] = requests::REGISTRATION;
-    request[json_field::USERNAME] = auth_info.username;
-    request[json_field::PW_HASH] = std::hash<std::string>{}(auth_info.password);
-
-    auto request_str = request.dump();
-    write(socket_, buffer(request_str, request_str.size()));
-    auto registration_result = ReadAuthResponse();
-    if (!registration_result) {
+    if (!Authenticate(requests::REGISTRATION)) {
         std::cout << "User with this username already exist. Try again."
                   << std::endl;
         ProcessAuthentication();
-    } else {
-        id_ = *registration_result;
     }
 }
 
 void Client::Login() {
+    if (!Authenticate(requests::LOGIN)) {
+        std::cout << "Wrong username or password. Try again." << std::endl;
+        ProcessAuthentication();
+    }
+}
+
+// Server binds connection to authenticated user, so later requests do not
+// name user
+bool Client::Authenticate(const std::string& request_type) {
     AuthInfo auth_info = GetAuthInfo();
 
     json request;
-    request[json_field::TYPE] = requests::LOGIN;
+    request[json_field::TYPE] = request_type;
     request[json_field::USERNAME] = auth_info.username;
     request[json_field::PW_HASH] = std::hash<std::string>{}(auth_info.password);
-
-    auto request_str = request.dump();
-    write(socket_, buffer(request_str, request_str.size()));
-    auto registration_result = ReadAuthResponse();
-    if (!registration_result) {
-        std::cout << "Wrong username or password. Try again." << std::endl;
-        ProcessAuthentication();
-    } else {
-        id_ = *registration_result;
+    if (use_compression_) {
+        request[json_field::COMPRESSION] = compressions::LZ4;
     }
-}
 
-std::optional<uint64_t> Client::ReadAuthResponse() {
-    streambuf buff;
-    read_until(socket_, buff, "\0");
-    std::istream input(&buff);
-    std::string line(std::istreambuf_iterator<char>(input), {});
-    json registration_response = json::parse(line);
-    if (registration_response.at(json_field::SUCCESS)) {
-        return registration_response.at(json_field::USER_ID);
-    } else {
-        return std::nullopt;
+    json registration_response = connection_.Send(request);
+    if (registration_response.contains(json_field::COMPRESSION) &&
+        !registration_response.at(json_field::COMPRESSION)) {
+        std::cout << "Server does not support compression." << std::endl;
     }
+    return registration_response.at(json_field::SUCCESS).get<bool>();
 }
 
 // Main menu of application
@@ -123,7 +110,7 @@ void Client::Poll() {
                 return;
             default:
                 auto request_handler =
-                    MakeRequest(static_cast<RequestType>(option), socket_, id_);
+                    MakeRequest(static_cast<RequestType>(option), connection_);
                 if (request_handler) {
                     request_handler->Handle();
                 } else {
@@ -7,11 +7,17 @@
 #include <limits>
 #include <string>
 
+#include "json.h"
+#include "server_connection.h"
+
 // Class that provides client front end for users
 // communication with server
 class Client {
    public:
-    Client(boost::asio::ip::tcp::socket&& socket);
+    // Binary protocol and compression are used if they are requested and
+    // server supports them
+    Client(boost::asio::ip::tcp::socket&& socket, bool use_binary_protocol,
+           bool use_compression);
 
    private:
     struct AuthInfo {
@@ -25,15 +31,16 @@ class Client {
 
     void Login();
 
-    std::optional<uint64_t> ReadAuthResponse();
+    // Returns true if authentication succeeded
+    bool Authenticate(const std::string& request_type);
 
     void Poll();
 
     AuthInfo GetAuthInfo();
 
    private:
-    uint64_t id_;
-    boost::asio::ip::tcp::socket socket_;
+    bool use_compression_;
+    ServerConnection connection_;
 };
 
 // Safe int input function that checks input
@@ -10,7 +10,21 @@
 
 using namespace boost::asio;
 
-int main() {
+int main(int argc, char** argv) {
+    bool use_binary_protocol = false;
+    bool use_compression = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--binary") {
+            use_binary_protocol = true;
+        } else if (std::string(argv[i]) == "--compress") {
+            use_compression = true;
+        } else {
+            std::cout << "Usage: client.out [--binary] [--compress]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
     try {
         io_service io_service;
         ip::tcp::resolver resolver(io_service);
@@ -22,7 +36,7 @@ int main() {
         ip::tcp::socket socket(io_service);
         socket.connect(*it);
 
-        Client client(std::move(socket));
+        Client client(std::move(socket), use_binary_protocol, use_compression);
     } catch (std::exception& er) {
         std::cout << "ERROR: " << er.what() << std::endl;
     }
@@ -16,6 +16,8 @@ static inline const std::string POST_OFFER = "PostOffer";
 static inline const std::string QUOTES = "Quotes";
 static inline const std::string CANCEL = "Cancel";
 static inline const std::string LOGIN = "Log";
+static inline const std::string METRICS = "Metrics";
+static inline const std::string PROTOCOL = "Protocol";
 
 }  // namespace requests
 // namespace requests
@@ -42,5 +44,24 @@ static inline const std::string ASK_QUOTE = "ASK_QUOTE";
 static inline const std::string BID_QUOTE = "BID_QUOTE";
 static inline const std::string SPREAD = "SPREAD";
 static inline const std::string PW_HASH = "PW_HASH";
+static inline const std::string PROTOCOL = "PROTOCOL";
+static inline const std::string COMPRESSION = "COMPRESSION";
+// Microseconds since start of capture, only in captured requests
+static inline const std::string TIME_US = "TIME_US";
 
 }  // namespace json_field
+
+// Wire protocols that can be requested for connection
+namespace protocols {
+
+static inline const std::string JSON = "json";
+static inline const std::string BINARY = "binary";
+
+}  // namespace protocols
+
+// Compression of replies that can be requested at login
+namespace compressions {
+
+static inline const std::string LZ4 = "lz4";
+
+}  // namespace compressions
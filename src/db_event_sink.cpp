@@ -0,0 +1,60 @@
+#include "db_event_sink.h"
+
+#include <cstdint>
+#include <string>
+
+#include "db_manager.h"
+#include "offer.h"
+#include "snapshot.h"
+
+void DBEventSink::OnUserRegistered(uint64_t user_id,
+                                   const std::string& username,
+                                   size_t pw_hash) {
+    GetDBManager().FlushExpired();
+    GetDBManager().AddUser(user_id, username, pw_hash);
+}
+
+// Deposits are not stored in db. Market restored from db gets them from
+// command journal.
+void DBEventSink::OnDeposit(uint64_t, Currency, size_t) {}
+
+// Trades of offer follow it in the same batch
+void DBEventSink::OnOfferAccepted(const Offer& offer) {
+    GetDBManager().FlushExpired();
+    GetDBManager().AddOffer(offer.GetId(), offer.GetOwnerId(), offer.GetType(),
+                            offer.GetAmount(), offer.GetPrice());
+}
+
+void DBEventSink::OnTrade(const Deal& deal, const Offer& taker,
+                          const Offer& maker) {
+    GetDBManager().AddDeal(deal.GetId(), deal.GetSeller(), deal.GetBuyer(),
+                           deal.GetAmount(), deal.GetPrice());
+    GetDBManager().UpdateOffer(taker.GetId(), taker.GetAmount());
+    GetDBManager().UpdateOffer(maker.GetId(), maker.GetAmount());
+}
+
+void DBEventSink::OnOfferCanceled(uint64_t, uint64_t offer_id) {
+    GetDBManager().FlushExpired();
+    GetDBManager().CancelOffer(offer_id);
+}
+
+void DBEventSink::OnSnapshotRestored(const SnapshotView& snapshot) {
+    for (const SnapshotUser& user : snapshot.users) {
+        GetDBManager().AddUser(
+            user.id,
+            std::string(snapshot.usernames.substr(user.username_offset,
+                                                  user.username_size)),
+            user.pw_hash);
+    }
+    // Initial amount of offers is unknown, remaining one is stored instead
+    for (const SnapshotOffer& offer : snapshot.offers) {
+        GetDBManager().AddOffer(offer.id, offer.owner_id,
+                                static_cast<OfferType>(offer.type),
+                                offer.amount, offer.price);
+    }
+    for (const SnapshotDeal& deal : snapshot.deals) {
+        GetDBManager().AddDeal(deal.id, deal.seller_id, deal.buyer_id,
+                               deal.amount, deal.price);
+    }
+    GetDBManager().Flush();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "market_events.h"
+#include "snapshot.h"
+
+// Sink that persists market events to database. Pending batch is committed
+// when the next command starts, so that db holds a prefix of commands.
+class DBEventSink final : public MarketEventSink {
+   public:
+    void OnUserRegistered(uint64_t user_id, const std::string& username,
+                          size_t pw_hash) override;
+
+    void OnDeposit(uint64_t user_id, Currency currency, size_t amount) override;
+
+    void OnOfferAccepted(const Offer& offer) override;
+
+    void OnTrade(const Deal& deal, const Offer& taker,
+                 const Offer& maker) override;
+
+    void OnOfferCanceled(uint64_t user_id, uint64_t offer_id) override;
+
+    // Persists state market was restored to from snapshot. Balances are
+    // not stored, as deposits are not, and offers that were finished or
+    // canceled before snapshot are not part of it.
+    void OnSnapshotRestored(const SnapshotView& snapshot);
+};
@@ -1,15 +1,70 @@
 #include "db_manager.h"
 
+#include <chrono>
 #include <cstdint>
 #include <format>
+#include <functional>
+#include <iterator>
 #include <iostream>
-#include <optional>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 #include "logger.h"
 #include "offer.h"
 
-DBManager::DBManager(std::ostream& log_output) : logger_(log_output) {
+// Schema migrations. Migration with index i moves schema from version i to
+// version i + 1. Applied migrations must never be changed, new ones are
+// appended to the end. Kept as constant initialized array since DBManager is
+// created during static initialization.
+static constexpr const char* migrations[] = {
+    // 1: initial schema
+    "CREATE TABLE IF NOT EXISTS User ("
+    "  ID        INT PRIMARY KEY NOT NULL,"
+    "  USERNAME  TEXT NOT NULL,"
+    "  PW_HASH   INT NOT NULL"
+    ");"
+    "CREATE TABLE IF NOT EXISTS Deal ("
+    "  ID         INT PRIMARY KEY NOT NULL,"
+    "  SELLER_ID  INT NOT NULL,"
+    "  BUYER_ID   INT NOT NULL,"
+    "  AMOUNT     INT NOT NULL,"
+    "  PRICE      INT NOT NULL"
+    ");"
+    "CREATE TABLE IF NOT EXISTS Offer ("
+    "  ID         INT PRIMARY KEY NOT NULL,"
+    "  OWNER_ID   INT NOT NULL,"
+    "  TYPE       BOOL NOT NULL,"
+    "  AMOUNT     INT NOT NULL,"
+    "  PRICE      INT NOT NULL"
+    ");",
+
+    // 2: indexes for per-user history and username lookups
+    "CREATE INDEX IF NOT EXISTS OfferOwnerIndex ON Offer(OWNER_ID, ID);"
+    "CREATE INDEX IF NOT EXISTS DealSellerIndex ON Deal(SELLER_ID, ID);"
+    "CREATE INDEX IF NOT EXISTS DealBuyerIndex ON Deal(BUYER_ID, ID);"
+    "CREATE INDEX IF NOT EXISTS UserUsernameIndex ON User(USERNAME);",
+
+    // 3: state of offers for warm restart. State of offers posted before
+    // this migration is unknown, so they are considered inactive.
+    "ALTER TABLE Offer ADD COLUMN REMAINING INT NOT NULL DEFAULT 0;"
+    "ALTER TABLE Offer ADD COLUMN ACTIVE BOOL NOT NULL DEFAULT 0;"
+    "CREATE INDEX IF NOT EXISTS ActiveOfferIndex ON Offer(ID) WHERE ACTIVE;",
+};
+
+// Handle and statements are released if construction fails halfway, as
+// destructor is not run then
+DBManager::DBManager(std::ostream& log_output, const std::string& db_path)
+    : logger_(log_output) {
+    try {
+        Open(db_path);
+    } catch (...) {
+        Close();
+        throw;
+    }
+}
+
+void DBManager::Open(const std::string& db_path) {
     int db_error;
 
     db_error = sqlite3_open(db_path.c_str(), &db_);
@@ -18,91 +73,159 @@ DBManager::DBManager(std::ostream& log_output) : logger_(log_output) {
         throw std::runtime_error("Unable to connect to db.");
     }
 
-    std::string create_user_query =
-        "  CREATE TABLE IF NOT EXISTS User("
-        "  ID        INT PRIMARY KEY NOT NULL,"
-        "  USERNAME  TEXT NOT NULL,"
-        "  PW_HASH   INT NOT NULL"
-        ");";
-
-    std::string create_deal_query =
-        "CREATE TABLE IF NOT EXISTS Deal ("
-        "  ID         INT PRIMARY KEY NOT NULL,"
-        "  SELLER_ID  INT NOT NULL,"
-        "  BUYER_ID   INT NOT NULL,"
-        "  AMOUNT     INT NOT NULL,"
-        "  PRICE      INT NOT NULL"
-        ");";
-
-    std::string create_offer_query =
-        "CREATE TABLE IF NOT EXISTS Offer ("
-        "  ID         INT PRIMARY KEY NOT NULL,"
-        "  OWNER_ID   INT NOT NULL,"
-        "  TYPE       BOOL NOT NULL,"
-        "  AMOUNT     INT NOT NULL,"
-        "  PRICE      INT NOT NULL"
-        ");";
-
-    sqlite3_exec(db_, create_user_query.c_str(), NULL, NULL, NULL);
-    sqlite3_exec(db_, create_deal_query.c_str(), NULL, NULL, NULL);
-    sqlite3_exec(db_, create_offer_query.c_str(), NULL, NULL, NULL);
+    db_error = sqlite3_exec(db_, "PRAGMA journal_mode=WAL;", NULL, NULL, NULL);
+    if (db_error) {
+        logger_.Log(LogType::WARNING,
+                    "Unable to switch db journal to WAL mode");
+    }
+
+    Migrate();
+
+    add_offer_stmt_ = Prepare(
+        "INSERT INTO Offer(ID, OWNER_ID, TYPE, AMOUNT, PRICE, REMAINING, "
+        "ACTIVE) VALUES(?1, ?2, ?3, ?4, ?5, ?4, 1);");
+    update_offer_stmt_ = Prepare(
+        "UPDATE Offer SET REMAINING = ?2, ACTIVE = (?2 > 0) WHERE ID = ?1;");
+    cancel_offer_stmt_ =
+        Prepare("UPDATE Offer SET ACTIVE = 0 WHERE ID = ? AND ACTIVE;");
+    add_deal_stmt_ = Prepare("INSERT INTO Deal VALUES(?, ?, ?, ?, ?);");
+    add_user_stmt_ = Prepare("INSERT INTO User VALUES(?, ?, ?);");
+    get_users_stmt_ = Prepare("SELECT ID, USERNAME, PW_HASH FROM User;");
+    get_active_offers_stmt_ = Prepare(
+        "SELECT ID, OWNER_ID, TYPE, REMAINING, PRICE FROM Offer "
+        "WHERE ACTIVE ORDER BY ID;");
+    get_deals_stmt_ = Prepare(
+        "SELECT ID, SELLER_ID, BUYER_ID, AMOUNT, PRICE FROM Deal ORDER BY ID;");
+    get_user_offers_stmt_ = Prepare(
+        "SELECT ID, OWNER_ID, TYPE, AMOUNT, PRICE FROM Offer "
+        "WHERE OWNER_ID = ?1 ORDER BY ID;");
+    get_user_deals_stmt_ = Prepare(
+        "SELECT ID, SELLER_ID, BUYER_ID, AMOUNT, PRICE FROM Deal "
+        "WHERE SELLER_ID = ?1 "
+        "UNION ALL "
+        "SELECT ID, SELLER_ID, BUYER_ID, AMOUNT, PRICE FROM Deal "
+        "WHERE BUYER_ID = ?1 AND SELLER_ID != ?1 "
+        "ORDER BY ID;");
+    begin_stmt_ = Prepare("BEGIN;");
+    commit_stmt_ = Prepare("COMMIT;");
+    for (const char* table : {"User", "Deal", "Offer"}) {
+        max_id_stmts_[table] =
+            Prepare(std::format("SELECT MAX(ID) FROM {};", table));
+    }
 
     logger_.Log(LogType::INFO, "DB connection established");
 }
 
 void DBManager::AddOffer(uint64_t offer_id, uint64_t owner_id,
                          OfferType offer_type, size_t amount, int price) {
-    std::string query = std::format(
-        "INSERT INTO Offer VALUES({}, {}, {}, {}, {});", offer_id, owner_id,
-        static_cast<int>(offer_type == OfferType::BUY), amount, price);
-    int db_error = sqlite3_exec(db_, query.c_str(), NULL, NULL, NULL);
+    sqlite3_bind_int64(add_offer_stmt_, 1, offer_id);
+    sqlite3_bind_int64(add_offer_stmt_, 2, owner_id);
+    sqlite3_bind_int(add_offer_stmt_, 3, offer_type == OfferType::BUY);
+    sqlite3_bind_int64(add_offer_stmt_, 4, amount);
+    sqlite3_bind_int(add_offer_stmt_, 5, price);
+
+    BeginWrite();
+    int db_error = Execute(add_offer_stmt_);
+    EndWrite();
     if (db_error) {
         logger_.Log(
             LogType::WARNING,
             std::format("Failed to add offer with id {} to db", offer_id));
     } else {
-        logger_.Log(LogType::INFO,
-                    std::format("Offer with id {} was added to db", offer_id));
+        logger_.Log<LogType::DEBUG>("Offer with id {} was added to db",
+                                    offer_id);
+    }
+}
+
+void DBManager::UpdateOffer(uint64_t offer_id, size_t remaining) {
+    sqlite3_bind_int64(update_offer_stmt_, 1, offer_id);
+    sqlite3_bind_int64(update_offer_stmt_, 2, remaining);
+
+    BeginWrite();
+    int db_error = Execute(update_offer_stmt_);
+    EndWrite();
+    if (db_error) {
+        logger_.Log(
+            LogType::WARNING,
+            std::format("Failed to update offer with id {} in db", offer_id));
+    } else {
+        logger_.Log<LogType::DEBUG>("Offer with id {} was updated in db",
+                                    offer_id);
+    }
+}
+
+void DBManager::CancelOffer(uint64_t offer_id) {
+    sqlite3_bind_int64(cancel_offer_stmt_, 1, offer_id);
+
+    BeginWrite();
+    int db_error = Execute(cancel_offer_stmt_);
+    EndWrite();
+    if (db_error) {
+        logger_.Log(
+            LogType::WARNING,
+            std::format("Failed to cancel offer with id {} in db", offer_id));
+    } else {
+        logger_.Log<LogType::DEBUG>("Offer with id {} was canceled in db",
+                                    offer_id);
     }
 }
 
 void DBManager::AddDeal(uint64_t deal_id, uint64_t seller_id, uint64_t buyer_id,
                         size_t amount, int price) {
-    std::string query =
-        std::format("INSERT INTO Deal VALUES({}, {}, {}, {}, {})", deal_id,
-                    seller_id, buyer_id, amount, price);
-    int db_error = sqlite3_exec(db_, query.c_str(), NULL, NULL, NULL);
+    sqlite3_bind_int64(add_deal_stmt_, 1, deal_id);
+    sqlite3_bind_int64(add_deal_stmt_, 2, seller_id);
+    sqlite3_bind_int64(add_deal_stmt_, 3, buyer_id);
+    sqlite3_bind_int64(add_deal_stmt_, 4, amount);
+    sqlite3_bind_int(add_deal_stmt_, 5, price);
+
+    BeginWrite();
+    int db_error = Execute(add_deal_stmt_);
+    EndWrite();
     if (db_error) {
         logger_.Log(
             LogType::WARNING,
             std::format("Failed to add deal with id {} to db", deal_id));
     } else {
-        logger_.Log(LogType::INFO,
-                    std::format("Deal with id {} was added to db", deal_id));
+        logger_.Log<LogType::DEBUG>("Deal with id {} was added to db", deal_id);
     }
 }
 
 void DBManager::AddUser(uint64_t user_id, const std::string& username,
                         size_t pw_hash) {
-    std::string query = std::format("INSERT INTO User VALUES({}, \"{}\", {});",
-                                    user_id, username, pw_hash);
-    int db_error = sqlite3_exec(db_, query.c_str(), NULL, NULL, NULL);
+    sqlite3_bind_int64(add_user_stmt_, 1, user_id);
+    sqlite3_bind_text(add_user_stmt_, 2, username.c_str(), username.size(),
+                      SQLITE_STATIC);
+    sqlite3_bind_int64(add_user_stmt_, 3, pw_hash);
+
+    BeginWrite();
+    int db_error = Execute(add_user_stmt_);
+    EndWrite();
     if (db_error) {
         logger_.Log(
             LogType::WARNING,
             std::format("Failed to add user with id {} to db", user_id));
     } else {
-        logger_.Log(LogType::INFO,
-                    std::format("User with id {} was added to db", user_id));
+        logger_.Log<LogType::DEBUG>("User with id {} was added to db", user_id);
     }
 }
 
 int DBManager::GetMaxId(const std::string& table) {
+    auto stmt = max_id_stmts_.find(table);
+    if (stmt == max_id_stmts_.end()) {
+        logger_.Log(LogType::ERROR,
+                    std::format("Unable to init id for table {}", table));
+        return 0;
+    }
+
     int id = -1;
-    std::string query = std::format("SELECT MAX(ID) FROM {};", table);
-    int db_error =
-        sqlite3_exec(db_, query.c_str(), GetMaxIdCallback, &id, NULL);
-    if (db_error) {
+    int db_error = sqlite3_step(stmt->second);
+    if (db_error == SQLITE_ROW &&
+        sqlite3_column_type(stmt->second, 0) != SQLITE_NULL) {
+        id = sqlite3_column_int(stmt->second, 0);
+    }
+    sqlite3_reset(stmt->second);
+
+    if (db_error != SQLITE_ROW) {
         logger_.Log(LogType::ERROR,
                     std::format("Unable to init id for table {}", table));
     } else {
@@ -113,73 +236,261 @@ int DBManager::GetMaxId(const std::string& table) {
     return id + 1;
 }
 
-int DBManager::GetMaxIdCallback(void* id, int, char** data, char**) {
-    if (data == nullptr || data[0] == nullptr) {
-        return 0;
+void DBManager::LoadUsers(
+    const std::function<void(const UserRecord&)>& callback) {
+    auto start = std::chrono::steady_clock::now();
+    size_t count = 0;
+    int db_error;
+    while ((db_error = sqlite3_step(get_users_stmt_)) == SQLITE_ROW) {
+        callback({.id = static_cast<uint64_t>(
+                      sqlite3_column_int64(get_users_stmt_, 0)),
+                  .username = reinterpret_cast<const char*>(
+                      sqlite3_column_text(get_users_stmt_, 1)),
+                  .pw_hash = static_cast<size_t>(
+                      sqlite3_column_int64(get_users_stmt_, 2))});
+        ++count;
     }
+    sqlite3_reset(get_users_stmt_);
 
-    int* max_id = (int*)id;
-    *max_id = std::stoi(data[0]);
+    LogLoadResult(db_error, "users", count, start);
+}
+
+void DBManager::LoadActiveOffers(
+    const std::function<void(const OfferRecord&)>& callback) {
+    auto start = std::chrono::steady_clock::now();
+    size_t count = 0;
+    int db_error;
+    while ((db_error = sqlite3_step(get_active_offers_stmt_)) == SQLITE_ROW) {
+        callback(ReadOfferRecord(get_active_offers_stmt_));
+        ++count;
+    }
+    sqlite3_reset(get_active_offers_stmt_);
 
-    return 0;
+    LogLoadResult(db_error, "active offers", count, start);
 }
 
-int DBManager::UsernameExistCallback(void* exist, int, char** data, char**) {
-    int* exist_ = (int*)exist;
-    *exist_ = std::stoi(data[0]);
+void DBManager::LoadDeals(
+    const std::function<void(const DealRecord&)>& callback) {
+    auto start = std::chrono::steady_clock::now();
+    size_t count = 0;
+    int db_error;
+    while ((db_error = sqlite3_step(get_deals_stmt_)) == SQLITE_ROW) {
+        callback(ReadDealRecord(get_deals_stmt_));
+        ++count;
+    }
+    sqlite3_reset(get_deals_stmt_);
 
-    return 0;
+    LogLoadResult(db_error, "deals", count, start);
 }
 
-bool DBManager::UsernameExist(const std::string& username) {
-    std::string query = std::format(
-        "SELECT EXISTS(SELECT 1 FROM User WHERE USERNAME=\"{}\" LIMIT 1);",
-        username);
+std::vector<OfferRecord> DBManager::GetUserOffers(uint64_t owner_id) {
+    std::vector<OfferRecord> offers;
+    sqlite3_bind_int64(get_user_offers_stmt_, 1, owner_id);
+    int db_error;
+    while ((db_error = sqlite3_step(get_user_offers_stmt_)) == SQLITE_ROW) {
+        offers.push_back(ReadOfferRecord(get_user_offers_stmt_));
+    }
+    sqlite3_reset(get_user_offers_stmt_);
+    sqlite3_clear_bindings(get_user_offers_stmt_);
 
-    int exist;
-    int db_error =
-        sqlite3_exec(db_, query.c_str(), UsernameExistCallback, &exist, NULL);
-    if (db_error) {
-        logger_.Log(LogType::WARNING, "Could not find out if username exist");
+    if (db_error != SQLITE_DONE) {
+        logger_.Log(LogType::WARNING,
+                    std::format("Unable to load offers of user {}", owner_id));
+    }
+
+    return offers;
+}
+
+std::vector<DealRecord> DBManager::GetUserDeals(uint64_t user_id) {
+    std::vector<DealRecord> deals;
+    sqlite3_bind_int64(get_user_deals_stmt_, 1, user_id);
+    int db_error;
+    while ((db_error = sqlite3_step(get_user_deals_stmt_)) == SQLITE_ROW) {
+        deals.push_back(ReadDealRecord(get_user_deals_stmt_));
+    }
+    sqlite3_reset(get_user_deals_stmt_);
+    sqlite3_clear_bindings(get_user_deals_stmt_);
+
+    if (db_error != SQLITE_DONE) {
+        logger_.Log(LogType::WARNING,
+                    std::format("Unable to load deals of user {}", user_id));
+    }
+
+    return deals;
+}
+
+OfferRecord DBManager::ReadOfferRecord(sqlite3_stmt* stmt) {
+    return {.id = static_cast<uint64_t>(sqlite3_column_int64(stmt, 0)),
+            .owner_id = static_cast<uint64_t>(sqlite3_column_int64(stmt, 1)),
+            .type = sqlite3_column_int(stmt, 2) ? OfferType::BUY
+                                                : OfferType::SELL,
+            .amount = static_cast<size_t>(sqlite3_column_int64(stmt, 3)),
+            .price = sqlite3_column_int(stmt, 4)};
+}
+
+DealRecord DBManager::ReadDealRecord(sqlite3_stmt* stmt) {
+    return {.id = static_cast<uint64_t>(sqlite3_column_int64(stmt, 0)),
+            .seller_id = static_cast<uint64_t>(sqlite3_column_int64(stmt, 1)),
+            .buyer_id = static_cast<uint64_t>(sqlite3_column_int64(stmt, 2)),
+            .amount = static_cast<size_t>(sqlite3_column_int64(stmt, 3)),
+            .price = sqlite3_column_int(stmt, 4)};
+}
+
+void DBManager::LogLoadResult(int db_error, const std::string& table,
+                              size_t count,
+                              std::chrono::steady_clock::time_point start) {
+    if (db_error != SQLITE_DONE) {
+        logger_.Log(LogType::ERROR, std::format("Unable to load {} from db",
+                                                table));
     } else {
-        logger_.Log(LogType::INFO, "Found out if username exist");
+        logger_.Log(
+            LogType::INFO,
+            std::format("Loaded {} {} from db in {} ms", count, table,
+                        std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::steady_clock::now() - start)
+                            .count()));
     }
+}
 
-    return exist;
+void DBManager::FlushExpired() {
+    if (batch_size_ >= max_batch_size ||
+        (batch_size_ != 0 &&
+         std::chrono::steady_clock::now() - batch_start_ >= max_batch_delay)) {
+        Commit();
+    }
 }
 
-int DBManager::GetUserIdCallback(void* id, int, char** data, char**) {
-    if (data == nullptr || data[0] == nullptr) {
-        return 0;
+void DBManager::Flush() {
+    if (batch_size_ != 0) {
+        Commit();
+    }
+}
+
+void DBManager::BeginWrite() {
+    if (batch_size_ != 0) {
+        return;
     }
-    int* user_id = (int*)id;
-    *user_id = std::stoi(data[0]);
 
-    return 0;
+    int db_error = Execute(begin_stmt_);
+    if (db_error) {
+        logger_.Log(LogType::WARNING, "Unable to begin write batch");
+    }
+    batch_start_ = std::chrono::steady_clock::now();
 }
 
-std::optional<uint64_t> DBManager::GetUserId(const std::string& username,
-                                             size_t pw_hash) {
-    std::string query = std::format(
-        "SELECT * FROM User WHERE (USERNAME = \"{}\" AND PW_HASH = {}) LIMIT "
-        "1;",
-        username, pw_hash);
+void DBManager::EndWrite() { ++batch_size_; }
 
-    int user_id = -1;
-    int db_error =
-        sqlite3_exec(db_, query.c_str(), GetUserIdCallback, &user_id, NULL);
+void DBManager::Commit() {
+    using std::chrono::microseconds;
+
+    auto commit_start = std::chrono::steady_clock::now();
+    int db_error = Execute(commit_stmt_);
+    auto commit_end = std::chrono::steady_clock::now();
     if (db_error) {
-        logger_.Log(LogType::WARNING,
-                    "Unable to find user with given username and password");
+        logger_.Log(LogType::ERROR,
+                    std::format("Failed to commit batch of {} writes",
+                                batch_size_));
     } else {
+        logger_.Log(
+            LogType::INFO,
+            std::format(
+                "Committed batch of {} writes in {} us (batch age {} us)",
+                batch_size_,
+                std::chrono::duration_cast<microseconds>(commit_end -
+                                                         commit_start)
+                    .count(),
+                std::chrono::duration_cast<microseconds>(commit_end -
+                                                         batch_start_)
+                    .count()));
+    }
+    batch_size_ = 0;
+}
+
+void DBManager::Migrate() {
+    sqlite3_exec(db_,
+                 "CREATE TABLE IF NOT EXISTS SchemaVersion ("
+                 "  VERSION  INT NOT NULL"
+                 ");",
+                 NULL, NULL, NULL);
+
+    size_t version = GetSchemaVersion();
+    if (version > std::size(migrations)) {
+        logger_.Log(LogType::ERROR,
+                    std::format("DB schema version {} is newer than supported "
+                                "version {}",
+                                version, std::size(migrations)));
+        throw std::runtime_error("Unsupported db schema version.");
+    }
+
+    for (; version < std::size(migrations); ++version) {
+        std::string query = std::format(
+            "BEGIN;"
+            "{}"
+            "DELETE FROM SchemaVersion;"
+            "INSERT INTO SchemaVersion VALUES({});"
+            "COMMIT;",
+            migrations[version], version + 1);
+        int db_error = sqlite3_exec(db_, query.c_str(), NULL, NULL, NULL);
+        if (db_error) {
+            sqlite3_exec(db_, "ROLLBACK;", NULL, NULL, NULL);
+            logger_.Log(LogType::ERROR,
+                        std::format("Failed to migrate db schema to version {}",
+                                    version + 1));
+            throw std::runtime_error("Unable to migrate db schema.");
+        }
         logger_.Log(LogType::INFO,
-                    "User with given username and password was found");
+                    std::format("DB schema migrated to version {}",
+                                version + 1));
     }
+}
 
-    return user_id == -1 ? std::nullopt : std::optional<uint64_t>(user_id);
+size_t DBManager::GetSchemaVersion() {
+    sqlite3_stmt* stmt = Prepare("SELECT MAX(VERSION) FROM SchemaVersion;");
+    size_t version = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        version = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_reset(stmt);
+
+    return version;
 }
 
-DBManager::~DBManager() { sqlite3_close(db_); }
+sqlite3_stmt* DBManager::Prepare(const std::string& query) {
+    sqlite3_stmt* stmt;
+    int db_error =
+        sqlite3_prepare_v3(db_, query.c_str(), query.size() + 1,
+                           SQLITE_PREPARE_PERSISTENT, &stmt, NULL);
+    if (db_error) {
+        logger_.Log(LogType::ERROR,
+                    std::format("Unable to prepare statement: {}", query));
+        throw std::runtime_error("Unable to prepare db statement.");
+    }
+    statements_.push_back(stmt);
+
+    return stmt;
+}
+
+int DBManager::Execute(sqlite3_stmt* stmt) {
+    int db_error = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    return db_error == SQLITE_DONE ? SQLITE_OK : db_error;
+}
+
+void DBManager::Close() {
+    for (sqlite3_stmt* stmt : statements_) {
+        sqlite3_finalize(stmt);
+    }
+    statements_.clear();
+    sqlite3_close(db_);
+    db_ = nullptr;
+}
+
+DBManager::~DBManager() {
+    Flush();
+    Close();
+}
 
 DBManager& GetDBManager() {
     static DBManager db_manager(std::cout);
@@ -2,23 +2,65 @@
 
 #include <sqlite3.h>
 
+#include <chrono>
 #include <cstdint>
-#include <optional>
+#include <functional>
 #include <ostream>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "logger.h"
 #include "offer.h"
 
+struct UserRecord {
+    uint64_t id;
+    std::string username;
+    size_t pw_hash;
+};
+
+struct OfferRecord {
+    uint64_t id;
+    uint64_t owner_id;
+    OfferType type;
+    size_t amount;
+    int price;
+};
+
+struct DealRecord {
+    uint64_t id;
+    uint64_t seller_id;
+    uint64_t buyer_id;
+    size_t amount;
+    int price;
+};
+
+// Writes are grouped into batches: the first write opens a transaction
+// which is committed once it holds max_batch_size writes or becomes older
+// than max_batch_delay. Batches are committed only by FlushExpired and
+// Flush, so that a batch never ends in the middle of writes of one
+// command.
 class DBManager {
    public:
-    DBManager(std::ostream& log_output);
+    static constexpr size_t max_batch_size = 256;
+    static constexpr std::chrono::milliseconds max_batch_delay{20};
+
+    static inline const std::string default_db_path = "db/market.db";
+
+    DBManager(std::ostream& log_output,
+              const std::string& db_path = default_db_path);
 
     ~DBManager();
 
     void AddOffer(uint64_t offer_id, uint64_t owner_id, OfferType offer_type,
                   size_t amount, int price);
 
+    // Sets remaining amount of offer, offer becomes inactive once nothing
+    // remains
+    void UpdateOffer(uint64_t offer_id, size_t remaining);
+
+    void CancelOffer(uint64_t offer_id);
+
     void AddDeal(uint64_t deal_id, uint64_t seller_id, uint64_t buyer_id,
                  size_t amount, int price);
 
@@ -26,26 +68,79 @@ class DBManager {
 
     int GetMaxId(const std::string& table);
 
-    bool UsernameExist(const std::string& username);
+    // Bulk loading of state for warm restart. Each method is a single scan
+    // of table, rows are passed to callback in id order.
+    void LoadUsers(const std::function<void(const UserRecord&)>& callback);
+
+    void LoadActiveOffers(
+        const std::function<void(const OfferRecord&)>& callback);
+
+    void LoadDeals(const std::function<void(const DealRecord&)>& callback);
 
-    std::optional<uint64_t> GetUserId(const std::string& username,
-                                      size_t pw_hash);
+    // History queries, ordered by id. Offers are returned with their
+    // initial amount, deal where user is both seller and buyer only once.
+    std::vector<OfferRecord> GetUserOffers(uint64_t owner_id);
+
+    std::vector<DealRecord> GetUserDeals(uint64_t user_id);
+
+    // Commits pending batch if it holds max_batch_size writes or is older
+    // than max_batch_delay. Should be called between commands and
+    // periodically so that writes are not held back while idle.
+    void FlushExpired();
+
+    // Commits pending batch regardless of its size and age.
+    void Flush();
 
    private:
-    static int GetMaxIdCallback(void* id, int count, char** data,
-                                char** columns);
+    // Opens db, migrates its schema and prepares statements
+    void Open(const std::string& db_path);
+
+    void Close();
+
+    void Migrate();
+
+    size_t GetSchemaVersion();
+
+    void BeginWrite();
+
+    void EndWrite();
+
+    void Commit();
+
+    static OfferRecord ReadOfferRecord(sqlite3_stmt* stmt);
+
+    static DealRecord ReadDealRecord(sqlite3_stmt* stmt);
+
+    void LogLoadResult(int db_error, const std::string& table, size_t count,
+                       std::chrono::steady_clock::time_point start);
 
-    static int UsernameExistCallback(void* exist, int count, char** data,
-                                     char** columns);
+    sqlite3_stmt* Prepare(const std::string& query);
 
-    static int GetUserIdCallback(void* id, int count, char** data,
-                                 char** columns);
+    // Runs statement that returns no rows and resets it for reuse.
+    int Execute(sqlite3_stmt* stmt);
 
    private:
-    sqlite3* db_;
+    sqlite3* db_ = nullptr;
     Logger logger_;
 
-    static inline const std::string db_path = "db/market.db";
+    // Statements are prepared once and reused with bound parameters
+    std::vector<sqlite3_stmt*> statements_;
+    sqlite3_stmt* add_offer_stmt_;
+    sqlite3_stmt* update_offer_stmt_;
+    sqlite3_stmt* cancel_offer_stmt_;
+    sqlite3_stmt* add_deal_stmt_;
+    sqlite3_stmt* add_user_stmt_;
+    sqlite3_stmt* get_users_stmt_;
+    sqlite3_stmt* get_active_offers_stmt_;
+    sqlite3_stmt* get_deals_stmt_;
+    sqlite3_stmt* get_user_offers_stmt_;
+    sqlite3_stmt* get_user_deals_stmt_;
+    sqlite3_stmt* begin_stmt_;
+    sqlite3_stmt* commit_stmt_;
+    std::unordered_map<std::string, sqlite3_stmt*> max_id_stmts_;
+
+    size_t batch_size_ = 0;
+    std::chrono::steady_clock::time_point batch_start_;
 };
 
 DBManager& GetDBManager();
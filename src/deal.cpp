@@ -2,20 +2,16 @@
 
 #include <cstdint>
 
-#ifndef TEST
-#include "db_manager.h"
-#endif  // !TEST
-
 Deal::Deal(uint64_t seller_id, uint64_t buyer_id, int price, size_t amount)
-    : id_(GenerateId()),
+    : Deal(GenerateId(), seller_id, buyer_id, price, amount) {}
+
+Deal::Deal(uint64_t id, uint64_t seller_id, uint64_t buyer_id, int price,
+           size_t amount)
+    : id_(id),
       seller_id_(seller_id),
       buyer_id_(buyer_id),
       price_(price),
-      amount_(amount) {
-#ifndef TEST
-    GetDBManager().AddDeal(id_, seller_id_, buyer_id_, amount, price);
-#endif  // !TEST
-}
+      amount_(amount) {}
 
 uint64_t Deal::GetId() const { return id_; }
 
@@ -27,6 +23,10 @@ int Deal::GetPrice() const { return price_; }
 
 size_t Deal::GetAmount() const { return amount_; }
 
+uint64_t Deal::GetNextId() { return deal_id_; }
+
+void Deal::SetNextId(uint64_t next_id) { deal_id_ = next_id; }
+
 uint64_t Deal::GenerateId() { return deal_id_++; }
 
 bool operator<(const std::shared_ptr<Deal>& lhs,
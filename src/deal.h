@@ -8,6 +8,9 @@ class Deal {
    public:
     Deal(uint64_t seller_id, uint64_t buyer_id_, int price, size_t amount);
 
+    Deal(uint64_t id, uint64_t seller_id, uint64_t buyer_id_, int price,
+         size_t amount);
+
     uint64_t GetId() const;
 
     uint64_t GetSeller() const;
@@ -18,6 +21,12 @@ class Deal {
 
     size_t GetAmount() const;
 
+    // Id counter is shared by all instances. Reset is used when market
+    // state is rebuilt from journal or snapshot.
+    static uint64_t GetNextId();
+
+    static void SetNextId(uint64_t next_id);
+
    private:
     static uint64_t GenerateId();
 
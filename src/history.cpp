@@ -0,0 +1,84 @@
+#include "history.h"
+
+#include <iostream>
+#include <limits>
+
+#include "common.h"
+#include "option_parsing.h"
+
+using nlohmann::json;
+
+bool ParseHistoryOptions(int argc, char** argv, HistoryOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        std::string value = argv[++i];
+        bool is_valid = true;
+        if (arg == "--user") {
+            is_valid = ParseNumber(value, 0, std::numeric_limits<int>::max(),
+                                   options.user_id);
+        } else if (arg == "--db") {
+            options.db_path = value;
+        } else {
+            is_valid = false;
+        }
+        if (!is_valid) {
+            return false;
+        }
+    }
+
+    return options.user_id >= 0;
+}
+
+void PrintHistoryUsage() {
+    std::cout << "Usage: history.out --user <id> [options]\n"
+                 "    --user <id>              user whose offers and deals "
+                 "are printed\n"
+                 "    --db <path>              market db (default "
+                 "db/market.db)"
+              << std::endl;
+}
+
+json FormatOfferHistory(const std::vector<OfferRecord>& offers) {
+    json reply;
+    reply[json_field::TYPE] = requests::ACTIVE_OFFERS;
+    reply[json_field::BUY] = json::array();
+    reply[json_field::SELL] = json::array();
+    for (const OfferRecord& offer : offers) {
+        reply[offer.type == OfferType::BUY ? json_field::BUY
+                                           : json_field::SELL]
+            .push_back({{json_field::OFFER_ID, offer.id},
+                        {json_field::PRICE, offer.price},
+                        {json_field::AMOUNT, offer.amount}});
+    }
+
+    return reply;
+}
+
+json FormatDealHistory(uint64_t user_id, const std::vector<DealRecord>& deals) {
+    json reply;
+    reply[json_field::TYPE] = requests::CLOSED_DEALS;
+    reply[json_field::BUY] = json::array();
+    reply[json_field::SELL] = json::array();
+    reply[json_field::BUY_SELL] = json::array();
+    for (const DealRecord& deal : deals) {
+        const std::string& side =
+            deal.buyer_id == deal.seller_id ? json_field::BUY_SELL
+            : deal.buyer_id == user_id      ? json_field::BUY
+                                            : json_field::SELL;
+        reply[side].push_back({{json_field::DEAL_ID, deal.id},
+                               {json_field::PRICE, deal.price},
+                               {json_field::AMOUNT, deal.amount}});
+    }
+
+    return reply;
+}
+
+void PrintUserHistory(DBManager& db_manager, uint64_t user_id,
+                      std::ostream& output) {
+    output << FormatOfferHistory(db_manager.GetUserOffers(user_id)) << '\n'
+           << FormatDealHistory(user_id, db_manager.GetUserDeals(user_id))
+           << std::endl;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "db_manager.h"
+#include "json.h"
+
+// Options of history.out, set from command line
+struct HistoryOptions {
+    int user_id = -1;
+    std::string db_path = DBManager::default_db_path;
+};
+
+// Returns false if arguments are invalid
+bool ParseHistoryOptions(int argc, char** argv, HistoryOptions& options);
+
+void PrintHistoryUsage();
+
+// Offers of user in the form of reply to Active request, including
+// finished and canceled ones
+nlohmann::json FormatOfferHistory(const std::vector<OfferRecord>& offers);
+
+// Deals of user in the form of reply to Deal request, with their ids
+nlohmann::json FormatDealHistory(uint64_t user_id,
+                                 const std::vector<DealRecord>& deals);
+
+// Prints offers and deals of user from db, one json per line
+void PrintUserHistory(DBManager& db_manager, uint64_t user_id,
+                      std::ostream& output);
@@ -0,0 +1,32 @@
+#include <exception>
+#include <filesystem>
+#include <iostream>
+
+#include "db_manager.h"
+#include "history.h"
+#include "logger.h"
+
+int main(int argc, char** argv) {
+    HistoryOptions options;
+    if (!ParseHistoryOptions(argc, argv, options)) {
+        PrintHistoryUsage();
+        return 1;
+    }
+
+    // Sqlite would create empty db in place of missing one
+    if (!std::filesystem::exists(options.db_path)) {
+        std::cerr << "ERROR: " << options.db_path << " does not exist"
+                  << std::endl;
+        return 1;
+    }
+
+    try {
+        // Log goes to stderr, so that output stays json
+        DBManager db_manager(std::cerr, options.db_path);
+        PrintUserHistory(db_manager, options.user_id, std::cout);
+    } catch (std::exception& er) {
+        Logger::Flush();
+        std::cerr << "ERROR: " << er.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,438 @@
+#include "journal.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "binary_io.h"
+#include "deal.h"
+#include "logger.h"
+
+static constexpr uint32_t journal_magic = 0x314a5846;  // "FXJ1"
+static constexpr size_t journal_header_size = 4 + 3 * 8;
+static constexpr size_t max_record_size = 1 << 20;
+
+void EncodeJournalRecord(const JournalRecord& record, std::string& buffer) {
+    size_t size_offset = buffer.size();
+    BinaryWriter writer(buffer);
+    writer.Write(uint32_t{0});
+    writer.Write(record.seq);
+    writer.Write(record.type);
+    switch (record.type) {
+        case JournalRecordType::REGISTER:
+            writer.Write(record.user_id);
+            writer.Write(static_cast<uint64_t>(record.pw_hash));
+            writer.WriteString(record.username);
+            break;
+        case JournalRecordType::DEPOSIT:
+            writer.Write(record.user_id);
+            writer.Write(record.currency);
+            writer.Write(static_cast<uint64_t>(record.amount));
+            break;
+        case JournalRecordType::POST_OFFER:
+            writer.Write(record.user_id);
+            writer.Write(record.offer_id);
+            writer.Write(static_cast<uint8_t>(record.offer_type));
+            writer.Write(static_cast<int32_t>(record.price));
+            writer.Write(static_cast<uint64_t>(record.amount));
+            break;
+        case JournalRecordType::CANCEL:
+            writer.Write(record.user_id);
+            writer.Write(record.offer_id);
+            break;
+    }
+
+    uint32_t size = buffer.size() - size_offset - sizeof(uint32_t);
+    std::memcpy(buffer.data() + size_offset, &size, sizeof(size));
+    writer.Write(Checksum(
+        std::string_view(buffer).substr(size_offset + sizeof(uint32_t))));
+}
+
+size_t DecodeJournalRecord(std::string_view data, JournalRecord& record) {
+    BinaryReader frame_reader(data);
+    uint32_t size;
+    if (!frame_reader.Read(size) || size > max_record_size ||
+        data.size() < sizeof(uint32_t) + size + sizeof(uint32_t)) {
+        return 0;
+    }
+
+    std::string_view body = data.substr(sizeof(uint32_t), size);
+    uint32_t checksum;
+    BinaryReader(data.substr(sizeof(uint32_t) + size)).Read(checksum);
+    if (Checksum(body) != checksum) {
+        return 0;
+    }
+
+    BinaryReader reader(body);
+    JournalRecord result;
+    uint64_t pw_hash = 0;
+    uint64_t amount = 0;
+    uint8_t offer_type = 0;
+    int32_t price = 0;
+    bool ok = reader.Read(result.seq) && reader.Read(result.type);
+    if (ok) {
+        switch (result.type) {
+            case JournalRecordType::REGISTER:
+                ok = reader.Read(result.user_id) && reader.Read(pw_hash) &&
+                     reader.ReadString(result.username);
+                break;
+            case JournalRecordType::DEPOSIT:
+                ok = reader.Read(result.user_id) &&
+                     reader.Read(result.currency) && reader.Read(amount);
+                break;
+            case JournalRecordType::POST_OFFER:
+                ok = reader.Read(result.user_id) &&
+                     reader.Read(result.offer_id) && reader.Read(offer_type) &&
+                     reader.Read(price) && reader.Read(amount);
+                break;
+            case JournalRecordType::CANCEL:
+                ok = reader.Read(result.user_id) &&
+                     reader.Read(result.offer_id);
+                break;
+            default:
+                ok = false;
+        }
+    }
+    if (!ok) {
+        return 0;
+    }
+
+    result.pw_hash = pw_hash;
+    result.amount = amount;
+    result.offer_type = static_cast<OfferType>(offer_type);
+    result.price = price;
+    record = std::move(result);
+
+    return sizeof(uint32_t) + size + sizeof(uint32_t);
+}
+
+Journal::Journal(const std::string& path, uint64_t after_seq,
+                 uint64_t offset)
+    : path_(path) {
+    bool exists = std::filesystem::exists(path);
+    if (exists) {
+        JournalReader reader(path);
+        if (reader.Seek(after_seq, offset)) {
+            last_seq_ = after_seq;
+        }
+        JournalRecord record;
+        while (reader.Next(record)) {
+            last_seq_ = record.seq;
+        }
+        size_ = reader.GetValidSize();
+        uint64_t file_size = std::filesystem::file_size(path);
+        if (size_ < file_size) {
+            Logger(std::cout)
+                .Log(LogType::WARNING,
+                     std::format("Truncating journal {} at offset {} after "
+                                 "record {}, dropping {} bytes",
+                                 path, size_, last_seq_, file_size - size_));
+            std::filesystem::resize_file(path, size_);
+        }
+    }
+
+    file_ = std::fopen(path.c_str(), "ab");
+    if (file_ == nullptr) {
+        throw std::runtime_error("Unable to open journal " + path);
+    }
+    std::setvbuf(file_, nullptr, _IOFBF, file_buffer_size);
+
+    if (!exists) {
+        BinaryWriter writer(buffer_);
+        writer.Write(journal_magic);
+        writer.Write(UserData::GetNextId());
+        writer.Write(Offer::GetNextId());
+        writer.Write(Deal::GetNextId());
+        if (std::fwrite(buffer_.data(), 1, buffer_.size(), file_) !=
+            buffer_.size()) {
+            Fail("write");
+        }
+        size_ = buffer_.size();
+        unsynced_ = true;
+        Flush();
+    }
+}
+
+Journal::~Journal() {
+    if (!failed_) {
+        try {
+            Flush();
+        } catch (const std::exception& error) {
+            Logger(std::cout).Log(LogType::ERROR, error.what());
+        }
+    }
+    std::fclose(file_);
+}
+
+void Journal::OnUserRegistered(uint64_t user_id, const std::string& username,
+                               size_t pw_hash) {
+    JournalRecord record{.type = JournalRecordType::REGISTER,
+                         .user_id = user_id,
+                         .username = username,
+                         .pw_hash = pw_hash};
+    Append(record);
+}
+
+void Journal::OnDeposit(uint64_t user_id, Currency currency, size_t amount) {
+    JournalRecord record{.type = JournalRecordType::DEPOSIT,
+                         .user_id = user_id,
+                         .currency = currency,
+                         .amount = amount};
+    Append(record);
+}
+
+void Journal::OnOfferAccepted(const Offer& offer) {
+    JournalRecord record{.type = JournalRecordType::POST_OFFER,
+                         .user_id = offer.GetOwnerId(),
+                         .offer_id = offer.GetId(),
+                         .offer_type = offer.GetType(),
+                         .price = offer.GetPrice(),
+                         .amount = offer.GetAmount()};
+    Append(record);
+}
+
+void Journal::OnTrade(const Deal&, const Offer&, const Offer&) {}
+
+void Journal::OnOfferCanceled(uint64_t user_id, uint64_t offer_id) {
+    JournalRecord record{.type = JournalRecordType::CANCEL,
+                         .user_id = user_id,
+                         .offer_id = offer_id};
+    Append(record);
+}
+
+void Journal::Flush() {
+    if (!unsynced_) {
+        return;
+    }
+    FlushBuffer();
+    if (fdatasync(fileno(file_)) != 0) {
+        Fail("sync");
+    }
+    unsynced_ = false;
+}
+
+void Journal::FlushBuffer() {
+    CheckUsable();
+    if (std::fflush(file_) != 0) {
+        Fail("write");
+    }
+}
+
+uint64_t Journal::GetLastSeq() const { return last_seq_; }
+
+uint64_t Journal::GetSize() const { return size_; }
+
+void Journal::SetListener(JournalListener* listener) { listener_ = listener; }
+
+void Journal::AppendReplicated(const JournalRecord& record) {
+    if (record.seq != last_seq_ + 1) {
+        throw std::runtime_error(
+            "Replicated record " + std::to_string(record.seq) +
+            " does not follow record " + std::to_string(last_seq_));
+    }
+    last_seq_ = record.seq;
+    Write(record);
+}
+
+void Journal::StartAfter(uint64_t seq) {
+    if (last_seq_ != 0) {
+        throw std::runtime_error("Journal is not empty");
+    }
+    last_seq_ = seq;
+}
+
+void Journal::Append(JournalRecord& record) {
+    record.seq = ++last_seq_;
+    Write(record);
+}
+
+void Journal::Write(const JournalRecord& record) {
+    CheckUsable();
+    buffer_.clear();
+    EncodeJournalRecord(record, buffer_);
+    if (std::fwrite(buffer_.data(), 1, buffer_.size(), file_) !=
+        buffer_.size()) {
+        Fail("write");
+    }
+    size_ += buffer_.size();
+    unsynced_ = true;
+    if (listener_ != nullptr) {
+        listener_->OnRecordAppended(record, buffer_);
+    }
+}
+
+void Journal::CheckUsable() const {
+    if (failed_) {
+        throw std::runtime_error("Journal " + path_ +
+                                 " is not writable after failed write");
+    }
+}
+
+void Journal::Fail(const std::string& operation) {
+    int error = errno;
+    failed_ = true;
+    throw std::runtime_error(std::format("Unable to {} journal {}: {}",
+                                         operation, path_,
+                                         std::strerror(error)));
+}
+
+JournalReader::JournalReader(const std::string& path)
+    : input_(path, std::ios::binary),
+      file_size_(std::filesystem::file_size(path)) {
+    std::string header(journal_header_size, '\0');
+    if (!input_.read(header.data(), header.size())) {
+        throw std::runtime_error("Unable to read journal header " + path);
+    }
+
+    BinaryReader reader(header);
+    uint32_t magic;
+    reader.Read(magic);
+    if (magic != journal_magic) {
+        throw std::runtime_error("Unknown journal format " + path);
+    }
+    reader.Read(header_.next_user_id);
+    reader.Read(header_.next_offer_id);
+    reader.Read(header_.next_deal_id);
+    valid_size_ = journal_header_size;
+}
+
+const JournalHeader& JournalReader::GetHeader() const { return header_; }
+
+bool JournalReader::Seek(uint64_t after_seq, uint64_t offset) {
+    if (offset >= journal_header_size && offset <= file_size_) {
+        SeekTo(offset);
+        JournalRecord record;
+        if (Next(record) ? record.seq == after_seq + 1
+                         : offset == file_size_) {
+            SeekTo(offset);
+            return true;
+        }
+    }
+    SeekTo(journal_header_size);
+    return false;
+}
+
+bool JournalReader::Next(JournalRecord& record) {
+    uint32_t size;
+    if (!input_.read(reinterpret_cast<char*>(&size), sizeof(size)) ||
+        size > max_record_size) {
+        return false;
+    }
+
+    record_data_.resize(sizeof(size) + size + sizeof(uint32_t));
+    std::memcpy(record_data_.data(), &size, sizeof(size));
+    if (!input_.read(record_data_.data() + sizeof(size),
+                     size + sizeof(uint32_t))) {
+        return false;
+    }
+
+    size_t consumed = DecodeJournalRecord(record_data_, record);
+    valid_size_ += consumed;
+
+    return consumed != 0;
+}
+
+size_t JournalReader::GetValidSize() const { return valid_size_; }
+
+void JournalReader::SeekTo(uint64_t offset) {
+    input_.clear();
+    input_.seekg(offset);
+    valid_size_ = offset;
+}
+
+void ApplyJournalRecord(Market& market, const JournalRecord& record) {
+    bool consistent = true;
+    switch (record.type) {
+        case JournalRecordType::REGISTER:
+            consistent = market.RegisterUser(record.username, record.pw_hash) ==
+                         record.user_id;
+            break;
+        case JournalRecordType::DEPOSIT:
+            if (record.currency == Currency::USD) {
+                market.DepositUSD(record.user_id, record.amount);
+            } else {
+                market.DepositRUB(record.user_id, record.amount);
+            }
+            break;
+        case JournalRecordType::POST_OFFER:
+            consistent = market.PostOffer(record.user_id, record.offer_type,
+                                          record.price, record.amount) ==
+                         record.offer_id;
+            break;
+        case JournalRecordType::CANCEL:
+            consistent = market.RemoveOffer(record.user_id, record.offer_id);
+            break;
+    }
+
+    if (!consistent) {
+        throw std::runtime_error("Market diverged from journal at record " +
+                                 std::to_string(record.seq));
+    }
+}
+
+uint64_t ReplayJournal(const std::string& path, Market& market,
+                       uint64_t after_seq, uint64_t offset) {
+    JournalReader reader(path);
+    if (after_seq == 0) {
+        UserData::SetNextId(reader.GetHeader().next_user_id);
+        Offer::SetNextId(reader.GetHeader().next_offer_id);
+        Deal::SetNextId(reader.GetHeader().next_deal_id);
+    }
+    reader.Seek(after_seq, offset);
+
+    uint64_t count = 0;
+    JournalRecord record;
+    while (reader.Next(record)) {
+        if (record.seq <= after_seq) {
+            continue;
+        }
+        if (record.seq != after_seq + count + 1) {
+            throw std::runtime_error("Gap in journal before record " +
+                                     std::to_string(record.seq));
+        }
+        ApplyJournalRecord(market, record);
+        ++count;
+    }
+
+    return count;
+}
+
+// Cancel is reflected if offer is no longer active: it could not have been
+// filled after it was canceled
+static bool IsRestoredFromDB(const Market& market,
+                             const JournalRecord& record) {
+    switch (record.type) {
+        case JournalRecordType::REGISTER:
+            return record.user_id < UserData::GetNextId();
+        case JournalRecordType::POST_OFFER:
+            return record.offer_id < Offer::GetNextId();
+        case JournalRecordType::CANCEL:
+            return !market.GetActiveOffers(record.user_id)
+                        .contains(record.offer_id);
+        default:
+            return true;
+    }
+}
+
+uint64_t ReplayJournalTail(const std::string& path, Market& market) {
+    JournalReader reader(path);
+    uint64_t count = 0;
+    bool is_tail = false;
+    JournalRecord record;
+    while (reader.Next(record)) {
+        is_tail = is_tail || !IsRestoredFromDB(market, record);
+        if (is_tail || record.type == JournalRecordType::DEPOSIT) {
+            ApplyJournalRecord(market, record);
+            count += is_tail;
+        }
+    }
+
+    return count;
+}
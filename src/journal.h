@@ -0,0 +1,190 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+#include "market.h"
+#include "market_events.h"
+#include "offer.h"
+#include "user_data.h"
+
+// Journal is a binary append-only log of every command accepted by market.
+// Replaying it from empty market rebuilds exactly the same state, including
+// ids of users, offers and deals.
+//
+// File layout (little-endian):
+//   header: magic, next user id, next offer id, next deal id at the moment
+//           journal was created
+//   record: uint32 size, uint64 seq, uint8 type, payload, uint32 checksum
+//           where size covers seq, type and payload
+
+enum class JournalRecordType : uint8_t {
+    REGISTER = 1,
+    DEPOSIT = 2,
+    POST_OFFER = 3,
+    CANCEL = 4,
+};
+
+struct JournalRecord {
+    uint64_t seq = 0;
+    JournalRecordType type = JournalRecordType::REGISTER;
+    uint64_t user_id = 0;
+    // POST_OFFER, CANCEL
+    uint64_t offer_id = 0;
+    // REGISTER
+    std::string username;
+    size_t pw_hash = 0;
+    // POST_OFFER
+    OfferType offer_type = OfferType::BUY;
+    int price = 0;
+    // DEPOSIT
+    Currency currency = Currency::USD;
+    // POST_OFFER, DEPOSIT
+    size_t amount = 0;
+};
+
+struct JournalHeader {
+    uint64_t next_user_id = 0;
+    uint64_t next_offer_id = 0;
+    uint64_t next_deal_id = 0;
+};
+
+// Appends framed record to buffer
+void EncodeJournalRecord(const JournalRecord& record, std::string& buffer);
+
+// Decodes framed record from beginning of data. Returns number of consumed
+// bytes or 0 if data holds incomplete or corrupted record.
+size_t DecodeJournalRecord(std::string_view data, JournalRecord& record);
+
+// Receives every record appended to journal together with its encoded
+// frame, e.g. to ship it to replicas
+class JournalListener {
+   public:
+    virtual void OnRecordAppended(const JournalRecord& record,
+                                  std::string_view frame) = 0;
+
+    virtual ~JournalListener() = default;
+};
+
+// Failure to write or sync journal is fatal: it throws std::runtime_error
+// and every later write throws as well, so that no command is acknowledged
+// once journal stopped being durable and no record follows a torn one.
+class Journal final : public MarketEventSink {
+   public:
+    // Opens existing journal for appending, dropping torn record at its
+    // end, or creates new one with current id counters in header. Search
+    // for the end starts at offset of record after_seq + 1, if it is there,
+    // and from the first record otherwise.
+    explicit Journal(const std::string& path, uint64_t after_seq = 0,
+                     uint64_t offset = 0);
+
+    ~Journal();
+
+    void OnUserRegistered(uint64_t user_id, const std::string& username,
+                          size_t pw_hash) override;
+
+    void OnDeposit(uint64_t user_id, Currency currency, size_t amount) override;
+
+    void OnOfferAccepted(const Offer& offer) override;
+
+    // Deals are result of matching and are not journaled
+    void OnTrade(const Deal& deal, const Offer& taker,
+                 const Offer& maker) override;
+
+    void OnOfferCanceled(uint64_t user_id, uint64_t offer_id) override;
+
+    // Writes buffered records to file and syncs it to disk
+    void Flush();
+
+    // Writes buffered records to file without syncing it, so that they can
+    // be read back
+    void FlushBuffer();
+
+    uint64_t GetLastSeq() const;
+
+    // Size of journal with buffered records, i.e. offset of the next record
+    uint64_t GetSize() const;
+
+    void SetListener(JournalListener* listener);
+
+    // Appends record received from primary keeping its sequence number.
+    // Throws std::runtime_error if it does not follow the last record.
+    void AppendReplicated(const JournalRecord& record);
+
+    // Makes empty journal continue after snapshot taken at seq
+    void StartAfter(uint64_t seq);
+
+   private:
+    void Append(JournalRecord& record);
+
+    void Write(const JournalRecord& record);
+
+    // Throws if earlier write failed
+    void CheckUsable() const;
+
+    // Marks journal as failed and throws error of the last I/O call
+    [[noreturn]] void Fail(const std::string& operation);
+
+   private:
+    std::string path_;
+    std::FILE* file_;
+    JournalListener* listener_ = nullptr;
+    uint64_t last_seq_ = 0;
+    uint64_t size_ = 0;
+    bool unsynced_ = false;
+    bool failed_ = false;
+    std::string buffer_;
+
+    static constexpr size_t file_buffer_size = 1 << 16;
+};
+
+class JournalReader {
+   public:
+    explicit JournalReader(const std::string& path);
+
+    const JournalHeader& GetHeader() const;
+
+    // Moves to record at offset if it is record after_seq + 1 or end of
+    // journal. Otherwise, e.g. when journal was recreated after offset was
+    // taken, moves to the first record and returns false.
+    bool Seek(uint64_t after_seq, uint64_t offset);
+
+    // Returns false at end of journal or at torn record
+    bool Next(JournalRecord& record);
+
+    // Size of header and all records read so far
+    size_t GetValidSize() const;
+
+   private:
+    void SeekTo(uint64_t offset);
+
+   private:
+    std::ifstream input_;
+    JournalHeader header_;
+    uint64_t file_size_;
+    size_t valid_size_ = 0;
+    std::string record_data_;
+};
+
+// Applies command from journal to market. Throws std::runtime_error if
+// market produces different result than the one recorded.
+void ApplyJournalRecord(Market& market, const JournalRecord& record);
+
+// Rebuilds market state from journal. Market must be empty, unless it was
+// restored from snapshot taken at after_seq, in which case only later records
+// are applied. They are read starting at offset stored in snapshot, earlier
+// records are read and skipped only if it is not valid. Returns number of
+// replayed records.
+uint64_t ReplayJournal(const std::string& path, Market& market,
+                       uint64_t after_seq = 0, uint64_t offset = 0);
+
+// Applies records that market restored from db lacks because server
+// stopped before db committed its last batch. Db batches end between
+// commands, so db holds a prefix of journal and the first record it does
+// not reflect starts the tail. Id counters must be the ones restored from
+// db. Deposits are not stored in db, so every one of them is applied.
+// Returns number of applied records of the tail.
+uint64_t ReplayJournalTail(const std::string& path, Market& market);
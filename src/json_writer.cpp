@@ -0,0 +1,42 @@
+#include "json_writer.h"
+
+// Escapes as nlohmann does with ensure_ascii off
+void JsonWriter::String(std::string_view value) {
+    BeforeValue();
+    buffer_ += '"';
+    for (char symbol : value) {
+        switch (symbol) {
+            case '"':
+                buffer_ += "\\\"";
+                break;
+            case '\\':
+                buffer_ += "\\\\";
+                break;
+            case '\b':
+                buffer_ += "\\b";
+                break;
+            case '\f':
+                buffer_ += "\\f";
+                break;
+            case '\n':
+                buffer_ += "\\n";
+                break;
+            case '\r':
+                buffer_ += "\\r";
+                break;
+            case '\t':
+                buffer_ += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(symbol) < 0x20) {
+                    static constexpr char hex_digits[] = "0123456789abcdef";
+                    buffer_ += "\\u00";
+                    buffer_ += hex_digits[symbol >> 4];
+                    buffer_ += hex_digits[symbol & 0xf];
+                } else {
+                    buffer_ += symbol;
+                }
+        }
+    }
+    buffer_ += '"';
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <charconv>
+#include <concepts>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Writes compact json straight into buffer without building json document.
+// Output is the same as of nlohmann::json::dump as long as keys of every
+// object are written in sorted order, as nlohmann stores them.
+class JsonWriter {
+   public:
+    explicit JsonWriter(std::string& buffer) : buffer_(buffer) {}
+
+    void BeginObject() { Open('{'); }
+
+    void EndObject() { Close('}'); }
+
+    void BeginArray() { Open('['); }
+
+    void EndArray() { Close(']'); }
+
+    void Key(std::string_view key) {
+        String(key);
+        buffer_ += ':';
+        needs_comma_ = false;
+    }
+
+    void String(std::string_view value);
+
+    template <std::integral T>
+    void Integer(T value) {
+        BeforeValue();
+        char digits[24];
+        char* end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+        buffer_.append(digits, end);
+    }
+
+    void Bool(bool value) {
+        BeforeValue();
+        buffer_ += value ? "true" : "false";
+    }
+
+    void Null() {
+        BeforeValue();
+        buffer_ += "null";
+    }
+
+    template <std::integral T>
+    void Optional(const std::optional<T>& value) {
+        if (value.has_value()) {
+            Integer(*value);
+        } else {
+            Null();
+        }
+    }
+
+   private:
+    void BeforeValue() {
+        if (needs_comma_) {
+            buffer_ += ',';
+        }
+        needs_comma_ = true;
+    }
+
+    void Open(char bracket) {
+        BeforeValue();
+        buffer_ += bracket;
+        needs_comma_ = false;
+    }
+
+    void Close(char bracket) {
+        buffer_ += bracket;
+        needs_comma_ = true;
+    }
+
+   private:
+    std::string& buffer_;
+    // Set after value, so that the next value or key is separated from it
+    bool needs_comma_ = false;
+};
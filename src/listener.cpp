@@ -0,0 +1,122 @@
+#include "listener.h"
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/socket_base.hpp>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <utility>
+
+#include "server_options.h"
+
+using boost::asio::ip::tcp;
+
+using reuse_port =
+    boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+Listener::Listener(
+    boost::asio::io_service& io_service,
+    boost::asio::io_service& market_io_service,
+    const boost::asio::generic::stream_protocol::endpoint& endpoint,
+    bool is_port_shared, std::shared_ptr<SessionLimit> session_limit)
+    : acceptor_(io_service),
+      accept_retry_timer_(io_service),
+      logger_(std::cout),
+      is_local_(endpoint.protocol().family() == AF_UNIX),
+      session_pool_(std::make_shared<SessionPool>(
+          io_service, market_io_service, std::move(session_limit),
+          [this] { HandleSessionRelease(); })) {
+    acceptor_.open(endpoint.protocol());
+    if (!is_local_) {
+        acceptor_.set_option(tcp::acceptor::reuse_address(true));
+    }
+    if (is_port_shared) {
+        acceptor_.set_option(reuse_port(true));
+    }
+    acceptor_.bind(endpoint);
+    if (is_local_) {
+        // Only owner and group may connect, nobody can before listen
+        using std::filesystem::perms;
+        std::filesystem::permissions(
+            reinterpret_cast<const sockaddr_un*>(endpoint.data())->sun_path,
+            perms::owner_read | perms::owner_write | perms::group_read |
+                perms::group_write);
+    }
+    acceptor_.listen();
+    StartAccept();
+}
+
+void Listener::StartAccept() {
+    acceptor_.async_accept(
+        [this](const boost::system::error_code& error,
+               boost::asio::generic::stream_protocol::socket socket) {
+            HandleAccept(error, std::move(socket));
+        });
+}
+
+// Socket options are best effort, connection is served without them
+void Listener::HandleAccept(
+    const boost::system::error_code& error,
+    boost::asio::generic::stream_protocol::socket socket) {
+    if (error == boost::asio::error::operation_aborted) {
+        return;
+    }
+    if (error) {
+        logger_.Log(LogType::WARNING,
+                    std::format("Unable to accept connection: {}",
+                                error.message()));
+        if (error == boost::system::errc::too_many_files_open ||
+            error == boost::system::errc::too_many_files_open_in_system) {
+            accept_retry_timer_.expires_after(accept_retry_delay);
+            accept_retry_timer_.async_wait(
+                [this](const boost::system::error_code& timer_error) {
+                    HandleAcceptRetry(timer_error);
+                });
+        } else {
+            StartAccept();
+        }
+        return;
+    }
+    const ServerOptions& options = GetServerOptions();
+    boost::system::error_code option_error;
+    if (!is_local_) {
+        socket.set_option(tcp::no_delay(true), option_error);
+    }
+    if (options.send_buffer_size != 0) {
+        socket.set_option(boost::asio::socket_base::send_buffer_size(
+                              options.send_buffer_size),
+                          option_error);
+    }
+    if (options.receive_buffer_size != 0) {
+        socket.set_option(boost::asio::socket_base::receive_buffer_size(
+                              options.receive_buffer_size),
+                          option_error);
+    }
+    accepted_socket_.emplace(std::move(socket));
+    ServeAccepted();
+}
+
+void Listener::ServeAccepted() {
+    std::shared_ptr<Session> session = session_pool_->Acquire();
+    if (!session) {
+        return;
+    }
+    session->GetSocket() = std::move(*accepted_socket_);
+    accepted_socket_.reset();
+    session->Start();
+    StartAccept();
+}
+
+void Listener::HandleAcceptRetry(const boost::system::error_code& error) {
+    if (!error) {
+        StartAccept();
+    }
+}
+
+void Listener::HandleSessionRelease() {
+    if (accepted_socket_) {
+        ServeAccepted();
+    }
+}
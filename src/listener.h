@@ -0,0 +1,60 @@
+#pragma once
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/basic_socket_acceptor.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <optional>
+
+#include "logger.h"
+#include "session.h"
+#include "session_pool.h"
+
+// Accepts clients on TCP or Unix domain socket endpoint and serves them on
+// io_service, their requests are handled on market_io_service. Listeners
+// with shared port are bound with SO_REUSEPORT, kernel spreads new
+// connections between them. All listeners share one session limit.
+class Listener {
+   public:
+    // Delay before accepting again when process or system is out of file
+    // descriptors
+    static constexpr std::chrono::milliseconds accept_retry_delay{100};
+
+    Listener(boost::asio::io_service& io_service,
+             boost::asio::io_service& market_io_service,
+             const boost::asio::generic::stream_protocol::endpoint& endpoint,
+             bool is_port_shared,
+             std::shared_ptr<SessionLimit> session_limit);
+
+   private:
+    void StartAccept();
+
+    // Failed accept is logged and retried, so that listener keeps serving
+    // once the cause is gone
+    void HandleAccept(const boost::system::error_code& error,
+                      boost::asio::generic::stream_protocol::socket socket);
+
+    // Accepting pauses while session limit is reached, accepted client waits
+    // for a free session and others wait in listen backlog. It resumes when
+    // a session of any listener is released.
+    void ServeAccepted();
+
+    void HandleSessionRelease();
+
+    void HandleAcceptRetry(const boost::system::error_code& error);
+
+   private:
+    boost::asio::basic_socket_acceptor<boost::asio::generic::stream_protocol>
+        acceptor_;
+    boost::asio::steady_timer accept_retry_timer_;
+    Logger logger_;
+    // TCP options are not set on Unix domain socket connections
+    bool is_local_;
+    std::optional<boost::asio::generic::stream_protocol::socket>
+        accepted_socket_;
+    // Destroyed first, so released sessions do not resume accepting
+    std::shared_ptr<SessionPool> session_pool_;
+};
@@ -0,0 +1,454 @@
+#include "load_generator.h"
+
+#include <algorithm>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/bind/bind.hpp>
+#include <cmath>
+#include <format>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <thread>
+
+#include "option_parsing.h"
+
+using boost::asio::generic::stream_protocol;
+using boost::asio::ip::tcp;
+using nlohmann::json;
+
+bool ParseLoadOptions(int argc, char** argv, LoadOptions& options) {
+    constexpr int max_int = std::numeric_limits<int>::max();
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        std::string value = argv[++i];
+        bool is_valid = true;
+        if (arg == "--host") {
+            options.host = value;
+        } else if (arg == "--port") {
+            is_valid = ParseNumber(value, 1, max_port, options.port);
+        } else if (arg == "--unix-socket") {
+            options.unix_socket_path = value;
+        } else if (arg == "--connections") {
+            is_valid = ParseNumber(value, 1, max_int, options.connections);
+        } else if (arg == "--threads") {
+            is_valid = ParseNumber(value, 1, 1024, options.threads);
+        } else if (arg == "--duration") {
+            is_valid = ParseNumber(value, 1, max_int, options.duration);
+        } else if (arg == "--connect-timeout") {
+            is_valid = ParseNumber(value, 1, max_int, options.connect_timeout);
+        } else if (arg == "--rate") {
+            is_valid = ParseNumber(value, 0, max_int, options.rate);
+        } else if (arg == "--mid-price") {
+            is_valid = ParseNumber(value, 1, max_int, options.mid_price);
+        } else if (arg == "--price-deviation") {
+            is_valid = ParseNumber(value, 0.0, 1e9, options.price_deviation);
+        } else if (arg == "--max-amount") {
+            is_valid = ParseNumber(value, 1, max_int, options.max_amount);
+        } else if (arg == "--cancel-ratio") {
+            is_valid = ParseNumber(value, 0.0, 1.0, options.cancel_ratio);
+        } else if (arg == "--quote-ratio") {
+            is_valid = ParseNumber(value, 0.0, 1.0, options.quote_ratio);
+        } else if (arg == "--seed") {
+            is_valid = ParseNumber(value, 0, max_int, options.seed);
+        } else if (arg == "--protocol") {
+            std::optional<Protocol> protocol = GetProtocol(value);
+            is_valid = protocol.has_value();
+            options.protocol = protocol.value_or(Protocol::JSON);
+        } else {
+            is_valid = false;
+        }
+        if (!is_valid) {
+            return false;
+        }
+    }
+
+    return options.cancel_ratio + options.quote_ratio <= 1;
+}
+
+void PrintLoadUsage() {
+    std::cout << "Usage: load_generator.out [options]\n"
+                 "    --host <host>            server host (default "
+                 "127.0.0.1)\n"
+                 "    --port <port>            server port (default 5555)\n"
+                 "    --unix-socket <path>     connect to Unix domain socket "
+                 "instead\n"
+                 "    --connections <n>        concurrent users "
+                 "(default 1000)\n"
+                 "    --threads <n>            I/O threads (default 1)\n"
+                 "    --duration <sec>         measurement time (default 10)\n"
+                 "    --connect-timeout <sec>  time to connect and log in "
+                 "(default 5)\n"
+                 "    --rate <n>               total requests per second, "
+                 "0 for closed loop (default 0)\n"
+                 "    --mid-price <price>      center of offer prices "
+                 "(default 1000)\n"
+                 "    --price-deviation <x>    standard deviation of prices "
+                 "(default 10)\n"
+                 "    --max-amount <n>         offer amount is uniform in "
+                 "[1, n] (default 10)\n"
+                 "    --cancel-ratio <share>   share of cancels "
+                 "(default 0.1)\n"
+                 "    --quote-ratio <share>    share of quote requests "
+                 "(default 0.1)\n"
+                 "    --seed <n>               random seed, also part of "
+                 "usernames (default 1)\n"
+                 "    --protocol <json|binary> wire protocol (default json)"
+              << std::endl;
+}
+
+LoadConnection::LoadConnection(boost::asio::io_service& io_service,
+                               LoadGenerator& generator, size_t index)
+    : socket_(io_service),
+      timer_(io_service),
+      generator_(generator),
+      index_(index),
+      random_(generator.GetOptions().seed * 1'000'003 + index) {}
+
+// Timer paces requests only once connection is authenticated, until then it
+// bounds time to get there
+void LoadConnection::Start(
+    const std::vector<stream_protocol::endpoint>& endpoints) {
+    timer_.expires_after(
+        std::chrono::seconds(generator_.GetOptions().connect_timeout));
+    timer_.async_wait(boost::bind(&LoadConnection::HandleConnectTimeout, this,
+                                  boost::asio::placeholders::error));
+    boost::asio::async_connect(
+        socket_, endpoints,
+        [this](const boost::system::error_code& error,
+               const stream_protocol::endpoint&) { HandleConnect(error); });
+}
+
+void LoadConnection::HandleConnect(const boost::system::error_code& error) {
+    if (error) {
+        Close(true);
+        return;
+    }
+    if (generator_.GetOptions().unix_socket_path.empty()) {
+        boost::system::error_code option_error;
+        socket_.set_option(tcp::no_delay(true), option_error);
+    }
+    if (generator_.GetOptions().protocol == Protocol::BINARY) {
+        json request = {{json_field::TYPE, requests::PROTOCOL},
+                        {json_field::PROTOCOL, protocols::BINARY}};
+        Send(RequestKind::PROTOCOL, request);
+        return;
+    }
+    Authenticate(requests::REGISTRATION);
+}
+
+void LoadConnection::HandleConnectTimeout(
+    const boost::system::error_code& error) {
+    if (!error && !ready_) {
+        Close(true);
+    }
+}
+
+// Registration fails if user is left from previous run with same seed, then
+// connection logs in
+void LoadConnection::Authenticate(const std::string& request_type) {
+    std::string username =
+        std::format("load_{}_{}", generator_.GetOptions().seed, index_);
+    json request;
+    request[json_field::TYPE] = request_type;
+    request[json_field::USERNAME] = username;
+    request[json_field::PW_HASH] = std::hash<std::string>{}(username);
+    Send(GetRequestKind(request_type), request);
+}
+
+void LoadConnection::SendNext() {
+    auto now = std::chrono::steady_clock::now();
+    if (generator_.IsFinished(now)) {
+        Close(false);
+        return;
+    }
+    const LoadOptions& options = generator_.GetOptions();
+    if (options.rate == 0) {
+        next_send_ = now;
+        HandleTimer({});
+        return;
+    }
+
+    auto interval = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::duration<double>(static_cast<double>(options.connections) /
+                                      options.rate));
+    next_send_ += interval;
+    if (next_send_ <= now) {
+        HandleTimer({});
+        return;
+    }
+    timer_.expires_at(next_send_);
+    timer_.async_wait(boost::bind(&LoadConnection::HandleTimer, this,
+                                  boost::asio::placeholders::error));
+}
+
+void LoadConnection::HandleTimer(const boost::system::error_code& error) {
+    if (error || closed_) {
+        return;
+    }
+    if (generator_.IsFinished(std::chrono::steady_clock::now())) {
+        Close(false);
+        return;
+    }
+
+    const LoadOptions& options = generator_.GetOptions();
+    request_start_ = next_send_;
+    double share = std::uniform_real_distribution<double>(0, 1)(random_);
+    json request;
+    // Cancel needs id of offer, so it starts with request of active offers
+    if (share < options.cancel_ratio) {
+        request[json_field::TYPE] = requests::ACTIVE_OFFERS;
+        Send(RequestKind::ACTIVE_OFFERS, request);
+    } else if (share < options.cancel_ratio + options.quote_ratio) {
+        request[json_field::TYPE] = requests::QUOTES;
+        Send(RequestKind::QUOTES, request);
+    } else {
+        std::normal_distribution<double> price(options.mid_price,
+                                               options.price_deviation);
+        std::uniform_int_distribution<int> amount(1, options.max_amount);
+        request[json_field::TYPE] = requests::POST_OFFER;
+        request[json_field::OFFER_SIDE] =
+            random_() % 2 == 0 ? json_field::BUY : json_field::SELL;
+        request[json_field::PRICE] =
+            std::max(1L, std::lround(price(random_)));
+        request[json_field::AMOUNT] = amount(random_);
+        Send(RequestKind::POST_OFFER, request);
+    }
+}
+
+void LoadConnection::Send(RequestKind kind, const json& request) {
+    request_kind_ = kind;
+    if (protocol_ == Protocol::BINARY) {
+        request_.clear();
+        AppendBinaryRequest(request, request_);
+    } else {
+        request_ = request.dump();
+    }
+    boost::asio::async_write(
+        socket_, boost::asio::buffer(request_),
+        boost::bind(&LoadConnection::HandleWrite, this,
+                    boost::asio::placeholders::error));
+}
+
+void LoadConnection::HandleWrite(const boost::system::error_code& error) {
+    if (error) {
+        Close(true);
+        return;
+    }
+    StartRead();
+}
+
+void LoadConnection::StartRead() {
+    socket_.async_read_some(
+        boost::asio::buffer(data_, max_length),
+        boost::bind(&LoadConnection::HandleRead, this,
+                    boost::asio::placeholders::error,
+                    boost::asio::placeholders::bytes_transferred));
+}
+
+// Json replies are not framed, reply is complete once it is valid json
+void LoadConnection::HandleRead(const boost::system::error_code& error,
+                                size_t bytes_transferred) {
+    if (error) {
+        Close(true);
+        return;
+    }
+    input_.append(data_, bytes_transferred);
+    RequestKind kind;
+    std::string_view payload;
+    bool is_complete = protocol_ == Protocol::BINARY
+                           ? DecodeBinaryMessage(input_, kind, payload) != 0
+                           : json::accept(input_);
+    if (!is_complete) {
+        StartRead();
+        return;
+    }
+
+    if (ready_) {
+        generator_.Record(request_kind_, request_start_,
+                          std::chrono::steady_clock::now());
+    }
+    json reply = protocol_ == Protocol::BINARY
+                     ? DecodeBinaryReply(kind, payload)
+                     : json::parse(input_);
+    input_.clear();
+    HandleReply(reply);
+}
+
+void LoadConnection::HandleReply(const json& reply) {
+    if (request_kind_ == RequestKind::PROTOCOL) {
+        if (!reply.is_object() || !reply.at(json_field::SUCCESS)) {
+            Close(true);
+            return;
+        }
+        protocol_ = Protocol::BINARY;
+        Authenticate(requests::REGISTRATION);
+        return;
+    }
+
+    if (reply.is_string()) {
+        if (reply.get<std::string>().starts_with("ERROR")) {
+            generator_.AddError();
+        }
+        SendNext();
+        return;
+    }
+
+    if (!ready_) {
+        if (!reply.at(json_field::SUCCESS)) {
+            if (request_kind_ == RequestKind::REGISTRATION) {
+                Authenticate(requests::LOGIN);
+            } else {
+                Close(true);
+            }
+            return;
+        }
+        ready_ = true;
+        timer_.cancel();
+        generator_.OnSettled();
+        // Paced connections start at random point of their interval
+        const LoadOptions& options = generator_.GetOptions();
+        next_send_ = std::chrono::steady_clock::now();
+        if (options.rate != 0) {
+            next_send_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::duration<double>(
+                    std::uniform_real_distribution<double>(0, 1)(random_) *
+                    options.connections / options.rate));
+        }
+        SendNext();
+        return;
+    }
+
+    if (request_kind_ == RequestKind::ACTIVE_OFFERS) {
+        std::vector<uint64_t> offer_ids;
+        for (const auto& side : {json_field::BUY, json_field::SELL}) {
+            for (const auto& offer : reply.at(side)) {
+                offer_ids.push_back(offer.at(json_field::OFFER_ID));
+            }
+        }
+        if (!offer_ids.empty()) {
+            json request;
+            request[json_field::TYPE] = requests::CANCEL;
+            request[json_field::OFFER_ID] =
+                offer_ids[random_() % offer_ids.size()];
+            request_start_ = std::chrono::steady_clock::now();
+            Send(RequestKind::CANCEL, request);
+            return;
+        }
+    }
+    SendNext();
+}
+
+void LoadConnection::Close(bool failed) {
+    if (closed_) {
+        return;
+    }
+    closed_ = true;
+    boost::system::error_code error;
+    socket_.close(error);
+    timer_.cancel();
+    if (failed) {
+        generator_.AddError();
+    }
+    if (!ready_) {
+        generator_.OnSettled();
+    }
+}
+
+LoadGenerator::LoadGenerator(const LoadOptions& options) : options_(options) {}
+
+LoadGenerator::~LoadGenerator() = default;
+
+void LoadGenerator::Run() {
+    std::vector<stream_protocol::endpoint> endpoints;
+    if (options_.unix_socket_path.empty()) {
+        tcp::resolver resolver(io_service_);
+        for (const auto& entry : resolver.resolve(
+                 options_.host, std::to_string(options_.port))) {
+            endpoints.emplace_back(entry.endpoint());
+        }
+    } else {
+        endpoints.emplace_back(boost::asio::local::stream_protocol::endpoint(
+            options_.unix_socket_path));
+    }
+    connections_.reserve(options_.connections);
+    for (int i = 0; i < options_.connections; ++i) {
+        connections_.push_back(
+            std::make_unique<LoadConnection>(io_service_, *this, i));
+        connections_.back()->Start(endpoints);
+    }
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < options_.threads; ++i) {
+        threads.emplace_back([this] { io_service_.run(); });
+    }
+    io_service_.run();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+void LoadGenerator::PrintReport(std::ostream& output) const {
+    uint64_t count = total_latency_.GetCount();
+    output << std::format(
+        "Connections: {}, duration: {} s, rate: {}\n"
+        "Requests: {}, errors: {}, throughput: {:.0f} requests/s\n",
+        options_.connections, options_.duration,
+        options_.rate == 0 ? "closed loop" : std::to_string(options_.rate),
+        count, errors_.load(), static_cast<double>(count) / options_.duration);
+    output << FormatLatencyHeader() << FormatLatencyRow("all", total_latency_);
+    for (size_t kind = 0; kind < latencies_.size(); ++kind) {
+        if (latencies_[kind].GetCount() != 0) {
+            output << FormatLatencyRow(
+                GetRequestKindName(static_cast<RequestKind>(kind)),
+                latencies_[kind]);
+        }
+    }
+    output.flush();
+}
+
+const LoadOptions& LoadGenerator::GetOptions() const { return options_; }
+
+void LoadGenerator::OnSettled() {
+    if (++settled_ == options_.connections) {
+        start_ = std::chrono::steady_clock::now().time_since_epoch().count();
+    }
+}
+
+bool LoadGenerator::IsMeasuring(
+    std::chrono::steady_clock::time_point now) const {
+    auto start = start_.load();
+    if (start == 0) {
+        return false;
+    }
+    auto elapsed = now.time_since_epoch() -
+                   std::chrono::steady_clock::duration(start);
+    return elapsed >= std::chrono::steady_clock::duration::zero() &&
+           elapsed < std::chrono::seconds(options_.duration);
+}
+
+bool LoadGenerator::IsFinished(
+    std::chrono::steady_clock::time_point now) const {
+    auto start = start_.load();
+    return start != 0 && now.time_since_epoch() -
+                                 std::chrono::steady_clock::duration(start) >=
+                             std::chrono::seconds(options_.duration);
+}
+
+// Only requests completed during measurement are counted
+void LoadGenerator::Record(RequestKind kind,
+                           std::chrono::steady_clock::time_point start,
+                           std::chrono::steady_clock::time_point end) {
+    if (!IsMeasuring(end)) {
+        return;
+    }
+    latencies_[static_cast<size_t>(kind)].Record(end - start);
+    total_latency_.Record(end - start);
+}
+
+void LoadGenerator::AddError() { ++errors_; }
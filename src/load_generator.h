@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "binary_protocol.h"
+#include "common.h"
+#include "json.h"
+#include "metrics.h"
+
+// Options of load_generator.out, set from command line
+struct LoadOptions {
+    std::string host = "127.0.0.1";
+    int port = ::port;
+    // Unix domain socket of server, used instead of host and port if set
+    std::string unix_socket_path;
+    int connections = 1000;
+    int threads = 1;
+    // Seconds of measurement after all connections are authenticated
+    int duration = 10;
+    // Seconds for connection to connect and authenticate, otherwise it is
+    // closed and counted as error
+    int connect_timeout = 5;
+    // Total requests per second over all connections, 0 sends next request
+    // as soon as reply to previous one arrives
+    int rate = 0;
+    int mid_price = 1000;
+    // Standard deviation of offer prices around mid_price
+    double price_deviation = 10;
+    int max_amount = 10;
+    // Shares of cancels and quote requests, the rest are new offers
+    double cancel_ratio = 0.1;
+    double quote_ratio = 0.1;
+    int seed = 1;
+    Protocol protocol = Protocol::JSON;
+};
+
+// Returns false if arguments are invalid
+bool ParseLoadOptions(int argc, char** argv, LoadOptions& options);
+
+void PrintLoadUsage();
+
+class LoadGenerator;
+
+// Connection of one user. Each connection has at most one request in
+// flight, as server expects one request per read.
+class LoadConnection {
+   public:
+    LoadConnection(boost::asio::io_service& io_service,
+                   LoadGenerator& generator, size_t index);
+
+    void Start(
+        const std::vector<boost::asio::generic::stream_protocol::endpoint>&
+            endpoints);
+
+   private:
+    void HandleConnect(const boost::system::error_code& error);
+
+    void HandleConnectTimeout(const boost::system::error_code& error);
+
+    void Authenticate(const std::string& request_type);
+
+    // Picks next request from order mix, waits for its turn when rate is
+    // limited
+    void SendNext();
+
+    void HandleTimer(const boost::system::error_code& error);
+
+    void Send(RequestKind kind, const nlohmann::json& request);
+
+    void HandleWrite(const boost::system::error_code& error);
+
+    void StartRead();
+
+    void HandleRead(const boost::system::error_code& error,
+                    size_t bytes_transferred);
+
+    void HandleReply(const nlohmann::json& reply);
+
+    void Close(bool failed);
+
+   private:
+    boost::asio::generic::stream_protocol::socket socket_;
+    boost::asio::steady_timer timer_;
+    LoadGenerator& generator_;
+    size_t index_;
+    std::mt19937 random_;
+    bool ready_ = false;
+    bool closed_ = false;
+    // Connection starts in json and switches after protocol request
+    Protocol protocol_ = Protocol::JSON;
+    RequestKind request_kind_ = RequestKind::UNKNOWN;
+    // With limited rate latency is measured from scheduled time of request,
+    // so that delays of server are not hidden by waiting for the reply
+    std::chrono::steady_clock::time_point next_send_;
+    std::chrono::steady_clock::time_point request_start_;
+    std::string request_;
+    std::string input_;
+    enum { max_length = 4096 };
+    char data_[max_length];
+};
+
+class LoadGenerator {
+   public:
+    explicit LoadGenerator(const LoadOptions& options);
+
+    ~LoadGenerator();
+
+    // Blocks until measurement is over and all connections are closed
+    void Run();
+
+    void PrintReport(std::ostream& output) const;
+
+    const LoadOptions& GetOptions() const;
+
+    // Called once by every connection when it is authenticated or failed
+    // or timed out before that. Measurement starts when all connections
+    // are settled.
+    void OnSettled();
+
+    bool IsMeasuring(std::chrono::steady_clock::time_point now) const;
+
+    bool IsFinished(std::chrono::steady_clock::time_point now) const;
+
+    void Record(RequestKind kind, std::chrono::steady_clock::time_point start,
+                std::chrono::steady_clock::time_point end);
+
+    void AddError();
+
+   private:
+    LoadOptions options_;
+    boost::asio::io_service io_service_;
+    std::vector<std::unique_ptr<LoadConnection>> connections_;
+    std::atomic<int> settled_ = 0;
+    // Start of measurement in steady clock ticks, 0 until it starts
+    std::atomic<std::chrono::steady_clock::rep> start_ = 0;
+    std::array<LatencyHistogram, static_cast<size_t>(RequestKind::COUNT)>
+        latencies_;
+    LatencyHistogram total_latency_;
+    std::atomic<uint64_t> errors_ = 0;
+};
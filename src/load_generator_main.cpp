@@ -0,0 +1,21 @@
+#include <exception>
+#include <iostream>
+
+#include "load_generator.h"
+
+int main(int argc, char** argv) {
+    LoadOptions options;
+    if (!ParseLoadOptions(argc, argv, options)) {
+        PrintLoadUsage();
+        return 1;
+    }
+
+    try {
+        LoadGenerator generator(options);
+        generator.Run();
+        generator.PrintReport(std::cout);
+    } catch (std::exception& er) {
+        std::cerr << "ERROR: " << er.what() << std::endl;
+        return 1;
+    }
+}
@@ -1,24 +1,269 @@
 #include "logger.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <ctime>
-#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
 
-Logger::Logger(std::ostream& log_output) : log_output_(log_output) {}
+namespace {
 
-void Logger::Log(LogType log_type, const std::string& message) {
-    auto t = std::time(nullptr);
-    auto tm = *std::localtime(&t);
-    log_output_ << std::put_time(&tm, "%d-%m-%Y %H-%M-%S");
+std::string_view GetLogTypePrefix(LogType log_type) {
     switch (log_type) {
+        case LogType::DEBUG:
+            return " | DEBUG | ";
         case LogType::INFO:
-            log_output_ << " | INFO | ";
-            break;
+            return " | INFO | ";
         case LogType::WARNING:
-            log_output_ << " | WARNING | ";
-            break;
+            return " | WARNING | ";
         case LogType::ERROR:
-            log_output_ << "| ERROR | ";
-            break;
+            return "| ERROR | ";
     }
-    log_output_ << message << ";" << std::endl;
+    return " | ";
 }
+
+// Timestamp is formatted once per second on each thread
+std::string_view GetTimestamp() {
+    thread_local std::time_t cached_time = -1;
+    thread_local char cached_timestamp[32];
+    thread_local size_t cached_size = 0;
+    std::time_t time = std::time(nullptr);
+    if (time != cached_time) {
+        std::tm tm;
+        localtime_r(&time, &tm);
+        cached_size = std::strftime(cached_timestamp, sizeof(cached_timestamp),
+                                    "%d-%m-%Y %H-%M-%S", &tm);
+        cached_time = time;
+    }
+    return std::string_view(cached_timestamp, cached_size);
+}
+
+struct LogRecordHeader {
+    std::ostream* output;
+    uint32_t size;
+};
+
+// Single producer single consumer ring of log records. Positions grow
+// monotonically, record may wrap around end of buffer.
+class LogRing {
+   public:
+    LogRing() : buffer_(std::make_unique<char[]>(Logger::ring_capacity)) {}
+
+    bool TryPush(std::ostream* output,
+                 std::initializer_list<std::string_view> parts) {
+        size_t size = 0;
+        for (std::string_view part : parts) {
+            size += part.size();
+        }
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        uint64_t tail = tail_.load(std::memory_order_acquire);
+        if (sizeof(LogRecordHeader) + size >
+            Logger::ring_capacity - (head - tail)) {
+            return false;
+        }
+
+        LogRecordHeader header{output, static_cast<uint32_t>(size)};
+        CopyIn(head, reinterpret_cast<const char*>(&header), sizeof(header));
+        head += sizeof(header);
+        for (std::string_view part : parts) {
+            CopyIn(head, part.data(), part.size());
+            head += part.size();
+        }
+        head_.store(head, std::memory_order_release);
+        return true;
+    }
+
+    // Writes all complete records, touched outputs are added to outputs
+    bool Drain(std::vector<std::ostream*>& outputs) {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        uint64_t head = head_.load(std::memory_order_acquire);
+        if (tail == head) {
+            return false;
+        }
+        while (tail != head) {
+            LogRecordHeader header;
+            CopyOut(tail, reinterpret_cast<char*>(&header), sizeof(header));
+            tail += sizeof(header);
+            size_t offset = tail % Logger::ring_capacity;
+            size_t first = std::min<size_t>(header.size,
+                                            Logger::ring_capacity - offset);
+            header.output->write(buffer_.get() + offset, first);
+            header.output->write(buffer_.get(), header.size - first);
+            tail += header.size;
+            tail_.store(tail, std::memory_order_release);
+            if (std::find(outputs.begin(), outputs.end(), header.output) ==
+                outputs.end()) {
+                outputs.push_back(header.output);
+            }
+        }
+        return true;
+    }
+
+    bool IsEmpty() const {
+        return tail_.load(std::memory_order_relaxed) ==
+               head_.load(std::memory_order_acquire);
+    }
+
+    // Set when owning thread exits, ring is removed once drained
+    std::atomic<bool> closed = false;
+
+   private:
+    void CopyIn(uint64_t position, const char* data, size_t size) {
+        size_t offset = position % Logger::ring_capacity;
+        size_t first = std::min(size, Logger::ring_capacity - offset);
+        std::memcpy(buffer_.get() + offset, data, first);
+        std::memcpy(buffer_.get(), data + first, size - first);
+    }
+
+    void CopyOut(uint64_t position, char* data, size_t size) const {
+        size_t offset = position % Logger::ring_capacity;
+        size_t first = std::min(size, Logger::ring_capacity - offset);
+        std::memcpy(data, buffer_.get() + offset, first);
+        std::memcpy(data + first, buffer_.get(), size - first);
+    }
+
+   private:
+    std::unique_ptr<char[]> buffer_;
+    alignas(64) std::atomic<uint64_t> head_ = 0;
+    alignas(64) std::atomic<uint64_t> tail_ = 0;
+};
+
+// Owns rings of all threads and drains them on its own thread
+class LogBackend {
+   public:
+    static constexpr std::chrono::milliseconds idle_delay{1};
+
+    LogBackend() : thread_([this] { Run(); }) {}
+
+    ~LogBackend() {
+        stopped_ = true;
+        thread_.join();
+        DrainAll();
+    }
+
+    // Ring is registered on first message of thread, the only time logging
+    // thread takes a lock. Returns nullptr once ring of thread is released,
+    // e.g. in destructors of static objects run after thread locals of main
+    // thread are destroyed.
+    LogRing* GetThreadRing() {
+        // Trivially destructible, so it outlives holder
+        thread_local bool is_released = false;
+        struct RingHolder {
+            ~RingHolder() {
+                if (ring) {
+                    ring->closed = true;
+                }
+                is_released = true;
+            }
+
+            std::shared_ptr<LogRing> ring;
+        };
+        thread_local RingHolder holder;
+        if (is_released) {
+            return nullptr;
+        }
+        if (!holder.ring) {
+            holder.ring = std::make_shared<LogRing>();
+            std::lock_guard lock(rings_mutex_);
+            rings_.push_back(holder.ring);
+        }
+        return holder.ring.get();
+    }
+
+    void AddDropped() { dropped_.fetch_add(1, std::memory_order_relaxed); }
+
+    uint64_t GetDroppedCount() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    bool DrainAll() {
+        std::lock_guard drain_lock(drain_mutex_);
+        std::vector<std::shared_ptr<LogRing>> rings;
+        {
+            std::lock_guard lock(rings_mutex_);
+            std::erase_if(rings_, [](const std::shared_ptr<LogRing>& ring) {
+                return ring->closed && ring->IsEmpty();
+            });
+            rings = rings_;
+        }
+
+        bool drained = false;
+        outputs_.clear();
+        for (const auto& ring : rings) {
+            drained |= ring->Drain(outputs_);
+        }
+        for (std::ostream* output : outputs_) {
+            output->flush();
+        }
+        return drained;
+    }
+
+   private:
+    void Run() {
+        uint64_t reported_dropped = 0;
+        while (!stopped_) {
+            uint64_t dropped = GetDroppedCount();
+            if (dropped != reported_dropped) {
+                std::string message = std::format(
+                    "{} log messages were dropped", dropped - reported_dropped);
+                GetThreadRing()->TryPush(
+                    &std::cerr, {GetTimestamp(),
+                                 GetLogTypePrefix(LogType::WARNING), message,
+                                 ";\n"});
+                reported_dropped = dropped;
+            }
+            if (!DrainAll()) {
+                std::this_thread::sleep_for(idle_delay);
+            }
+        }
+    }
+
+   private:
+    std::mutex rings_mutex_;
+    std::vector<std::shared_ptr<LogRing>> rings_;
+    // Held while draining, so that Flush does not race with drain thread
+    std::mutex drain_mutex_;
+    std::vector<std::ostream*> outputs_;
+    std::atomic<bool> stopped_ = false;
+    std::atomic<uint64_t> dropped_ = 0;
+    std::thread thread_;
+};
+
+LogBackend& GetLogBackend() {
+    static LogBackend backend;
+    return backend;
+}
+
+}  // namespace
+
+Logger::Logger(std::ostream& log_output) : log_output_(log_output) {}
+
+void Logger::Log(LogType log_type, const std::string& message) {
+    if (log_type < min_log_type) {
+        return;
+    }
+    LogBackend& backend = GetLogBackend();
+    LogRing* ring = backend.GetThreadRing();
+    if (ring == nullptr) {
+        // Written in place after messages queued so far
+        backend.DrainAll();
+        log_output_ << GetTimestamp() << GetLogTypePrefix(log_type) << message
+                    << ";\n"
+                    << std::flush;
+        return;
+    }
+    if (!ring->TryPush(&log_output_, {GetTimestamp(),
+                                      GetLogTypePrefix(log_type), message,
+                                      ";\n"})) {
+        backend.AddDropped();
+    }
+}
+
+void Logger::Flush() { GetLogBackend().DrainAll(); }
+
+uint64_t Logger::GetDroppedCount() { return GetLogBackend().GetDroppedCount(); }
@@ -1,20 +1,49 @@
 #pragma once
 
+#include <cstdint>
+#include <format>
 #include <iostream>
 #include <string>
+#include <utility>
 
 enum class LogType {
+    DEBUG,
     INFO,
     WARNING,
     ERROR,
 };
 
+// Messages less severe than LOG_LEVEL (index in LogType) are compiled out
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 1
+#endif
+
+inline constexpr LogType min_log_type = static_cast<LogType>(LOG_LEVEL);
+
+// Log never blocks: message is formatted into lock-free ring of calling
+// thread and written to output by background thread. Messages that do not
+// fit into ring are dropped and counted.
 class Logger {
    public:
+    static constexpr size_t ring_capacity = 1 << 20;
+
     Logger(std::ostream& log_output);
 
     void Log(LogType log_type, const std::string& message);
 
+    // Formats message only if log_type is not filtered at compile time
+    template <LogType log_type, typename... Args>
+    void Log(std::format_string<Args...> format, Args&&... args) {
+        if constexpr (log_type >= min_log_type) {
+            Log(log_type, std::format(format, std::forward<Args>(args)...));
+        }
+    }
+
+    // Waits until messages logged so far are written
+    static void Flush();
+
+    static uint64_t GetDroppedCount();
+
    private:
     std::ostream& log_output_;
 };
@@ -0,0 +1,164 @@
+#include "lz4.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+constexpr size_t min_match = 4;
+// Block always ends with literals, and last match starts this far from end
+constexpr size_t last_literals = 5;
+constexpr size_t match_find_limit = 12;
+constexpr size_t max_offset = 65535;
+constexpr int hash_log = 12;
+// Lengths of literals and matches above this continue in extra bytes
+constexpr size_t max_token_length = 15;
+
+uint32_t Read32(const char* data) {
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+size_t Hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - hash_log);
+}
+
+void WriteLength(size_t length, std::string& output) {
+    for (; length >= 255; length -= 255) {
+        output += static_cast<char>(255);
+    }
+    output += static_cast<char>(length);
+}
+
+// Sequence without match ends the block
+void WriteSequence(std::string_view literals, size_t match_length,
+                   size_t offset, std::string& output) {
+    size_t literal_code = std::min(literals.size(), max_token_length);
+    size_t match_code =
+        match_length == 0
+            ? 0
+            : std::min(match_length - min_match, max_token_length);
+    output += static_cast<char>(literal_code << 4 | match_code);
+    if (literal_code == max_token_length) {
+        WriteLength(literals.size() - max_token_length, output);
+    }
+    output.append(literals);
+    if (match_length == 0) {
+        return;
+    }
+    output += static_cast<char>(offset & 0xff);
+    output += static_cast<char>(offset >> 8);
+    if (match_code == max_token_length) {
+        WriteLength(match_length - min_match - max_token_length, output);
+    }
+}
+
+}  // namespace
+
+void Lz4Compress(std::string_view input, std::string& output) {
+    const char* data = input.data();
+    size_t anchor = 0;
+    if (input.size() > match_find_limit) {
+        std::array<uint32_t, 1 << hash_log> positions{};
+        size_t match_limit = input.size() - match_find_limit;
+        size_t match_end_limit = input.size() - last_literals;
+        size_t position = 0;
+        while (position < match_limit) {
+            uint32_t sequence = Read32(data + position);
+            size_t candidate = positions[Hash(sequence)];
+            positions[Hash(sequence)] = static_cast<uint32_t>(position);
+            if (candidate >= position || position - candidate > max_offset ||
+                Read32(data + candidate) != sequence) {
+                ++position;
+                continue;
+            }
+
+            size_t length = min_match;
+            while (position + length < match_end_limit &&
+                   data[candidate + length] == data[position + length]) {
+                ++length;
+            }
+            while (position > anchor && candidate > 0 &&
+                   data[position - 1] == data[candidate - 1]) {
+                --position;
+                --candidate;
+                ++length;
+            }
+            WriteSequence(input.substr(anchor, position - anchor), length,
+                          position - candidate, output);
+            position += length;
+            anchor = position;
+        }
+    }
+    WriteSequence(input.substr(anchor), 0, 0, output);
+}
+
+bool Lz4Decompress(std::string_view input, size_t size, std::string& output) {
+    // Byte of block yields at most 255 bytes, larger sizes are not allocated
+    if (size / 255 > input.size()) {
+        return false;
+    }
+    size_t start = output.size();
+    output.resize(start + size);
+    char* decompressed = output.data() + start;
+    size_t written = 0;
+    size_t position = 0;
+    auto read_length = [&](size_t& length) {
+        uint8_t byte;
+        do {
+            if (position == input.size()) {
+                return false;
+            }
+            byte = static_cast<uint8_t>(input[position++]);
+            length += byte;
+        } while (byte == 255);
+        return true;
+    };
+    auto fail = [&] {
+        output.resize(start);
+        return false;
+    };
+
+    while (position < input.size()) {
+        auto token = static_cast<uint8_t>(input[position++]);
+        size_t literal_length = token >> 4;
+        if ((literal_length == max_token_length &&
+             !read_length(literal_length)) ||
+            input.size() - position < literal_length ||
+            size - written < literal_length) {
+            return fail();
+        }
+        std::memcpy(decompressed + written, input.data() + position,
+                    literal_length);
+        position += literal_length;
+        written += literal_length;
+        if (position == input.size()) {
+            break;
+        }
+
+        if (input.size() - position < 2) {
+            return fail();
+        }
+        size_t offset = static_cast<uint8_t>(input[position]) |
+                        static_cast<uint8_t>(input[position + 1]) << 8;
+        position += 2;
+        size_t match_length = token & max_token_length;
+        if ((match_length == max_token_length &&
+             !read_length(match_length)) ||
+            offset == 0 || offset > written ||
+            size - written < match_length + min_match) {
+            return fail();
+        }
+        match_length += min_match;
+        // Match may overlap bytes it produces
+        for (size_t i = 0; i < match_length; ++i) {
+            decompressed[written + i] = decompressed[written - offset + i];
+        }
+        written += match_length;
+    }
+
+    return written == size || fail();
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Bundled implementation of LZ4 block format, blocks are interchangeable with
+// those of LZ4_compress_default and LZ4_decompress_safe of liblz4. Compression
+// is greedy with single hash table, which is enough for small replies.
+
+// Appends compressed input to output
+void Lz4Compress(std::string_view input, std::string& output);
+
+// Appends block that decompresses to size bytes to output. Returns false and
+// leaves output untouched if block is malformed or of other size.
+bool Lz4Decompress(std::string_view input, size_t size, std::string& output);
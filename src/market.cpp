@@ -1,5 +1,6 @@
 #include "market.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 #include <optional>
@@ -15,26 +16,68 @@ bool operator<(const OfferQueue& lhs, const OfferQueue& rhs) {
 bool operator<(int lhs, const OfferQueue& rhs) { return lhs < rhs.price; }
 bool operator<(const OfferQueue& lhs, int rhs) { return lhs.price < rhs; }
 
+Market::Market() : Market(GetNullMarketEventSink()) {}
+
+Market::Market(MarketEventSink& event_sink) : event_sink_(event_sink) {}
+
 std::optional<uint64_t> Market::RegisterUser(const std::string& username,
                                              size_t pw_hash) {
-    auto user_data = CreateUser(username, pw_hash);
-    std::optional<uint64_t> user_id =
-        user_data.has_value() ? std::optional<uint64_t>(user_data->GetId())
-                              : std::nullopt;
-
-    if (user_id) {
-        user_id_to_user_data_.insert({*user_id, std::move(*user_data)});
+    if (username_to_credentials_.contains(username)) {
+        return std::nullopt;
     }
 
+    UserData user_data(username);
+    uint64_t user_id = user_data.GetId();
+    user_id_to_user_data_.insert({user_id, std::move(user_data)});
+    username_to_credentials_.insert(
+        {username, {.user_id = user_id, .pw_hash = pw_hash}});
+    event_sink_.OnUserRegistered(user_id, username, pw_hash);
+
     return user_id;
 }
 
+std::optional<uint64_t> Market::Login(const std::string& username,
+                                      size_t pw_hash) const {
+    auto credentials = username_to_credentials_.find(username);
+    if (credentials == username_to_credentials_.end() ||
+        credentials->second.pw_hash != pw_hash) {
+        return std::nullopt;
+    }
+
+    return credentials->second.user_id;
+}
+
+void Market::RestoreUser(uint64_t user_id, const std::string& username,
+                         size_t pw_hash) {
+    user_id_to_user_data_.insert({user_id, UserData(user_id, username)});
+    username_to_credentials_.insert(
+        {username, {.user_id = user_id, .pw_hash = pw_hash}});
+}
+
+void Market::RestoreOffer(uint64_t offer_id, uint64_t owner_id,
+                          OfferType offer_type, int price, size_t amount) {
+    auto offer =
+        std::make_shared<Offer>(offer_id, owner_id, offer_type, price, amount);
+    user_id_to_user_data_.at(owner_id).AddOffer(offer);
+    AddActiveOffer(offer);
+}
+
+void Market::RestoreDeal(uint64_t deal_id, uint64_t seller_id,
+                         uint64_t buyer_id, int price, size_t amount) {
+    auto deal =
+        std::make_shared<Deal>(deal_id, seller_id, buyer_id, price, amount);
+    RegisterDeal(deal);
+    UpdateQuote(deal);
+}
+
 void Market::DepositUSD(uint64_t user_id, size_t usd_amount) {
     user_id_to_user_data_.at(user_id).DepositUSD(usd_amount);
+    event_sink_.OnDeposit(user_id, Currency::USD, usd_amount);
 }
 
 void Market::DepositRUB(uint64_t user_id, size_t rub_amount) {
     user_id_to_user_data_.at(user_id).DepositRUB(rub_amount);
+    event_sink_.OnDeposit(user_id, Currency::RUB, rub_amount);
 }
 
 Balance Market::GetUserBalance(uint64_t user_id) const {
@@ -51,6 +94,123 @@ const std::set<std::shared_ptr<Deal>, std::less<>>& Market::GetClosedDeals(
     return user_id_to_user_data_.at(user_id).GetClosedDeals();
 }
 
+MarketSnapshot Market::MakeSnapshot() const {
+    MarketSnapshot snapshot;
+    snapshot.header.next_user_id = UserData::GetNextId();
+    snapshot.header.next_offer_id = Offer::GetNextId();
+    snapshot.header.next_deal_id = Deal::GetNextId();
+    snapshot.header.has_quote = quote_.has_value();
+    snapshot.header.quote = quote_.value_or(0);
+
+    snapshot.users.reserve(username_to_credentials_.size());
+    for (const auto& [username, credentials] : username_to_credentials_) {
+        const UserData& user_data =
+            user_id_to_user_data_.at(credentials.user_id);
+        Balance balance = user_data.GetBalance();
+        snapshot.users.push_back({.id = credentials.user_id,
+                                  .pw_hash = credentials.pw_hash,
+                                  .usd = balance.usd,
+                                  .rub = balance.rub,
+                                  .username_offset = snapshot.usernames.size(),
+                                  .username_size = username.size()});
+        snapshot.usernames += username;
+
+        // Every deal has exactly one seller, so it is stored once
+        for (const auto& deal : user_data.GetClosedDeals()) {
+            if (deal->GetSeller() == credentials.user_id) {
+                snapshot.deals.push_back({.id = deal->GetId(),
+                                          .seller_id = deal->GetSeller(),
+                                          .buyer_id = deal->GetBuyer(),
+                                          .amount = deal->GetAmount(),
+                                          .price = deal->GetPrice()});
+            }
+        }
+    }
+    std::sort(snapshot.deals.begin(), snapshot.deals.end(),
+              [](const SnapshotDeal& lhs, const SnapshotDeal& rhs) {
+                  return lhs.id < rhs.id;
+              });
+
+    AppendSnapshotOffers(active_sell_offers_, snapshot.offers);
+    AppendSnapshotOffers(active_buy_offers_, snapshot.offers);
+
+    return snapshot;
+}
+
+void Market::AppendSnapshotOffers(
+    const std::set<OfferQueue, std::less<>>& offers,
+    std::vector<SnapshotOffer>& snapshot_offers) {
+    for (const OfferQueue& queue : offers) {
+        // Oldest offer of queue is at its back
+        for (auto it = queue.offers.rbegin(); it != queue.offers.rend(); ++it) {
+            auto offer = it->lock();
+            if (!offer) {
+                continue;
+            }
+            snapshot_offers.push_back(
+                {.id = offer->GetId(),
+                 .owner_id = offer->GetOwnerId(),
+                 .amount = offer->GetAmount(),
+                 .price = offer->GetPrice(),
+                 .type = static_cast<uint8_t>(offer->GetType())});
+        }
+    }
+}
+
+void Market::RestoreSnapshot(const SnapshotView& snapshot) {
+    UserData::SetNextId(snapshot.header.next_user_id);
+    Offer::SetNextId(snapshot.header.next_offer_id);
+    Deal::SetNextId(snapshot.header.next_deal_id);
+    if (snapshot.header.has_quote) {
+        quote_ = snapshot.header.quote;
+    }
+
+    user_id_to_user_data_.reserve(snapshot.users.size());
+    username_to_credentials_.reserve(snapshot.users.size());
+    for (const SnapshotUser& user : snapshot.users) {
+        std::string username(snapshot.usernames.substr(user.username_offset,
+                                                       user.username_size));
+        auto user_data =
+            user_id_to_user_data_.emplace(user.id, UserData(user.id, username))
+                .first;
+        user_data->second.SetBalance({.usd = static_cast<int>(user.usd),
+                                      .rub = static_cast<int>(user.rub)});
+        username_to_credentials_.emplace(
+            std::move(username),
+            UserCredentials{.user_id = user.id, .pw_hash = user.pw_hash});
+    }
+
+    // Offers come level by level in ascending price, oldest first, so each
+    // level is appended at the end of its book without searching it
+    std::set<OfferQueue, std::less<>>* book = nullptr;
+    std::set<OfferQueue, std::less<>>::iterator level;
+    for (const SnapshotOffer& snapshot_offer : snapshot.offers) {
+        auto offer = std::make_shared<Offer>(
+            snapshot_offer.id, snapshot_offer.owner_id,
+            static_cast<OfferType>(snapshot_offer.type), snapshot_offer.price,
+            snapshot_offer.amount);
+        user_id_to_user_data_.at(offer->GetOwnerId()).AddOffer(offer);
+
+        auto& offer_book = offer->GetType() == OfferType::SELL
+                               ? active_sell_offers_
+                               : active_buy_offers_;
+        if (book != &offer_book || level->price != offer->GetPrice()) {
+            book = &offer_book;
+            level = offer_book.emplace_hint(
+                offer_book.end(), OfferQueue{.price = offer->GetPrice()});
+        }
+        level->offers.push_front(offer);
+    }
+
+    for (const SnapshotDeal& snapshot_deal : snapshot.deals) {
+        auto deal = std::make_shared<Deal>(
+            snapshot_deal.id, snapshot_deal.seller_id, snapshot_deal.buyer_id,
+            snapshot_deal.price, snapshot_deal.amount);
+        user_id_to_user_data_.at(deal->GetSeller()).AddDeal(deal);
+        user_id_to_user_data_.at(deal->GetBuyer()).AddDeal(deal);
+    }
+}
+
 std::optional<int> Market::GetQuote() const { return quote_; }
 
 AskBidQuotesInfo Market::GetAskBidQuotes() {
@@ -65,11 +225,26 @@ AskBidQuotesInfo Market::GetAskBidQuotes() {
     return quotes_info;
 }
 
+size_t Market::GetActiveOfferCount() const {
+    size_t count = 0;
+    for (const auto& [user_id, user_data] : user_id_to_user_data_) {
+        count += user_data.GetActiveOffers().size();
+    }
+
+    return count;
+}
+
+size_t Market::GetBookLevels(OfferType offer_type) const {
+    return offer_type == OfferType::SELL ? active_sell_offers_.size()
+                                         : active_buy_offers_.size();
+}
+
 uint64_t Market::PostOffer(uint64_t user_id, OfferType offer_type, int price,
                            size_t amount) {
     auto new_offer =
         std::make_shared<Offer>(user_id, offer_type, price, amount);
     user_id_to_user_data_.at(user_id).AddOffer(new_offer);
+    event_sink_.OnOfferAccepted(*new_offer);
     switch (new_offer->GetType()) {
         case OfferType::SELL: {
             ProcessOffer(
@@ -98,7 +273,13 @@ uint64_t Market::PostOffer(uint64_t user_id, OfferType offer_type, int price,
 }
 
 bool Market::RemoveOffer(uint64_t user_id, uint64_t offer_id) {
-    return user_id_to_user_data_.at(user_id).RemoveActiveOffer(offer_id);
+    bool is_removed =
+        user_id_to_user_data_.at(user_id).RemoveActiveOffer(offer_id);
+    if (is_removed) {
+        event_sink_.OnOfferCanceled(user_id, offer_id);
+    }
+
+    return is_removed;
 }
 
 void Market::AddActiveOffer(const std::shared_ptr<Offer>& offer) {
@@ -145,6 +326,7 @@ std::optional<int> Market::DetermineQuote(OfferType offer_type) {
                 best_offers->offers.pop_back();
                 if (best_offers->offers.empty()) {
                     offers.erase(best_offers);
+                    break;
                 }
             } else {
                 quote = best_offer.lock()->GetPrice();
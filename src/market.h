@@ -1,3 +1,5 @@
+#pragma once
+
 #include <cstdint>
 #include <deque>
 #include <memory>
@@ -5,7 +7,9 @@
 #include <string>
 #include <unordered_map>
 
+#include "market_events.h"
 #include "offer.h"
+#include "snapshot.h"
 #include "user_data.h"
 
 struct OfferQueue {
@@ -21,15 +25,42 @@ struct AskBidQuotesInfo {
     bool operator<=>(const AskBidQuotesInfo& other) const = default;
 };
 
+struct UserCredentials {
+    uint64_t user_id;
+    size_t pw_hash;
+};
+
 bool operator<(const OfferQueue& lhs, const OfferQueue& rhs);
 bool operator<(int lhs, const OfferQueue& rhs);
 bool operator<(const OfferQueue& lhs, int rhs);
 
 class Market {
    public:
+    Market();
+
+    explicit Market(MarketEventSink& event_sink);
+
     std::optional<uint64_t> RegisterUser(const std::string& username,
                                          size_t pw_hash);
 
+    std::optional<uint64_t> Login(const std::string& username,
+                                  size_t pw_hash) const;
+
+    // Adds already registered user, e.g. loaded from database at startup.
+    // No events are emitted.
+    void RestoreUser(uint64_t user_id, const std::string& username,
+                     size_t pw_hash);
+
+    // Puts active offer back to order book. Offers must be restored in
+    // order of ids to keep time priority.
+    void RestoreOffer(uint64_t offer_id, uint64_t owner_id,
+                      OfferType offer_type, int price, size_t amount);
+
+    // Applies closed deal to balances and deal history of its sides. Deals
+    // must be restored in order of ids, last one determines quote.
+    void RestoreDeal(uint64_t deal_id, uint64_t seller_id, uint64_t buyer_id,
+                     int price, size_t amount);
+
     void DepositUSD(uint64_t user_id, size_t usd_amount);
 
     void DepositRUB(uint64_t user_id, size_t rub_amount);
@@ -47,10 +78,24 @@ class Market {
 
     bool RemoveOffer(uint64_t user_id, uint64_t offer_id);
 
+    // Copies full state of market including id counters. Journal sequence
+    // number of snapshot is left for caller to fill.
+    MarketSnapshot MakeSnapshot() const;
+
+    // Fills empty market from snapshot. No events are emitted.
+    void RestoreSnapshot(const SnapshotView& snapshot);
+
     std::optional<int> GetQuote() const;
 
     AskBidQuotesInfo GetAskBidQuotes();
 
+    // Number of offers that are neither fulfilled nor canceled
+    size_t GetActiveOfferCount() const;
+
+    // Number of price levels in order book. Levels are purged lazily, so
+    // emptied ones are counted until matching reaches them.
+    size_t GetBookLevels(OfferType offer_type) const;
+
    private:
     void RegisterDeal(const std::shared_ptr<Deal>& deal);
 
@@ -65,8 +110,15 @@ class Market {
 
     std::optional<int> DetermineQuote(OfferType offer_type);
 
+    static void AppendSnapshotOffers(
+        const std::set<OfferQueue, std::less<>>& offers,
+        std::vector<SnapshotOffer>& snapshot_offers);
+
    private:
+    MarketEventSink& event_sink_;
+
     std::unordered_map<uint64_t, UserData> user_id_to_user_data_;
+    std::unordered_map<std::string, UserCredentials> username_to_credentials_;
 
     std::set<OfferQueue, std::less<>> active_sell_offers_;
     std::set<OfferQueue, std::less<>> active_buy_offers_;
@@ -97,6 +149,7 @@ void Market::ProcessOffer(const std::shared_ptr<Offer>& offer,
         }
 
         auto deal = std::make_shared<Deal>(offer->MakeDeal(*best_offer.lock()));
+        event_sink_.OnTrade(*deal, *offer, *best_offer.lock());
         RegisterDeal(deal);
         UpdateQuote(deal);
         if (best_offer.lock()->GetStatus() == OfferStatus::FULLFILLED) {
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "deal.h"
+#include "offer.h"
+#include "user_data.h"
+
+// Receiver of events emitted by Market. Events are delivered synchronously
+// in the order state changes happen, so sinks should not do heavy work on
+// the calling thread.
+class MarketEventSink {
+   public:
+    virtual void OnUserRegistered(uint64_t user_id, const std::string& username,
+                                  size_t pw_hash) = 0;
+
+    virtual void OnDeposit(uint64_t user_id, Currency currency,
+                           size_t amount) = 0;
+
+    virtual void OnOfferAccepted(const Offer& offer) = 0;
+
+    // Taker is incoming offer, maker is resting offer it was matched with.
+    // Both offers are passed after their amounts were reduced by deal.
+    virtual void OnTrade(const Deal& deal, const Offer& taker,
+                         const Offer& maker) = 0;
+
+    virtual void OnOfferCanceled(uint64_t user_id, uint64_t offer_id) = 0;
+
+    virtual ~MarketEventSink() = default;
+};
+
+// Sink that ignores all events. Used by tests and benchmarks.
+class NullMarketEventSink final : public MarketEventSink {
+   public:
+    void OnUserRegistered(uint64_t, const std::string&, size_t) override {}
+
+    void OnDeposit(uint64_t, Currency, size_t) override {}
+
+    void OnOfferAccepted(const Offer&) override {}
+
+    void OnTrade(const Deal&, const Offer&, const Offer&) override {}
+
+    void OnOfferCanceled(uint64_t, uint64_t) override {}
+};
+
+// Forwards events to every added sink in order of addition
+class MarketEventSinkList final : public MarketEventSink {
+   public:
+    void Add(MarketEventSink& sink) { sinks_.push_back(&sink); }
+
+    void OnUserRegistered(uint64_t user_id, const std::string& username,
+                          size_t pw_hash) override {
+        for (MarketEventSink* sink : sinks_) {
+            sink->OnUserRegistered(user_id, username, pw_hash);
+        }
+    }
+
+    void OnDeposit(uint64_t user_id, Currency currency,
+                   size_t amount) override {
+        for (MarketEventSink* sink : sinks_) {
+            sink->OnDeposit(user_id, currency, amount);
+        }
+    }
+
+    void OnOfferAccepted(const Offer& offer) override {
+        for (MarketEventSink* sink : sinks_) {
+            sink->OnOfferAccepted(offer);
+        }
+    }
+
+    void OnTrade(const Deal& deal, const Offer& taker,
+                 const Offer& maker) override {
+        for (MarketEventSink* sink : sinks_) {
+            sink->OnTrade(deal, taker, maker);
+        }
+    }
+
+    void OnOfferCanceled(uint64_t user_id, uint64_t offer_id) override {
+        for (MarketEventSink* sink : sinks_) {
+            sink->OnOfferCanceled(user_id, offer_id);
+        }
+    }
+
+   private:
+    std::vector<MarketEventSink*> sinks_;
+};
+
+inline MarketEventSink& GetNullMarketEventSink() {
+    static NullMarketEventSink sink;
+    return sink;
+}
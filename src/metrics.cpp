@@ -0,0 +1,172 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <format>
+#include <string>
+#include <utility>
+
+static constexpr std::array<const char*,
+                            static_cast<size_t>(RequestStage::COUNT)>
+    stage_names = {"parse", "match", "persist", "serialize", "write"};
+
+// Nested stages are accumulated per thread, so that handlers running on
+// different threads do not mix their times
+static thread_local std::array<std::chrono::nanoseconds,
+                               static_cast<size_t>(RequestStage::COUNT)>
+    nested_times{};
+
+void LatencyHistogram::Record(uint64_t value) {
+    buckets_[GetBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::Record(std::chrono::nanoseconds duration) {
+    Record(static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0)));
+}
+
+uint64_t LatencyHistogram::GetCount() const {
+    return count_.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::GetSum() const {
+    return sum_.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::GetQuantile(double quantile) const {
+    uint64_t count = GetCount();
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(
+        1, static_cast<uint64_t>(std::ceil(quantile * count)));
+    uint64_t seen = 0;
+    for (size_t index = 0; index < bucket_count; ++index) {
+        seen += buckets_[index].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return GetBucketUpperBound(index);
+        }
+    }
+
+    return GetBucketUpperBound(bucket_count - 1);
+}
+
+// Values below sub_bucket_count have bucket each. Larger value with highest
+// bit at exponent goes to group exponent - sub_bucket_bits, bucket within
+// group is given by sub_bucket_bits bits following the highest one.
+size_t LatencyHistogram::GetBucketIndex(uint64_t value) {
+    if (value < sub_bucket_count) {
+        return value;
+    }
+    int exponent = std::bit_width(value) - 1;
+    if (exponent > max_exponent) {
+        return bucket_count - 1;
+    }
+    int group = exponent - sub_bucket_bits;
+    uint64_t sub_bucket = (value >> group) - sub_bucket_count;
+
+    return sub_bucket_count * (group + 1) + sub_bucket;
+}
+
+uint64_t LatencyHistogram::GetBucketUpperBound(size_t index) {
+    if (index < sub_bucket_count) {
+        return index;
+    }
+    uint64_t group = index / sub_bucket_count - 1;
+    uint64_t sub_bucket = index % sub_bucket_count;
+
+    return ((sub_bucket_count + sub_bucket + 1) << group) - 1;
+}
+
+std::string FormatLatencyHeader() {
+    return std::format("{:<16}{:>12}{:>12}{:>12}{:>12}\n", "Latency, us",
+                       "count", "p50", "p99", "p999");
+}
+
+std::string FormatLatencyRow(const std::string& name,
+                             const LatencyHistogram& histogram) {
+    return std::format("{:<16}{:>12}{:>12.1f}{:>12.1f}{:>12.1f}\n", name,
+                       histogram.GetCount(), histogram.GetQuantile(0.5) / 1e3,
+                       histogram.GetQuantile(0.99) / 1e3,
+                       histogram.GetQuantile(0.999) / 1e3);
+}
+
+StageTimer::StageTimer(RequestStage stage)
+    : stage_(stage), start_(std::chrono::steady_clock::now()) {}
+
+StageTimer::~StageTimer() {
+    nested_times[static_cast<size_t>(stage_)] +=
+        std::chrono::steady_clock::now() - start_;
+}
+
+void Metrics::RecordLatency(RequestKind kind, RequestStage stage,
+                            std::chrono::nanoseconds duration) {
+    latencies_[static_cast<size_t>(kind)][static_cast<size_t>(stage)].Record(
+        duration);
+}
+
+const LatencyHistogram& Metrics::GetLatency(RequestKind kind,
+                                            RequestStage stage) const {
+    return latencies_[static_cast<size_t>(kind)][static_cast<size_t>(stage)];
+}
+
+std::chrono::nanoseconds Metrics::TakeNestedTime(RequestStage stage) {
+    return std::exchange(nested_times[static_cast<size_t>(stage)],
+                         std::chrono::nanoseconds(0));
+}
+
+void Metrics::WritePrometheus(std::string& output) const {
+    output +=
+        "# HELP market_request_latency_seconds Time spent in stage of "
+        "request\n"
+        "# TYPE market_request_latency_seconds summary\n";
+    for (size_t kind = 0; kind < latencies_.size(); ++kind) {
+        for (size_t stage = 0; stage < stage_names.size(); ++stage) {
+            const LatencyHistogram& histogram = latencies_[kind][stage];
+            if (histogram.GetCount() == 0) {
+                continue;
+            }
+            std::string labels = std::format(
+                "request=\"{}\",stage=\"{}\"",
+                GetRequestKindName(static_cast<RequestKind>(kind)),
+                stage_names[stage]);
+            for (double quantile : {0.5, 0.9, 0.99, 0.999}) {
+                output += std::format(
+                    "market_request_latency_seconds{{{},quantile=\"{}\"}} "
+                    "{}\n",
+                    labels, quantile, histogram.GetQuantile(quantile) / 1e9);
+            }
+            output += std::format(
+                "market_request_latency_seconds_sum{{{}}} {}\n"
+                "market_request_latency_seconds_count{{{}}} {}\n",
+                labels, histogram.GetSum() / 1e9, labels,
+                histogram.GetCount());
+        }
+    }
+
+    output += std::format(
+        "# HELP market_orders_total Offers accepted by market\n"
+        "# TYPE market_orders_total counter\n"
+        "market_orders_total {}\n"
+        "# HELP market_fills_total Deals made by market\n"
+        "# TYPE market_fills_total counter\n"
+        "market_fills_total {}\n"
+        "# HELP market_cancels_total Offers canceled by users\n"
+        "# TYPE market_cancels_total counter\n"
+        "market_cancels_total {}\n"
+        "# HELP market_active_sessions Connected clients\n"
+        "# TYPE market_active_sessions gauge\n"
+        "market_active_sessions {}\n"
+        "# HELP market_active_offers Offers neither fulfilled nor canceled\n"
+        "# TYPE market_active_offers gauge\n"
+        "market_active_offers {}\n",
+        orders.Get(), fills.Get(), cancels.Get(), active_sessions.Get(),
+        active_offers.Get());
+}
+
+Metrics& GetMetrics() {
+    static Metrics metrics;
+    return metrics;
+}
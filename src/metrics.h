@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "request.h"
+
+// Stages of handling request. Persistence happens in event sinks and
+// serialization in Serializer while request is matched, their time is
+// subtracted from matching time.
+enum class RequestStage : uint8_t {
+    PARSE,
+    MATCH,
+    PERSIST,
+    SERIALIZE,
+    WRITE,
+    COUNT,
+};
+
+// Log-linear histogram of durations in nanoseconds in the spirit of
+// HdrHistogram: values are grouped by powers of two and every group is split
+// into sub_bucket_count linear buckets, so relative error is bounded by
+// 1 / sub_bucket_count. Recording is a few relaxed atomic increments and
+// never locks.
+class LatencyHistogram {
+   public:
+    static constexpr int sub_bucket_bits = 4;
+    static constexpr uint64_t sub_bucket_count = uint64_t{1} << sub_bucket_bits;
+    // Values above 2^max_exponent ns (about 18 minutes) go to the last bucket
+    static constexpr int max_exponent = 40;
+    static constexpr size_t bucket_count =
+        sub_bucket_count * (max_exponent - sub_bucket_bits + 2);
+
+    void Record(uint64_t value);
+
+    void Record(std::chrono::nanoseconds duration);
+
+    uint64_t GetCount() const;
+
+    uint64_t GetSum() const;
+
+    // Returns upper bound of bucket holding given quantile, 0 if histogram
+    // is empty
+    uint64_t GetQuantile(double quantile) const;
+
+    static size_t GetBucketIndex(uint64_t value);
+
+    static uint64_t GetBucketUpperBound(size_t index);
+
+   private:
+    std::array<std::atomic<uint64_t>, bucket_count> buckets_{};
+    std::atomic<uint64_t> count_ = 0;
+    std::atomic<uint64_t> sum_ = 0;
+};
+
+// Human readable latency table of load tools: count of requests and
+// p50/p99/p99.9 in microseconds
+std::string FormatLatencyHeader();
+
+std::string FormatLatencyRow(const std::string& name,
+                             const LatencyHistogram& histogram);
+
+class Counter {
+   public:
+    void Add(int64_t value) {
+        value_.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void Set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+
+    int64_t Get() const { return value_.load(std::memory_order_relaxed); }
+
+   private:
+    std::atomic<int64_t> value_ = 0;
+};
+
+// Accumulates time of nested stage on current thread while it is alive
+class StageTimer {
+   public:
+    explicit StageTimer(RequestStage stage);
+
+    ~StageTimer();
+
+   private:
+    RequestStage stage_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+class Metrics {
+   public:
+    void RecordLatency(RequestKind kind, RequestStage stage,
+                       std::chrono::nanoseconds duration);
+
+    const LatencyHistogram& GetLatency(RequestKind kind,
+                                       RequestStage stage) const;
+
+    // Returns time of nested stage accumulated on current thread since the
+    // previous call
+    std::chrono::nanoseconds TakeNestedTime(RequestStage stage);
+
+    // Appends all metrics in Prometheus text format
+    void WritePrometheus(std::string& output) const;
+
+    Counter orders;
+    Counter fills;
+    Counter cancels;
+    Counter active_sessions;
+    Counter active_offers;
+
+   private:
+    std::array<std::array<LatencyHistogram,
+                          static_cast<size_t>(RequestStage::COUNT)>,
+               static_cast<size_t>(RequestKind::COUNT)>
+        latencies_;
+};
+
+Metrics& GetMetrics();
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "deal.h"
+#include "market_events.h"
+#include "metrics.h"
+#include "offer.h"
+#include "user_data.h"
+
+// Counts orders, fills and cancels and keeps number of resting offers
+class MetricsEventSink final : public MarketEventSink {
+   public:
+    void OnUserRegistered(uint64_t, const std::string&, size_t) override {}
+
+    void OnDeposit(uint64_t, Currency, size_t) override {}
+
+    void OnOfferAccepted(const Offer&) override {
+        GetMetrics().orders.Add(1);
+        GetMetrics().active_offers.Add(1);
+    }
+
+    void OnTrade(const Deal&, const Offer& taker, const Offer& maker) override {
+        GetMetrics().fills.Add(1);
+        GetMetrics().active_offers.Add(-static_cast<int64_t>(
+            (taker.GetAmount() == 0) + (maker.GetAmount() == 0)));
+    }
+
+    void OnOfferCanceled(uint64_t, uint64_t) override {
+        GetMetrics().cancels.Add(1);
+        GetMetrics().active_offers.Add(-1);
+    }
+};
+
+// Forwards events to another sink, time spent there is accounted as
+// persistence of current request
+class TimedEventSink final : public MarketEventSink {
+   public:
+    explicit TimedEventSink(MarketEventSink& sink) : sink_(sink) {}
+
+    void OnUserRegistered(uint64_t user_id, const std::string& username,
+                          size_t pw_hash) override {
+        StageTimer timer(RequestStage::PERSIST);
+        sink_.OnUserRegistered(user_id, username, pw_hash);
+    }
+
+    void OnDeposit(uint64_t user_id, Currency currency,
+                   size_t amount) override {
+        StageTimer timer(RequestStage::PERSIST);
+        sink_.OnDeposit(user_id, currency, amount);
+    }
+
+    void OnOfferAccepted(const Offer& offer) override {
+        StageTimer timer(RequestStage::PERSIST);
+        sink_.OnOfferAccepted(offer);
+    }
+
+    void OnTrade(const Deal& deal, const Offer& taker,
+                 const Offer& maker) override {
+        StageTimer timer(RequestStage::PERSIST);
+        sink_.OnTrade(deal, taker, maker);
+    }
+
+    void OnOfferCanceled(uint64_t user_id, uint64_t offer_id) override {
+        StageTimer timer(RequestStage::PERSIST);
+        sink_.OnOfferCanceled(user_id, offer_id);
+    }
+
+   private:
+    MarketEventSink& sink_;
+};
@@ -4,21 +4,17 @@
 #include <cstdint>
 #include <stdexcept>
 
-#ifndef TEST
-#include "db_manager.h"
-#endif  // !TEST
-
 Offer::Offer(uint64_t owner_id, OfferType type, int price, size_t amount)
-    : id_(GenerateId()),
+    : Offer(GenerateId(), owner_id, type, price, amount) {}
+
+Offer::Offer(uint64_t id, uint64_t owner_id, OfferType type, int price,
+             size_t amount)
+    : id_(id),
       owner_id_(owner_id),
       type_(type),
       price_(price),
       amount_(amount),
-      status_(OfferStatus::ACTIVE) {
-#ifndef TEST
-    GetDBManager().AddOffer(id_, owner_id_, type_, amount_, price_);
-#endif  // !TEST
-}
+      status_(OfferStatus::ACTIVE) {}
 
 Deal Offer::MakeDeal(Offer& other) {
     if (this->type_ == other.type_) {
@@ -57,6 +53,10 @@ OfferType Offer::GetType() const { return type_; }
 
 OfferStatus Offer::GetStatus() const { return status_; }
 
+uint64_t Offer::GetNextId() { return offer_id_; }
+
+void Offer::SetNextId(uint64_t next_id) { offer_id_ = next_id; }
+
 uint64_t Offer::GenerateId() { return offer_id_++; }
 
 bool operator<(const std::shared_ptr<Offer>& lhs,
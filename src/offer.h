@@ -22,6 +22,9 @@ class Offer {
    public:
     explicit Offer(uint64_t owner_id, OfferType type, int price, size_t amount);
 
+    Offer(uint64_t id, uint64_t owner_id, OfferType type, int price,
+          size_t amount);
+
     Deal MakeDeal(Offer& other);
 
     int GetPrice() const;
@@ -36,6 +39,12 @@ class Offer {
 
     OfferStatus GetStatus() const;
 
+    // Id counter is shared by all instances. Reset is used when market
+    // state is rebuilt from journal or snapshot.
+    static uint64_t GetNextId();
+
+    static void SetNextId(uint64_t next_id);
+
    private:
     static uint64_t GenerateId();
 
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <exception>
+#include <string>
+
+// Helpers for command line options of executables, return false if
+// argument is invalid
+
+inline constexpr int max_port = 65535;
+
+inline bool ParseNumber(const std::string& arg, int min_value, int max_value,
+                        int& value) {
+    try {
+        size_t parsed_size;
+        value = std::stoi(arg, &parsed_size);
+        return parsed_size == arg.size() && value >= min_value &&
+               value <= max_value;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+inline bool ParseNumber(const std::string& arg, double min_value,
+                        double max_value, double& value) {
+    try {
+        size_t parsed_size;
+        value = std::stod(arg, &parsed_size);
+        return parsed_size == arg.size() && value >= min_value &&
+               value <= max_value;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+inline bool ParseAddress(const std::string& arg, std::string& host,
+                         int& port) {
+    size_t colon = arg.rfind(':');
+    if (colon == std::string::npos || colon == 0) {
+        return false;
+    }
+    host = arg.substr(0, colon);
+    return ParseNumber(arg.substr(colon + 1), 1, max_port, port);
+}
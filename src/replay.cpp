@@ -0,0 +1,337 @@
+#include "replay.h"
+
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include "capture.h"
+#include "option_parsing.h"
+
+using boost::asio::ip::tcp;
+using nlohmann::json;
+
+bool ParseReplayOptions(int argc, char** argv, ReplayOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        std::string value = argv[++i];
+        bool is_valid = true;
+        if (arg == "--capture") {
+            options.capture_path = value;
+        } else if (arg == "--target") {
+            options.target = value;
+            is_valid = value == "market" || value == "server";
+        } else if (arg == "--host") {
+            options.host = value;
+        } else if (arg == "--port") {
+            is_valid = ParseNumber(value, 1, max_port, options.port);
+        } else if (arg == "--speed") {
+            is_valid = ParseNumber(value, 0.0, 1e9, options.speed);
+        } else {
+            is_valid = false;
+        }
+        if (!is_valid) {
+            return false;
+        }
+    }
+
+    return !options.capture_path.empty();
+}
+
+void PrintReplayUsage() {
+    std::cout << "Usage: replay.out --capture <path> [options]\n"
+                 "    --capture <path>         requests recorded by "
+                 "server.out --capture\n"
+                 "    --target <market|server> apply requests to market in "
+                 "process or send them to server (default market)\n"
+                 "    --host <host>            server host (default "
+                 "127.0.0.1)\n"
+                 "    --port <port>            server port (default 5555)\n"
+                 "    --speed <x>              1 keeps timing of capture, "
+                 "0 as fast as possible (default 0)"
+              << std::endl;
+}
+
+void StateHasher::Add(int64_t value) {
+    for (int byte = 0; byte < 8; ++byte) {
+        hash_ ^= static_cast<uint8_t>(value >> (8 * byte));
+        hash_ *= 1099511628211ull;
+    }
+}
+
+void StateHasher::Add(const std::optional<int>& value) {
+    Add(value.has_value());
+    Add(value.value_or(0));
+}
+
+uint64_t StateHasher::GetHash() const { return hash_; }
+
+std::optional<uint64_t> MarketReplayTarget::Execute(RequestKind kind,
+                                                    const json& request) {
+    switch (kind) {
+        case RequestKind::REGISTRATION:
+            return market_.RegisterUser(request.at(json_field::USERNAME),
+                                        request.at(json_field::PW_HASH));
+        case RequestKind::LOGIN:
+            return market_.Login(request.at(json_field::USERNAME),
+                                 request.at(json_field::PW_HASH));
+        case RequestKind::BALANCE:
+            market_.GetUserBalance(request.at(json_field::USER_ID));
+            break;
+        case RequestKind::ACTIVE_OFFERS:
+            market_.GetActiveOffers(request.at(json_field::USER_ID));
+            break;
+        case RequestKind::CLOSED_DEALS:
+            market_.GetClosedDeals(request.at(json_field::USER_ID));
+            break;
+        case RequestKind::POST_OFFER:
+            market_.PostOffer(
+                request.at(json_field::USER_ID),
+                request.at(json_field::OFFER_SIDE) == json_field::BUY
+                    ? OfferType::BUY
+                    : OfferType::SELL,
+                request.at(json_field::PRICE), request.at(json_field::AMOUNT));
+            break;
+        case RequestKind::QUOTES:
+            market_.GetQuote();
+            market_.GetAskBidQuotes();
+            break;
+        case RequestKind::CANCEL:
+            market_.RemoveOffer(request.at(json_field::USER_ID),
+                                request.at(json_field::OFFER_ID));
+            break;
+        default:
+            throw std::invalid_argument("Unknown request type");
+    }
+    return std::nullopt;
+}
+
+// Values are added in order of fields of server responses
+void MarketReplayTarget::HashState(const std::set<uint64_t>& user_ids,
+                                   StateHasher& hasher) {
+    for (uint64_t user_id : user_ids) {
+        Balance balance = market_.GetUserBalance(user_id);
+        hasher.Add(balance.usd);
+        hasher.Add(balance.rub);
+
+        const auto& offers = market_.GetActiveOffers(user_id);
+        for (OfferType type : {OfferType::BUY, OfferType::SELL}) {
+            for (const auto& offer : offers) {
+                if (offer->GetType() == type) {
+                    hasher.Add(offer->GetId());
+                    hasher.Add(offer->GetPrice());
+                    hasher.Add(offer->GetAmount());
+                }
+            }
+            hasher.Add(-1);
+        }
+
+        const auto& deals = market_.GetClosedDeals(user_id);
+        for (const std::string& side :
+             {json_field::BUY, json_field::SELL, json_field::BUY_SELL}) {
+            for (const auto& deal : deals) {
+                const std::string& deal_side =
+                    deal->GetBuyer() == deal->GetSeller() ? json_field::BUY_SELL
+                    : deal->GetBuyer() == user_id         ? json_field::BUY
+                                                          : json_field::SELL;
+                if (deal_side == side) {
+                    hasher.Add(deal->GetPrice());
+                    hasher.Add(deal->GetAmount());
+                }
+            }
+            hasher.Add(-1);
+        }
+    }
+
+    AskBidQuotesInfo quotes = market_.GetAskBidQuotes();
+    hasher.Add(market_.GetQuote());
+    hasher.Add(quotes.ask_quote);
+    hasher.Add(quotes.bid_quote);
+}
+
+ServerReplayTarget::ServerReplayTarget(const std::string& host, int port)
+    : endpoints_(tcp::resolver(io_service_).resolve(host,
+                                                    std::to_string(port))),
+      socket_(Connect()) {}
+
+tcp::socket ServerReplayTarget::Connect() {
+    tcp::socket socket(io_service_);
+    boost::asio::connect(socket, endpoints_);
+    socket.set_option(tcp::no_delay(true));
+    return socket;
+}
+
+tcp::socket& ServerReplayTarget::GetConnection(const json& request) {
+    if (!request.contains(json_field::USER_ID)) {
+        return socket_;
+    }
+    auto user_socket =
+        user_sockets_.find(request.at(json_field::USER_ID).get<uint64_t>());
+    if (user_socket == user_sockets_.end()) {
+        throw std::runtime_error("User has not logged in");
+    }
+    return user_socket->second;
+}
+
+std::optional<uint64_t> ServerReplayTarget::Execute(RequestKind kind,
+                                                    const json& request) {
+    if (kind == RequestKind::REGISTRATION || kind == RequestKind::LOGIN) {
+        tcp::socket socket = Connect();
+        json reply = Request(socket, request);
+        if (!reply.at(json_field::SUCCESS)) {
+            return std::nullopt;
+        }
+        auto user_id = reply.at(json_field::USER_ID).get<uint64_t>();
+        user_sockets_.insert_or_assign(user_id, std::move(socket));
+        return user_id;
+    }
+
+    json reply = Request(request);
+    if (reply.is_string() &&
+        reply.get<std::string>().starts_with("ERROR")) {
+        throw std::runtime_error(reply.get<std::string>());
+    }
+    return std::nullopt;
+}
+
+void ServerReplayTarget::HashState(const std::set<uint64_t>& user_ids,
+                                   StateHasher& hasher) {
+    auto add_optional = [&hasher](const json& value) {
+        hasher.Add(value.is_null() ? std::nullopt
+                                   : std::optional<int>(value.get<int>()));
+    };
+
+    for (uint64_t user_id : user_ids) {
+        json balance = Request({{json_field::TYPE, requests::BALANCE},
+                                {json_field::USER_ID, user_id}});
+        hasher.Add(balance.at(json_field::USD).get<int64_t>());
+        hasher.Add(balance.at(json_field::RUB).get<int64_t>());
+
+        json offers = Request({{json_field::TYPE, requests::ACTIVE_OFFERS},
+                               {json_field::USER_ID, user_id}});
+        for (const std::string& side : {json_field::BUY, json_field::SELL}) {
+            for (const json& offer : offers.at(side)) {
+                hasher.Add(offer.at(json_field::OFFER_ID).get<int64_t>());
+                hasher.Add(offer.at(json_field::PRICE).get<int64_t>());
+                hasher.Add(offer.at(json_field::AMOUNT).get<int64_t>());
+            }
+            hasher.Add(-1);
+        }
+
+        json deals = Request({{json_field::TYPE, requests::CLOSED_DEALS},
+                              {json_field::USER_ID, user_id}});
+        for (const std::string& side :
+             {json_field::BUY, json_field::SELL, json_field::BUY_SELL}) {
+            for (const json& deal : deals.at(side)) {
+                hasher.Add(deal.at(json_field::PRICE).get<int64_t>());
+                hasher.Add(deal.at(json_field::AMOUNT).get<int64_t>());
+            }
+            hasher.Add(-1);
+        }
+    }
+
+    json quotes = Request({{json_field::TYPE, requests::QUOTES}});
+    add_optional(quotes.at(json_field::QUOTE));
+    add_optional(quotes.at(json_field::ASK_QUOTE));
+    add_optional(quotes.at(json_field::BID_QUOTE));
+}
+
+json ServerReplayTarget::Request(const json& request) {
+    return Request(GetConnection(request), request);
+}
+
+// Replies are not framed, reply is complete once it is valid json
+json ServerReplayTarget::Request(tcp::socket& socket, const json& request) {
+    boost::asio::write(socket, boost::asio::buffer(request.dump()));
+    std::string reply;
+    do {
+        size_t size = socket.read_some(boost::asio::buffer(data_));
+        reply.append(data_, size);
+    } while (!json::accept(reply));
+    return json::parse(reply);
+}
+
+void ReplayCapture(const ReplayOptions& options, ReplayTarget& target,
+                   ReplayReport& report) {
+    std::set<uint64_t> user_ids;
+    auto start = std::chrono::steady_clock::now();
+    ReadCapture(options.capture_path, [&](std::chrono::microseconds time,
+                                          json& request) {
+        const json& type = request[json_field::TYPE];
+        RequestKind kind = type.is_string()
+                               ? GetRequestKind(type.get<std::string>())
+                               : RequestKind::UNKNOWN;
+        // Metrics and protocol switches do not change market and are not
+        // known to Market
+        if (kind == RequestKind::METRICS || kind == RequestKind::PROTOCOL) {
+            return;
+        }
+        // Compression changes only encoding of replies
+        request.erase(json_field::COMPRESSION);
+        auto request_start = std::chrono::steady_clock::now();
+        if (options.speed > 0) {
+            auto scheduled =
+                start + std::chrono::duration_cast<
+                            std::chrono::steady_clock::duration>(
+                            std::chrono::duration<double, std::micro>(
+                                time.count() / options.speed));
+            if (scheduled > request_start) {
+                std::this_thread::sleep_until(scheduled);
+                request_start = std::chrono::steady_clock::now();
+            }
+            report.max_delay =
+                std::max(report.max_delay, request_start - scheduled);
+        }
+
+        try {
+            if (auto user_id = target.Execute(kind, request)) {
+                user_ids.insert(*user_id);
+            }
+        } catch (const boost::system::system_error&) {
+            throw;
+        } catch (const std::exception&) {
+            ++report.errors;
+        }
+        auto latency = std::chrono::steady_clock::now() - request_start;
+        report.latencies[static_cast<size_t>(kind)].Record(latency);
+        report.total_latency.Record(latency);
+        ++report.requests;
+    });
+    report.elapsed = std::chrono::steady_clock::now() - start;
+
+    StateHasher hasher;
+    target.HashState(user_ids, hasher);
+    report.state_hash = hasher.GetHash();
+}
+
+void PrintReplayReport(const ReplayOptions& options,
+                       const ReplayReport& report, std::ostream& output) {
+    double seconds = std::chrono::duration<double>(report.elapsed).count();
+    output << std::format(
+        "Replayed {} requests to {} in {:.3f} s, errors: {}, throughput: "
+        "{:.0f} requests/s\n",
+        report.requests, options.target, seconds, report.errors,
+        seconds > 0 ? report.requests / seconds : 0);
+    if (options.speed > 0) {
+        output << std::format(
+            "Speed: {}x, max delay behind capture: {:.1f} ms\n", options.speed,
+            std::chrono::duration<double, std::milli>(report.max_delay)
+                .count());
+    }
+    output << FormatLatencyHeader()
+           << FormatLatencyRow("all", report.total_latency);
+    for (size_t kind = 0; kind < report.latencies.size(); ++kind) {
+        if (report.latencies[kind].GetCount() != 0) {
+            output << FormatLatencyRow(
+                GetRequestKindName(static_cast<RequestKind>(kind)),
+                report.latencies[kind]);
+        }
+    }
+    output << std::format("State hash: {:016x}", report.state_hash)
+           << std::endl;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+#include "common.h"
+#include "json.h"
+#include "market.h"
+#include "metrics.h"
+
+// Options of replay.out, set from command line
+struct ReplayOptions {
+    std::string capture_path;
+    // "market" applies requests to Market in process, "server" sends them to
+    // running server.out
+    std::string target = "market";
+    std::string host = "127.0.0.1";
+    int port = ::port;
+    // 1 keeps timing of capture, 10 plays it ten times faster, 0 sends
+    // requests as fast as possible
+    double speed = 0;
+};
+
+// Returns false if arguments are invalid
+bool ParseReplayOptions(int argc, char** argv, ReplayOptions& options);
+
+void PrintReplayUsage();
+
+// FNV-1a hash of market state as users see it: balances, active offers and
+// closed deals of every user and quotes. Both targets add the same values
+// in the same order, so their hashes are comparable.
+class StateHasher {
+   public:
+    void Add(int64_t value);
+
+    void Add(const std::optional<int>& value);
+
+    uint64_t GetHash() const;
+
+   private:
+    uint64_t hash_ = 14695981039346656037ull;
+};
+
+class ReplayTarget {
+   public:
+    virtual ~ReplayTarget() = default;
+
+    // Returns id of user for successful registration or login. Throws if
+    // request fails.
+    virtual std::optional<uint64_t> Execute(RequestKind kind,
+                                            const nlohmann::json& request) = 0;
+
+    virtual void HashState(const std::set<uint64_t>& user_ids,
+                           StateHasher& hasher) = 0;
+};
+
+// Drives Market directly with null event sink, so neither database nor
+// journal is involved
+class MarketReplayTarget final : public ReplayTarget {
+   public:
+    std::optional<uint64_t> Execute(RequestKind kind,
+                                    const nlohmann::json& request) override;
+
+    void HashState(const std::set<uint64_t>& user_ids,
+                   StateHasher& hasher) override;
+
+   private:
+    Market market_;
+};
+
+// Sends requests one by one to server.out. Server binds connection to user
+// that logged in on it, so every registration and login is made on new
+// connection, which then carries requests of that user.
+class ServerReplayTarget final : public ReplayTarget {
+   public:
+    ServerReplayTarget(const std::string& host, int port);
+
+    std::optional<uint64_t> Execute(RequestKind kind,
+                                    const nlohmann::json& request) override;
+
+    void HashState(const std::set<uint64_t>& user_ids,
+                   StateHasher& hasher) override;
+
+   private:
+    boost::asio::ip::tcp::socket Connect();
+
+    // Connection of user named in request, or common one if request does not
+    // name user. Throws if user has not logged in.
+    boost::asio::ip::tcp::socket& GetConnection(const nlohmann::json& request);
+
+    nlohmann::json Request(const nlohmann::json& request);
+
+    nlohmann::json Request(boost::asio::ip::tcp::socket& socket,
+                           const nlohmann::json& request);
+
+   private:
+    boost::asio::io_service io_service_;
+    boost::asio::ip::tcp::resolver::results_type endpoints_;
+    boost::asio::ip::tcp::socket socket_;
+    std::unordered_map<uint64_t, boost::asio::ip::tcp::socket> user_sockets_;
+    enum { max_length = 4096 };
+    char data_[max_length];
+};
+
+struct ReplayReport {
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    std::chrono::steady_clock::duration elapsed{};
+    // Largest lag of request behind timing of capture
+    std::chrono::steady_clock::duration max_delay{};
+    std::array<LatencyHistogram, static_cast<size_t>(RequestKind::COUNT)>
+        latencies;
+    LatencyHistogram total_latency;
+    uint64_t state_hash = 0;
+};
+
+// Replays capture into target and hashes resulting state. Failed requests
+// are counted as errors, connection failures are thrown.
+void ReplayCapture(const ReplayOptions& options, ReplayTarget& target,
+                   ReplayReport& report);
+
+void PrintReplayReport(const ReplayOptions& options,
+                       const ReplayReport& report, std::ostream& output);
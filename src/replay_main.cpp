@@ -0,0 +1,39 @@
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <memory>
+
+#include "deal.h"
+#include "offer.h"
+#include "replay.h"
+#include "user_data.h"
+
+// Market target starts from empty market, same as server with empty db
+std::atomic<uint64_t> Offer::offer_id_ = 0;
+std::atomic<uint64_t> Deal::deal_id_ = 0;
+std::atomic<uint64_t> UserData::user_id_ = 0;
+
+int main(int argc, char** argv) {
+    ReplayOptions options;
+    if (!ParseReplayOptions(argc, argv, options)) {
+        PrintReplayUsage();
+        return 1;
+    }
+
+    try {
+        std::unique_ptr<ReplayTarget> target;
+        if (options.target == "server") {
+            target = std::make_unique<ServerReplayTarget>(options.host,
+                                                          options.port);
+        } else {
+            target = std::make_unique<MarketReplayTarget>();
+        }
+        ReplayReport report;
+        ReplayCapture(options, *target, report);
+        PrintReplayReport(options, report, std::cout);
+    } catch (std::exception& er) {
+        std::cerr << "ERROR: " << er.what() << std::endl;
+        return 1;
+    }
+}
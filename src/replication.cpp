@@ -0,0 +1,633 @@
+#include "replication.h"
+
+#include <boost/asio/placeholders.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/bind/bind.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "binary_io.h"
+#include "serializer.h"
+#include "server_options.h"
+#include "snapshot.h"
+
+using boost::asio::ip::tcp;
+
+static constexpr size_t message_header_size =
+    sizeof(ReplicationMessageType) + sizeof(uint64_t);
+static constexpr uint64_t max_message_size = uint64_t{1} << 32;
+
+void AppendReplicationMessage(ReplicationMessageType type,
+                              std::string_view payload, std::string& buffer) {
+    BinaryWriter writer(buffer);
+    writer.Write(type);
+    writer.Write(static_cast<uint64_t>(payload.size()));
+    buffer.append(payload);
+}
+
+size_t DecodeReplicationMessage(std::string_view data,
+                                ReplicationMessageType& type,
+                                std::string_view& payload) {
+    BinaryReader reader(data);
+    uint64_t size;
+    if (!reader.Read(type) || !reader.Read(size) ||
+        reader.Remaining() < size) {
+        return 0;
+    }
+    payload = data.substr(message_header_size, size);
+
+    return message_header_size + size;
+}
+
+// Returns true if data starts with header of message larger than max_size
+static bool ExceedsMessageSize(std::string_view data, uint64_t max_size) {
+    BinaryReader reader(data);
+    ReplicationMessageType type;
+    uint64_t size;
+    return reader.Read(type) && reader.Read(size) && size > max_size;
+}
+
+static std::string MakeSeqPayload(uint64_t seq) {
+    std::string payload;
+    BinaryWriter(payload).Write(seq);
+    return payload;
+}
+
+ReplicaConnection::ReplicaConnection(boost::asio::io_service& io_service,
+                                     ReplicationServer& server)
+    : socket_(io_service), server_(server) {}
+
+void ReplicaConnection::Start() {
+    boost::system::error_code error;
+    auto endpoint = socket_.remote_endpoint(error);
+    name_ = std::format("{}:{}", endpoint.address().to_string(),
+                        endpoint.port());
+    server_.GetLogger().Log(LogType::INFO,
+                            std::format("Replica {} connected", name_));
+    StartRead();
+}
+
+void ReplicaConnection::SendRecord(std::string_view frame) {
+    if (!subscribed_) {
+        return;
+    }
+    if (syncing_) {
+        AppendReplicationMessage(ReplicationMessageType::RECORD, frame, live_);
+    } else {
+        Send(ReplicationMessageType::RECORD, frame);
+    }
+    if (GetBacklog() > ReplicationServer::max_replica_backlog) {
+        server_.GetLogger().Log(
+            LogType::WARNING,
+            std::format("Replica {} is too far behind, disconnecting", name_));
+        Close();
+    }
+}
+
+void ReplicaConnection::Close() {
+    if (closed_) {
+        return;
+    }
+    closed_ = true;
+    boost::system::error_code error;
+    socket_.close(error);
+    server_.GetLogger().Log(LogType::INFO,
+                            std::format("Replica {} disconnected", name_));
+    server_.RemoveConnection(this);
+}
+
+tcp::socket& ReplicaConnection::GetSocket() { return socket_; }
+
+const std::string& ReplicaConnection::GetName() const { return name_; }
+
+uint64_t ReplicaConnection::GetAckedSeq() const { return acked_seq_; }
+
+// Snapshot or chunk of journal being sent is not counted, it is as large
+// as state of market or chunk size however far behind replica is
+size_t ReplicaConnection::GetBacklog() const {
+    return pending_.size() + (is_writing_sync_ ? 0 : writing_.size()) +
+           live_.size();
+}
+
+void ReplicaConnection::StartRead() {
+    socket_.async_read_some(
+        boost::asio::buffer(data_, max_length),
+        boost::bind(&ReplicaConnection::HandleRead, shared_from_this(),
+                    boost::asio::placeholders::error,
+                    boost::asio::placeholders::bytes_transferred));
+}
+
+void ReplicaConnection::HandleRead(const boost::system::error_code& error,
+                                   size_t bytes_transferred) {
+    if (error || closed_) {
+        Close();
+        return;
+    }
+
+    input_.append(data_, bytes_transferred);
+    std::string_view input = input_;
+    ReplicationMessageType type;
+    std::string_view payload;
+    while (size_t consumed = DecodeReplicationMessage(input, type, payload)) {
+        uint64_t seq = 0;
+        if (payload.size() != sizeof(seq)) {
+            Close();
+            return;
+        }
+        BinaryReader(payload).Read(seq);
+        if (type == ReplicationMessageType::HELLO && !subscribed_) {
+            HandleHello(seq);
+        } else if (type == ReplicationMessageType::ACK && subscribed_) {
+            acked_seq_ = seq;
+        } else {
+            Close();
+            return;
+        }
+        if (closed_) {
+            return;
+        }
+        input.remove_prefix(consumed);
+    }
+    input_.erase(0, input_.size() - input.size());
+    if (ExceedsMessageSize(input_, sizeof(uint64_t))) {
+        Close();
+        return;
+    }
+
+    StartRead();
+}
+
+void ReplicaConnection::HandleHello(uint64_t seq) {
+    uint64_t last_seq = GetSerializer().GetLastSeq();
+    if (seq > last_seq) {
+        server_.GetLogger().Log(
+            LogType::ERROR,
+            std::format("Replica {} is ahead of primary ({} > {})", name_, seq,
+                        last_seq));
+        Close();
+        return;
+    }
+
+    subscribed_ = true;
+    acked_seq_ = seq;
+    sync_seq_ = last_seq;
+    server_.GetLogger().Log(
+        LogType::INFO,
+        std::format("Replica {} subscribed at journal record {}", name_, seq));
+
+    // Empty replica gets whole state at once instead of entire journal:
+    // the newest snapshot on disk and records after it, both read in
+    // background. Without snapshot on disk market is copied right here, on
+    // matching thread, which stalls matching for time proportional to
+    // state of market. Periodic snapshots (--snapshot-interval) avoid that.
+    if (seq == 0) {
+        syncing_ = true;
+        const ServerOptions& options = GetServerOptions();
+        if (std::filesystem::exists(options.snapshot_path)) {
+            GetSerializer().FlushJournalBuffer();
+            StartSyncTask([this, snapshot_path = options.snapshot_path,
+                           journal_path = options.journal_path] {
+                return ReadSnapshot(snapshot_path, journal_path);
+            });
+            return;
+        }
+        next_sync_seq_ = last_seq + 1;
+        StartSyncTask(
+            [snapshot = GetSerializer().MakeSnapshot()]() -> std::string {
+                std::string payload;
+                EncodeSnapshot(snapshot.GetView(), payload);
+                std::string message;
+                AppendReplicationMessage(ReplicationMessageType::SNAPSHOT,
+                                         payload, message);
+                return message;
+            });
+    } else if (seq < last_seq) {
+        syncing_ = true;
+        next_sync_seq_ = seq + 1;
+        // Records are read back from file, so buffered ones are written
+        // there first
+        GetSerializer().FlushJournalBuffer();
+        ContinueSync();
+    }
+}
+
+// Task holds connection until its result is handled on io thread
+void ReplicaConnection::StartSyncTask(std::function<std::string()> task) {
+    boost::asio::post(
+        server_.GetSyncPool(),
+        [self = shared_from_this(), task = std::move(task)]() mutable {
+            std::string messages;
+            std::string error;
+            try {
+                messages = task();
+            } catch (const std::exception& task_error) {
+                error = task_error.what();
+            }
+            auto executor = self->socket_.get_executor();
+            boost::asio::post(executor, [self = std::move(self),
+                                         messages = std::move(messages),
+                                         error = std::move(error)]() mutable {
+                self->HandleSyncTask(std::move(messages), error);
+            });
+        });
+}
+
+void ReplicaConnection::HandleSyncTask(std::string messages,
+                                       const std::string& error) {
+    if (closed_) {
+        return;
+    }
+    if (!error.empty()) {
+        server_.GetLogger().Log(
+            LogType::ERROR,
+            std::format("Unable to sync replica {}: {}", name_, error));
+        Close();
+        return;
+    }
+    if (messages.empty()) {
+        ContinueSync();
+        return;
+    }
+
+    // Nothing else is written while syncing
+    writing_ = std::move(messages);
+    is_writing_sync_ = true;
+    Write();
+}
+
+void ReplicaConnection::ContinueSync() {
+    if (next_sync_seq_ <= sync_seq_) {
+        StartSyncTask([this, path = GetServerOptions().journal_path] {
+            return ReadJournalChunk(path);
+        });
+        return;
+    }
+
+    syncing_ = false;
+    journal_reader_.reset();
+    std::swap(pending_, live_);
+    server_.GetLogger().Log(
+        LogType::INFO,
+        std::format("Replica {} synced up to journal record {}", name_,
+                    sync_seq_));
+    StartWrite();
+}
+
+// Snapshot written after HELLO holds records that are also held back in
+// live_, replica gets an older one after reconnecting
+std::string ReplicaConnection::ReadSnapshot(const std::string& snapshot_path,
+                                            const std::string& journal_path) {
+    MappedSnapshot snapshot(snapshot_path);
+    const SnapshotHeader& header = snapshot.GetView().header;
+    if (header.journal_seq > sync_seq_) {
+        throw std::runtime_error(
+            std::format("Snapshot at journal record {} is newer than record {}",
+                        header.journal_seq, sync_seq_));
+    }
+    journal_reader_ = std::make_unique<JournalReader>(journal_path);
+    journal_reader_->Seek(header.journal_seq, header.journal_offset);
+    next_sync_seq_ = header.journal_seq + 1;
+
+    std::string payload;
+    EncodeSnapshot(snapshot.GetView(), payload);
+    std::string message;
+    AppendReplicationMessage(ReplicationMessageType::SNAPSHOT, payload,
+                             message);
+    return message;
+}
+
+std::string ReplicaConnection::ReadJournalChunk(
+    const std::string& journal_path) {
+    if (!journal_reader_) {
+        journal_reader_ = std::make_unique<JournalReader>(journal_path);
+    }
+
+    std::string messages;
+    JournalRecord record;
+    std::string frame;
+    while (next_sync_seq_ <= sync_seq_ &&
+           messages.size() < ReplicationServer::sync_chunk_size) {
+        if (!journal_reader_->Next(record)) {
+            throw std::runtime_error(std::format(
+                "Journal ends before record {}", next_sync_seq_));
+        }
+        if (record.seq < next_sync_seq_) {
+            continue;
+        }
+        if (record.seq != next_sync_seq_) {
+            throw std::runtime_error(std::format(
+                "Journal has no record {}", next_sync_seq_));
+        }
+        frame.clear();
+        EncodeJournalRecord(record, frame);
+        AppendReplicationMessage(ReplicationMessageType::RECORD, frame,
+                                 messages);
+        ++next_sync_seq_;
+    }
+
+    return messages;
+}
+
+void ReplicaConnection::Send(ReplicationMessageType type,
+                             std::string_view payload) {
+    AppendReplicationMessage(type, payload, pending_);
+    StartWrite();
+}
+
+void ReplicaConnection::StartWrite() {
+    if (!writing_.empty() || pending_.empty() || closed_) {
+        return;
+    }
+    std::swap(pending_, writing_);
+    Write();
+}
+
+void ReplicaConnection::Write() {
+    boost::asio::async_write(
+        socket_, boost::asio::buffer(writing_),
+        boost::bind(&ReplicaConnection::HandleWrite, shared_from_this(),
+                    boost::asio::placeholders::error));
+}
+
+void ReplicaConnection::HandleWrite(const boost::system::error_code& error) {
+    if (error || closed_) {
+        Close();
+        return;
+    }
+    writing_.clear();
+    if (is_writing_sync_) {
+        is_writing_sync_ = false;
+        ContinueSync();
+        return;
+    }
+    StartWrite();
+}
+
+ReplicationServer::ReplicationServer(boost::asio::io_service& io_service,
+                                     int port)
+    : io_service_(io_service),
+      acceptor_(io_service, tcp::endpoint(tcp::v4(), port)),
+      lag_report_timer_(io_service),
+      logger_(std::cout) {
+    logger_.Log(LogType::INFO,
+                std::format("Accepting replicas on port {}", port));
+    StartAccept();
+    ScheduleLagReport();
+}
+
+ReplicationServer::~ReplicationServer() {
+    GetSerializer().SetJournalListener(nullptr);
+}
+
+void ReplicationServer::OnRecordAppended(const JournalRecord&,
+                                         std::string_view frame) {
+    // Connection may remove itself from list while sending
+    for (auto it = connections_.begin(); it != connections_.end();) {
+        auto connection = *it++;
+        connection->SendRecord(frame);
+    }
+}
+
+void ReplicationServer::RemoveConnection(const ReplicaConnection* connection) {
+    connections_.remove_if(
+        [connection](const std::shared_ptr<ReplicaConnection>& other) {
+            return other.get() == connection;
+        });
+}
+
+Logger& ReplicationServer::GetLogger() { return logger_; }
+
+boost::asio::thread_pool& ReplicationServer::GetSyncPool() {
+    return sync_pool_;
+}
+
+void ReplicationServer::StartAccept() {
+    auto connection = std::make_shared<ReplicaConnection>(io_service_, *this);
+    acceptor_.async_accept(
+        connection->GetSocket(),
+        boost::bind(&ReplicationServer::HandleAccept, this, connection,
+                    boost::asio::placeholders::error));
+}
+
+void ReplicationServer::HandleAccept(
+    std::shared_ptr<ReplicaConnection> connection,
+    const boost::system::error_code& error) {
+    if (error) {
+        return;
+    }
+    boost::system::error_code option_error;
+    connection->GetSocket().set_option(tcp::no_delay(true), option_error);
+    connections_.push_back(connection);
+    connection->Start();
+    StartAccept();
+}
+
+void ReplicationServer::ScheduleLagReport() {
+    lag_report_timer_.expires_after(lag_report_interval);
+    lag_report_timer_.async_wait(
+        boost::bind(&ReplicationServer::HandleLagReport, this,
+                    boost::asio::placeholders::error));
+}
+
+void ReplicationServer::HandleLagReport(
+    const boost::system::error_code& error) {
+    if (error) {
+        return;
+    }
+    uint64_t last_seq = GetSerializer().GetLastSeq();
+    for (const auto& connection : connections_) {
+        uint64_t acked_seq = std::min(connection->GetAckedSeq(), last_seq);
+        logger_.Log(LogType::INFO,
+                    std::format("Replica {} lag: {} records, {} bytes queued",
+                                connection->GetName(), last_seq - acked_seq,
+                                connection->GetBacklog()));
+    }
+    ScheduleLagReport();
+}
+
+ReplicationClient::ReplicationClient(boost::asio::io_service& io_service,
+                                     const std::string& host, int port)
+    : socket_(io_service),
+      resolver_(io_service),
+      reconnect_timer_(io_service),
+      host_(host),
+      port_(port),
+      logger_(std::cout) {
+    Connect();
+}
+
+void ReplicationClient::Stop() {
+    stopped_ = true;
+    boost::system::error_code error;
+    socket_.close(error);
+    reconnect_timer_.cancel();
+    logger_.Log(LogType::INFO, "Replication stopped");
+}
+
+void ReplicationClient::Connect() {
+    boost::system::error_code error;
+    auto endpoints = resolver_.resolve(host_, std::to_string(port_), error);
+    if (error) {
+        HandleConnect(error);
+        return;
+    }
+    boost::asio::async_connect(
+        socket_, endpoints,
+        [this](const boost::system::error_code& error, const tcp::endpoint&) {
+            HandleConnect(error);
+        });
+}
+
+void ReplicationClient::HandleConnect(const boost::system::error_code& error) {
+    if (stopped_) {
+        return;
+    }
+    if (error) {
+        Disconnect();
+        return;
+    }
+
+    boost::system::error_code option_error;
+    socket_.set_option(tcp::no_delay(true), option_error);
+    connected_ = true;
+    acked_seq_ = GetSerializer().GetLastSeq();
+    logger_.Log(LogType::INFO,
+                std::format("Connected to primary {}:{} at journal record {}",
+                            host_, port_, acked_seq_));
+
+    writing_ = true;
+    output_.clear();
+    AppendReplicationMessage(ReplicationMessageType::HELLO,
+                             MakeSeqPayload(acked_seq_), output_);
+    boost::asio::async_write(
+        socket_, boost::asio::buffer(output_),
+        boost::bind(&ReplicationClient::HandleWrite, this,
+                    boost::asio::placeholders::error));
+    StartRead();
+}
+
+void ReplicationClient::StartRead() {
+    socket_.async_read_some(
+        boost::asio::buffer(data_, max_length),
+        boost::bind(&ReplicationClient::HandleRead, this,
+                    boost::asio::placeholders::error,
+                    boost::asio::placeholders::bytes_transferred));
+}
+
+void ReplicationClient::HandleRead(const boost::system::error_code& error,
+                                   size_t bytes_transferred) {
+    if (stopped_) {
+        return;
+    }
+    if (error) {
+        Disconnect();
+        return;
+    }
+
+    input_.append(data_, bytes_transferred);
+    std::string_view input = input_;
+    ReplicationMessageType type;
+    std::string_view payload;
+    try {
+        while (size_t consumed =
+                   DecodeReplicationMessage(input, type, payload)) {
+            HandleMessage(type, payload);
+            input.remove_prefix(consumed);
+        }
+    } catch (const std::exception& replication_error) {
+        // Replica can not continue once it diverged from primary
+        logger_.Log(LogType::ERROR, replication_error.what());
+        Stop();
+        return;
+    }
+    input_.erase(0, input_.size() - input.size());
+    if (ExceedsMessageSize(input_, max_message_size)) {
+        logger_.Log(LogType::ERROR, "Invalid message from primary");
+        Disconnect();
+        return;
+    }
+
+    SendAck();
+    StartRead();
+}
+
+void ReplicationClient::HandleMessage(ReplicationMessageType type,
+                                      std::string_view payload) {
+    switch (type) {
+        case ReplicationMessageType::SNAPSHOT: {
+            // Snapshot records are used in place and must be aligned, so
+            // payload is copied out of input buffer
+            std::string snapshot(payload);
+            SnapshotView view = ParseSnapshot(snapshot);
+            GetSerializer().RestoreReplicatedSnapshot(view);
+            logger_.Log(LogType::INFO,
+                        std::format("Received snapshot at journal record {}",
+                                    view.header.journal_seq));
+            break;
+        }
+        case ReplicationMessageType::RECORD: {
+            JournalRecord record;
+            if (DecodeJournalRecord(payload, record) != payload.size()) {
+                throw std::runtime_error("Corrupted record from primary");
+            }
+            GetSerializer().ApplyReplicatedRecord(record);
+            break;
+        }
+        default:
+            throw std::runtime_error("Unexpected message from primary");
+    }
+}
+
+void ReplicationClient::SendAck() {
+    uint64_t last_seq = GetSerializer().GetLastSeq();
+    if (writing_ || last_seq == acked_seq_) {
+        return;
+    }
+    acked_seq_ = last_seq;
+    writing_ = true;
+    output_.clear();
+    AppendReplicationMessage(ReplicationMessageType::ACK,
+                             MakeSeqPayload(acked_seq_), output_);
+    boost::asio::async_write(
+        socket_, boost::asio::buffer(output_),
+        boost::bind(&ReplicationClient::HandleWrite, this,
+                    boost::asio::placeholders::error));
+}
+
+void ReplicationClient::HandleWrite(const boost::system::error_code& error) {
+    writing_ = false;
+    if (stopped_ || error) {
+        return;
+    }
+    SendAck();
+}
+
+void ReplicationClient::Disconnect() {
+    if (connected_) {
+        logger_.Log(LogType::WARNING, "Lost connection to primary");
+        connected_ = false;
+    }
+    boost::system::error_code error;
+    socket_.close(error);
+    input_.clear();
+    reconnect_timer_.expires_after(reconnect_delay);
+    reconnect_timer_.async_wait(
+        boost::bind(&ReplicationClient::HandleReconnect, this,
+                    boost::asio::placeholders::error));
+}
+
+void ReplicationClient::HandleReconnect(
+    const boost::system::error_code& error) {
+    if (!error && !stopped_) {
+        Connect();
+    }
+}
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "journal.h"
+#include "logger.h"
+
+// Primary ships its command journal to hot standby replicas over TCP.
+//
+// Every message is uint8 type, uint64 payload size and payload
+// (little-endian):
+//   replica -> primary: HELLO with sequence number of the last record
+//                       replica has, then ACK with the last applied record
+//   primary -> replica: SNAPSHOT of market if replica is empty, otherwise
+//                       RECORDs from journal that replica misses, then every
+//                       new RECORD as it is appended to journal
+//
+// Shipping is asynchronous: matching only copies record to buffer of each
+// replica. Replica that falls more than max_replica_backlog bytes behind is
+// disconnected, it catches up from journal after reconnecting. Snapshot is
+// read from disk and missed records are read from journal in background, in
+// chunks that are read only once previous one is sent. Records appended
+// meanwhile are held back and count towards backlog.
+
+enum class ReplicationMessageType : uint8_t {
+    HELLO = 1,
+    ACK = 2,
+    SNAPSHOT = 3,
+    RECORD = 4,
+};
+
+void AppendReplicationMessage(ReplicationMessageType type,
+                              std::string_view payload, std::string& buffer);
+
+// Decodes message from beginning of data. Returns number of consumed bytes or
+// 0 if data holds incomplete message.
+size_t DecodeReplicationMessage(std::string_view data,
+                                ReplicationMessageType& type,
+                                std::string_view& payload);
+
+class ReplicationServer;
+
+// Connection of primary with one replica
+class ReplicaConnection
+    : public std::enable_shared_from_this<ReplicaConnection> {
+   public:
+    ReplicaConnection(boost::asio::io_service& io_service,
+                      ReplicationServer& server);
+
+    void Start();
+
+    void SendRecord(std::string_view frame);
+
+    void Close();
+
+    boost::asio::ip::tcp::socket& GetSocket();
+
+    const std::string& GetName() const;
+
+    uint64_t GetAckedSeq() const;
+
+    size_t GetBacklog() const;
+
+   private:
+    void StartRead();
+
+    void HandleRead(const boost::system::error_code& error,
+                    size_t bytes_transferred);
+
+    void HandleHello(uint64_t seq);
+
+    // Runs task in background and sends messages it returns
+    void StartSyncTask(std::function<std::string()> task);
+
+    void HandleSyncTask(std::string messages, const std::string& error);
+
+    // Starts next chunk of catch-up or, once replica has every record up to
+    // sync_seq_, starts sending records held back meanwhile
+    void ContinueSync();
+
+    // Runs in background. Returns message with snapshot from disk and
+    // positions journal reader after it.
+    std::string ReadSnapshot(const std::string& snapshot_path,
+                             const std::string& journal_path);
+
+    // Runs in background. Returns messages with next chunk of journal
+    // records up to sync_seq_, throws if journal misses some of them.
+    std::string ReadJournalChunk(const std::string& journal_path);
+
+    void Send(ReplicationMessageType type, std::string_view payload);
+
+    void StartWrite();
+
+    void Write();
+
+    void HandleWrite(const boost::system::error_code& error);
+
+   private:
+    boost::asio::ip::tcp::socket socket_;
+    ReplicationServer& server_;
+    std::string name_;
+    bool subscribed_ = false;
+    bool closed_ = false;
+    uint64_t acked_seq_ = 0;
+    std::string input_;
+    // Messages are queued to pending_ while writing_ is being sent
+    std::string pending_;
+    std::string writing_;
+    enum { max_length = 4096 };
+    char data_[max_length];
+
+    // Sync of replica with journal up to sync_seq_, the last record at the
+    // moment of HELLO. Records after it are held in live_ meanwhile.
+    bool syncing_ = false;
+    bool is_writing_sync_ = false;
+    uint64_t sync_seq_ = 0;
+    std::string live_;
+    // Used only by sync task, which runs one at a time
+    std::unique_ptr<JournalReader> journal_reader_;
+    uint64_t next_sync_seq_ = 0;
+};
+
+class ReplicationServer final : public JournalListener {
+   public:
+    static constexpr size_t max_replica_backlog = 64 << 20;
+    static constexpr size_t sync_chunk_size = 1 << 20;
+    static constexpr std::chrono::seconds lag_report_interval{5};
+
+    ReplicationServer(boost::asio::io_service& io_service, int port);
+
+    ~ReplicationServer();
+
+    void OnRecordAppended(const JournalRecord& record,
+                          std::string_view frame) override;
+
+    void RemoveConnection(const ReplicaConnection* connection);
+
+    Logger& GetLogger();
+
+    // Thread encoding snapshots and reading journal for replicas
+    boost::asio::thread_pool& GetSyncPool();
+
+   private:
+    void StartAccept();
+
+    void HandleAccept(std::shared_ptr<ReplicaConnection> connection,
+                      const boost::system::error_code& error);
+
+    // Logs how far behind each replica is
+    void ScheduleLagReport();
+
+    void HandleLagReport(const boost::system::error_code& error);
+
+   private:
+    boost::asio::io_service& io_service_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    boost::asio::steady_timer lag_report_timer_;
+    std::list<std::shared_ptr<ReplicaConnection>> connections_;
+    Logger logger_;
+    // Joined first on destruction, so that sync tasks do not outlive
+    // io_service_ they post to
+    boost::asio::thread_pool sync_pool_{1};
+};
+
+// Replica side: applies records received from primary to local market and
+// journal, reconnects when connection is lost
+class ReplicationClient {
+   public:
+    static constexpr std::chrono::seconds reconnect_delay{1};
+
+    ReplicationClient(boost::asio::io_service& io_service,
+                      const std::string& host, int port);
+
+    // Disconnects from primary for good, e.g. when replica is promoted
+    void Stop();
+
+   private:
+    void Connect();
+
+    void HandleConnect(const boost::system::error_code& error);
+
+    void StartRead();
+
+    void HandleRead(const boost::system::error_code& error,
+                    size_t bytes_transferred);
+
+    void HandleMessage(ReplicationMessageType type, std::string_view payload);
+
+    void SendAck();
+
+    void HandleWrite(const boost::system::error_code& error);
+
+    void Disconnect();
+
+    void HandleReconnect(const boost::system::error_code& error);
+
+   private:
+    boost::asio::ip::tcp::socket socket_;
+    boost::asio::ip::tcp::resolver resolver_;
+    boost::asio::steady_timer reconnect_timer_;
+    std::string host_;
+    int port_;
+    bool connected_ = false;
+    bool stopped_ = false;
+    bool writing_ = false;
+    uint64_t acked_seq_ = 0;
+    std::string input_;
+    std::string output_;
+    Logger logger_;
+    enum { max_length = 1 << 16 };
+    char data_[max_length];
+};
@@ -0,0 +1,421 @@
+#include "request.h"
+
+#include <array>
+#include <charconv>
+#include <utility>
+
+#include "common.h"
+
+using nlohmann::json;
+
+const std::string& GetRequestKindName(RequestKind kind) {
+    static const std::array<std::string,
+                            static_cast<size_t>(RequestKind::COUNT)>
+        names = {requests::REGISTRATION, requests::LOGIN,
+                 requests::BALANCE,      requests::ACTIVE_OFFERS,
+                 requests::CLOSED_DEALS, requests::POST_OFFER,
+                 requests::QUOTES,       requests::CANCEL,
+                 requests::METRICS,      requests::PROTOCOL,
+                 "Unknown"};
+    return names[static_cast<size_t>(kind)];
+}
+
+static constexpr size_t type_table_size = 32;
+
+// Current request types differ in first letter and length, so the tag is
+// unique for each of them and lookup takes a single comparison of strings.
+// Collisions of future types are resolved by probing next slots.
+static size_t GetTypeTag(std::string_view request_type) {
+    return (static_cast<uint8_t>(request_type[0]) * 7 + request_type.size()) %
+           type_table_size;
+}
+
+static const std::array<RequestKind, type_table_size>& GetTypeTable() {
+    static const auto table = [] {
+        std::array<RequestKind, type_table_size> table;
+        table.fill(RequestKind::UNKNOWN);
+        for (size_t kind = 0; kind < static_cast<size_t>(RequestKind::UNKNOWN);
+             ++kind) {
+            size_t slot =
+                GetTypeTag(GetRequestKindName(static_cast<RequestKind>(kind)));
+            while (table[slot] != RequestKind::UNKNOWN) {
+                slot = (slot + 1) % type_table_size;
+            }
+            table[slot] = static_cast<RequestKind>(kind);
+        }
+        return table;
+    }();
+    return table;
+}
+
+RequestKind GetRequestKind(std::string_view request_type) {
+    if (request_type.empty()) {
+        return RequestKind::UNKNOWN;
+    }
+    const auto& table = GetTypeTable();
+    for (size_t slot = GetTypeTag(request_type);
+         table[slot] != RequestKind::UNKNOWN;
+         slot = (slot + 1) % type_table_size) {
+        if (GetRequestKindName(table[slot]) == request_type) {
+            return table[slot];
+        }
+    }
+
+    return RequestKind::UNKNOWN;
+}
+
+bool IsUserRequest(RequestKind kind) {
+    switch (kind) {
+        case RequestKind::BALANCE:
+        case RequestKind::ACTIVE_OFFERS:
+        case RequestKind::CLOSED_DEALS:
+        case RequestKind::POST_OFFER:
+        case RequestKind::CANCEL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+const std::string& GetRequestErrorText(RequestError error) {
+    static const std::array<std::string, 5> texts = {
+        "", "ERROR: Malformed request", "ERROR: Unknown request type",
+        "ERROR: Invalid field", "ERROR: Not authenticated"};
+    return texts[static_cast<size_t>(error)];
+}
+
+RequestError ValidateRequest(const Request& request) {
+    if (request.kind == RequestKind::POST_OFFER &&
+        (request.price <= 0 || request.amount == 0)) {
+        return RequestError::INVALID_FIELD;
+    }
+    return RequestError::NONE;
+}
+
+// Readers of fields return false and leave value untouched if field is
+// missing, of other type or out of range of value
+static bool ReadField(const json& message, const std::string& key,
+                      std::string& value) {
+    auto field = message.find(key);
+    if (field == message.end() || !field->is_string()) {
+        return false;
+    }
+    value = field->get_ref<const std::string&>();
+    return true;
+}
+
+template <typename T>
+static bool ReadField(const json& message, const std::string& key, T& value) {
+    auto field = message.find(key);
+    if (field == message.end()) {
+        return false;
+    }
+    if (field->is_number_unsigned()) {
+        auto number = field->get<uint64_t>();
+        if (!std::in_range<T>(number)) {
+            return false;
+        }
+        value = static_cast<T>(number);
+        return true;
+    }
+    if (field->is_number_integer()) {
+        auto number = field->get<int64_t>();
+        if (!std::in_range<T>(number)) {
+            return false;
+        }
+        value = static_cast<T>(number);
+        return true;
+    }
+    return false;
+}
+
+RequestError ParseRequest(const json& message, Request& request) {
+    if (!message.is_object()) {
+        return RequestError::MALFORMED;
+    }
+    std::string type;
+    if (!ReadField(message, json_field::TYPE, type)) {
+        return RequestError::INVALID_FIELD;
+    }
+    Request parsed;
+    parsed.kind = GetRequestKind(type);
+    bool is_valid = true;
+    switch (parsed.kind) {
+        case RequestKind::REGISTRATION:
+        case RequestKind::LOGIN:
+            is_valid =
+                ReadField(message, json_field::USERNAME, parsed.username) &&
+                ReadField(message, json_field::PW_HASH, parsed.pw_hash) &&
+                (!message.contains(json_field::COMPRESSION) ||
+                 ReadField(message, json_field::COMPRESSION,
+                           parsed.compression));
+            break;
+        case RequestKind::POST_OFFER: {
+            std::string offer_side;
+            is_valid =
+                ReadField(message, json_field::OFFER_SIDE, offer_side) &&
+                (offer_side == json_field::BUY ||
+                 offer_side == json_field::SELL) &&
+                ReadField(message, json_field::PRICE, parsed.price) &&
+                ReadField(message, json_field::AMOUNT, parsed.amount);
+            parsed.offer_type = offer_side == json_field::BUY
+                                    ? OfferType::BUY
+                                    : OfferType::SELL;
+            break;
+        }
+        case RequestKind::CANCEL:
+            is_valid =
+                ReadField(message, json_field::OFFER_ID, parsed.offer_id);
+            break;
+        case RequestKind::PROTOCOL:
+            is_valid =
+                ReadField(message, json_field::PROTOCOL, parsed.protocol);
+            break;
+        case RequestKind::UNKNOWN:
+            return RequestError::UNKNOWN_TYPE;
+        default:
+            break;
+    }
+    if (!is_valid) {
+        return RequestError::INVALID_FIELD;
+    }
+    // Server ignores user named by client, so invalid one is ignored too
+    if (IsUserRequest(parsed.kind)) {
+        ReadField(message, json_field::USER_ID, parsed.user_id);
+    }
+
+    RequestError error = ValidateRequest(parsed);
+    if (error == RequestError::NONE) {
+        request = std::move(parsed);
+    }
+    return error;
+}
+
+RequestError ParseJsonRequest(std::string_view message, Request& request) {
+    if (ParseHotRequest(message, request)) {
+        return RequestError::NONE;
+    }
+    json document = json::parse(message, nullptr, false);
+    if (document.is_discarded()) {
+        return RequestError::MALFORMED;
+    }
+    return ParseRequest(document, request);
+}
+
+json RequestToJson(const Request& request) {
+    json message;
+    message[json_field::TYPE] = GetRequestKindName(request.kind);
+    switch (request.kind) {
+        case RequestKind::REGISTRATION:
+        case RequestKind::LOGIN:
+            message[json_field::USERNAME] = request.username;
+            message[json_field::PW_HASH] = request.pw_hash;
+            if (!request.compression.empty()) {
+                message[json_field::COMPRESSION] = request.compression;
+            }
+            break;
+        case RequestKind::POST_OFFER:
+            message[json_field::OFFER_SIDE] =
+                request.offer_type == OfferType::BUY ? json_field::BUY
+                                                     : json_field::SELL;
+            message[json_field::PRICE] = request.price;
+            message[json_field::AMOUNT] = request.amount;
+            break;
+        case RequestKind::CANCEL:
+            message[json_field::OFFER_ID] = request.offer_id;
+            break;
+        case RequestKind::PROTOCOL:
+            message[json_field::PROTOCOL] = request.protocol;
+            break;
+        default:
+            break;
+    }
+    if (IsUserRequest(request.kind)) {
+        message[json_field::USER_ID] = request.user_id;
+    }
+
+    return message;
+}
+
+namespace {
+
+// Reads flat json object of strings and integers
+class FlatJsonScanner {
+   public:
+    explicit FlatJsonScanner(std::string_view text) : text_(text) {}
+
+    bool Consume(char expected) {
+        SkipSpace();
+        if (position_ == text_.size() || text_[position_] != expected) {
+            return false;
+        }
+        ++position_;
+        return true;
+    }
+
+    // Only strings of printable ASCII without escapes are accepted
+    bool ReadString(std::string_view& value) {
+        if (!Consume('"')) {
+            return false;
+        }
+        size_t start = position_;
+        for (; position_ < text_.size(); ++position_) {
+            char symbol = text_[position_];
+            if (symbol == '"') {
+                value = text_.substr(start, position_++ - start);
+                return true;
+            }
+            if (symbol == '\\' || symbol < ' ' || symbol > '~') {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    // Fails on values out of range of T, leading zeros, fractions and
+    // exponents
+    template <typename T>
+    bool ReadInteger(T& value) {
+        SkipSpace();
+        const char* first = text_.data() + position_;
+        const char* last = text_.data() + text_.size();
+        const char* digits =
+            first != last && *first == '-' ? first + 1 : first;
+        if (digits + 1 < last && *digits == '0' && IsDigit(digits[1])) {
+            return false;
+        }
+        auto [end, error] = std::from_chars(first, last, value);
+        if (error != std::errc() ||
+            (end != last && (*end == '.' || *end == 'e' || *end == 'E'))) {
+            return false;
+        }
+        position_ = end - text_.data();
+        return true;
+    }
+
+    bool AtEnd() {
+        SkipSpace();
+        return position_ == text_.size();
+    }
+
+   private:
+    static bool IsDigit(char symbol) { return symbol >= '0' && symbol <= '9'; }
+
+    void SkipSpace() {
+        while (position_ < text_.size() &&
+               (text_[position_] == ' ' || text_[position_] == '\t' ||
+                text_[position_] == '\n' || text_[position_] == '\r')) {
+            ++position_;
+        }
+    }
+
+   private:
+    std::string_view text_;
+    size_t position_ = 0;
+};
+
+enum HotField : uint8_t {
+    TYPE_FIELD = 1 << 0,
+    USER_ID_FIELD = 1 << 1,
+    OFFER_ID_FIELD = 1 << 2,
+    OFFER_SIDE_FIELD = 1 << 3,
+    PRICE_FIELD = 1 << 4,
+    AMOUNT_FIELD = 1 << 5,
+};
+
+}  // namespace
+
+bool ParseHotRequest(std::string_view message, Request& request) {
+    FlatJsonScanner scanner(message);
+    std::string_view type;
+    std::string_view offer_side;
+    uint64_t user_id = 0;
+    uint64_t offer_id = 0;
+    int price = 0;
+    uint64_t amount = 0;
+    uint8_t fields = 0;
+    if (!scanner.Consume('{')) {
+        return false;
+    }
+    if (!scanner.Consume('}')) {
+        do {
+            std::string_view key;
+            if (!scanner.ReadString(key) || !scanner.Consume(':')) {
+                return false;
+            }
+            uint8_t field = 0;
+            bool is_read = false;
+            if (key == json_field::TYPE) {
+                field = TYPE_FIELD;
+                is_read = scanner.ReadString(type);
+            } else if (key == json_field::USER_ID) {
+                field = USER_ID_FIELD;
+                is_read = scanner.ReadInteger(user_id);
+            } else if (key == json_field::OFFER_ID) {
+                field = OFFER_ID_FIELD;
+                is_read = scanner.ReadInteger(offer_id);
+            } else if (key == json_field::OFFER_SIDE) {
+                field = OFFER_SIDE_FIELD;
+                is_read = scanner.ReadString(offer_side);
+            } else if (key == json_field::PRICE) {
+                field = PRICE_FIELD;
+                is_read = scanner.ReadInteger(price);
+            } else if (key == json_field::AMOUNT) {
+                field = AMOUNT_FIELD;
+                is_read = scanner.ReadInteger(amount);
+            }
+            if (!is_read || (fields & field) != 0) {
+                return false;
+            }
+            fields |= field;
+        } while (scanner.Consume(','));
+        if (!scanner.Consume('}')) {
+            return false;
+        }
+    }
+    if (!scanner.AtEnd()) {
+        return false;
+    }
+
+    RequestKind kind = GetRequestKind(type);
+    uint8_t required_fields = TYPE_FIELD;
+    switch (kind) {
+        case RequestKind::POST_OFFER:
+            required_fields |= OFFER_SIDE_FIELD | PRICE_FIELD | AMOUNT_FIELD;
+            break;
+        case RequestKind::CANCEL:
+            required_fields |= OFFER_ID_FIELD;
+            break;
+        case RequestKind::QUOTES:
+            break;
+        default:
+            return false;
+    }
+    if ((fields & required_fields) != required_fields) {
+        return false;
+    }
+
+    if (kind == RequestKind::POST_OFFER && offer_side != json_field::BUY &&
+        offer_side != json_field::SELL) {
+        return false;
+    }
+
+    // Same fields are set as by ParseRequest
+    Request parsed{.kind = kind};
+    if (kind == RequestKind::POST_OFFER) {
+        parsed.user_id = user_id;
+        parsed.offer_type =
+            offer_side == json_field::BUY ? OfferType::BUY : OfferType::SELL;
+        parsed.price = price;
+        parsed.amount = amount;
+    } else if (kind == RequestKind::CANCEL) {
+        parsed.user_id = user_id;
+        parsed.offer_id = offer_id;
+    }
+    if (ValidateRequest(parsed) != RequestError::NONE) {
+        return false;
+    }
+    request = parsed;
+
+    return true;
+}
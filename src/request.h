@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "json.h"
+#include "offer.h"
+
+// Values are also message codes of binary protocol, so existing kinds keep
+// their values
+enum class RequestKind : uint8_t {
+    REGISTRATION = 0,
+    LOGIN = 1,
+    BALANCE = 2,
+    ACTIVE_OFFERS = 3,
+    CLOSED_DEALS = 4,
+    POST_OFFER = 5,
+    QUOTES = 6,
+    CANCEL = 7,
+    METRICS = 8,
+    PROTOCOL = 9,
+    UNKNOWN = 10,
+    COUNT,
+};
+
+RequestKind GetRequestKind(std::string_view request_type);
+
+const std::string& GetRequestKindName(RequestKind kind);
+
+// Requests on behalf of user, accepted only after registration or login on
+// the same connection
+bool IsUserRequest(RequestKind kind);
+
+// Request in the form it is handled by server, whichever protocol it came
+// in. Only fields used by its kind are set.
+struct Request {
+    RequestKind kind = RequestKind::UNKNOWN;
+    // User authenticated on connection. Clients do not send it, it is kept
+    // in captured requests.
+    uint64_t user_id = 0;
+    uint64_t offer_id = 0;
+    OfferType offer_type = OfferType::BUY;
+    int price = 0;
+    size_t amount = 0;
+    size_t pw_hash = 0;
+    std::string username;
+    // Name of protocol requested for connection
+    std::string protocol;
+    // Compression of replies requested at login, empty if none
+    std::string compression;
+
+    bool operator==(const Request&) const = default;
+};
+
+// Reasons to reject request before it reaches market. Values are codes of
+// error replies, each answered with its own fixed text.
+enum class RequestError : uint8_t {
+    NONE = 0,
+    // Not json object or binary message of wrong layout
+    MALFORMED = 1,
+    UNKNOWN_TYPE = 2,
+    // Field is missing, of wrong type or out of range
+    INVALID_FIELD = 3,
+    NOT_AUTHENTICATED = 4,
+};
+
+const std::string& GetRequestErrorText(RequestError error);
+
+// Checks values of fields, whichever protocol request came in. Offers must
+// have positive price and amount.
+RequestError ValidateRequest(const Request& request);
+
+// Never throws. Request is set only if message is valid. USER_ID is optional.
+RequestError ParseRequest(const nlohmann::json& message, Request& request);
+
+// Parses text of json request, hot requests skip building of json document
+RequestError ParseJsonRequest(std::string_view message, Request& request);
+
+nlohmann::json RequestToJson(const Request& request);
+
+// Parses PostOffer, Cancel and Quotes requests straight from text without
+// building json document or allocating. Returns false for other types and for
+// anything unusual (escapes, floats, nested values, duplicate, out of range or
+// invalid fields), such messages go through ParseRequest.
+bool ParseHotRequest(std::string_view message, Request& request);
@@ -0,0 +1,161 @@
+#include "request_dispatch.h"
+
+#include <array>
+#include <optional>
+#include <utility>
+
+#include "common.h"
+#include "json_writer.h"
+#include "serializer.h"
+
+using ReplyHandler = void (*)(const Request& request,
+                              ConnectionState& connection,
+                              std::string& reply);
+
+// Compression is accepted at registration and login if it is supported,
+// nullopt if it was not requested
+static std::optional<bool> NegotiateCompression(const Request& request) {
+    if (request.compression.empty()) {
+        return std::nullopt;
+    }
+    return request.compression == compressions::LZ4;
+}
+
+// Failed attempt keeps user and compression of connection
+static void Authenticate(const std::optional<uint64_t>& user_id,
+                         const std::optional<bool>& compression,
+                         ConnectionState& connection) {
+    if (user_id.has_value()) {
+        connection.user_id = user_id;
+        connection.compression = compression.value_or(connection.compression);
+    }
+}
+
+static void HandleRegistration(const Request& request,
+                               ConnectionState& connection,
+                               std::string& reply) {
+    std::optional<bool> compression = NegotiateCompression(request);
+    std::optional<uint64_t> user_id = GetSerializer().RegisterUser(
+        request.username, request.pw_hash, connection.protocol, compression,
+        reply);
+    Authenticate(user_id, compression, connection);
+}
+
+static void HandleLogin(const Request& request, ConnectionState& connection,
+                        std::string& reply) {
+    std::optional<bool> compression = NegotiateCompression(request);
+    std::optional<uint64_t> user_id = GetSerializer().Login(
+        request.username, request.pw_hash, connection.protocol, compression,
+        reply);
+    Authenticate(user_id, compression, connection);
+}
+
+static void HandleBalance(const Request& request, ConnectionState& connection,
+                          std::string& reply) {
+    GetSerializer().GetBalance(request.user_id, connection.protocol, reply);
+}
+
+static void HandleActiveOffers(const Request& request,
+                               ConnectionState& connection,
+                               std::string& reply) {
+    GetSerializer().GetActiveOffers(request.user_id, connection.protocol,
+                                    reply);
+}
+
+static void HandleClosedDeals(const Request& request,
+                              ConnectionState& connection,
+                              std::string& reply) {
+    GetSerializer().GetClosedDeals(request.user_id, connection.protocol,
+                                   reply);
+}
+
+static void HandlePostOffer(const Request& request,
+                            ConnectionState& connection, std::string& reply) {
+    GetSerializer().PostOffer(request.user_id, request.offer_type,
+                              request.price, request.amount);
+    if (connection.protocol == Protocol::JSON) {
+        reply += "\"Offer was posted.\"";
+    }
+}
+
+static void HandleQuotes(const Request&, ConnectionState& connection,
+                         std::string& reply) {
+    GetSerializer().GetQuotes(connection.protocol, reply);
+}
+
+static void HandleCancel(const Request& request, ConnectionState& connection,
+                         std::string& reply) {
+    GetSerializer().CancelOffer(request.user_id, request.offer_id,
+                                connection.protocol, reply);
+}
+
+static void HandleMetrics(const Request&, ConnectionState&,
+                          std::string& reply) {
+    GetSerializer().GetMetricsReport(reply);
+}
+
+static void HandleProtocol(const Request& request, ConnectionState& connection,
+                           std::string& reply) {
+    std::optional<Protocol> requested = GetProtocol(request.protocol);
+    JsonWriter writer(reply);
+    writer.BeginObject();
+    writer.Key(json_field::SUCCESS);
+    writer.Bool(requested.has_value());
+    writer.Key(json_field::TYPE);
+    writer.String(requests::PROTOCOL);
+    writer.EndObject();
+    connection.protocol = requested.value_or(connection.protocol);
+}
+
+static void WriteError(RequestError error, Protocol protocol,
+                       std::string& reply) {
+    const std::string& text = GetRequestErrorText(error);
+    if (protocol == Protocol::BINARY) {
+        reply += text;
+    } else {
+        JsonWriter(reply).String(text);
+    }
+}
+
+static void HandleUnknown(const Request&, ConnectionState& connection,
+                          std::string& reply) {
+    WriteError(RequestError::UNKNOWN_TYPE, connection.protocol, reply);
+}
+
+static constexpr std::pair<RequestKind, ReplyHandler> reply_handlers[] = {
+    {RequestKind::REGISTRATION, &HandleRegistration},
+    {RequestKind::LOGIN, &HandleLogin},
+    {RequestKind::BALANCE, &HandleBalance},
+    {RequestKind::ACTIVE_OFFERS, &HandleActiveOffers},
+    {RequestKind::CLOSED_DEALS, &HandleClosedDeals},
+    {RequestKind::POST_OFFER, &HandlePostOffer},
+    {RequestKind::QUOTES, &HandleQuotes},
+    {RequestKind::CANCEL, &HandleCancel},
+    {RequestKind::METRICS, &HandleMetrics},
+    {RequestKind::PROTOCOL, &HandleProtocol},
+};
+
+// Handlers indexed by RequestKind, kinds without handler are unknown
+static constexpr auto dispatch_table = [] {
+    std::array<ReplyHandler, static_cast<size_t>(RequestKind::COUNT)> table;
+    table.fill(&HandleUnknown);
+    for (const auto& [kind, handler] : reply_handlers) {
+        table[static_cast<size_t>(kind)] = handler;
+    }
+    return table;
+}();
+
+RequestKind DispatchRequest(const Request& request, RequestError error,
+                            ConnectionState& connection, std::string& reply) {
+    if (error == RequestError::NONE && IsUserRequest(request.kind) &&
+        !connection.user_id.has_value()) {
+        error = RequestError::NOT_AUTHENTICATED;
+    }
+    if (error != RequestError::NONE) {
+        WriteError(error, connection.protocol, reply);
+        return RequestKind::UNKNOWN;
+    }
+    dispatch_table[static_cast<size_t>(request.kind)](request, connection,
+                                                      reply);
+    return request.kind;
+}
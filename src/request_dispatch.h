@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "binary_protocol.h"
+#include "request.h"
+
+// Settings of connection that are changed by its requests
+struct ConnectionState {
+    Protocol protocol = Protocol::JSON;
+    // Replies are compressed, accepted at login
+    bool compression = false;
+    // Set by successful registration or login, requests of user act on
+    // behalf of this user
+    std::optional<uint64_t> user_id;
+};
+
+// Handles request and appends reply in protocol of connection. Reply to
+// request that changes connection is made with the old settings, then they
+// are changed. Request that failed parsing with error and requests of user
+// on connection that is not authenticated are answered with error text.
+// Returns kind of reply, which is UNKNOWN for rejected requests. New request
+// types are added as handler in table of request_dispatch.cpp.
+RequestKind DispatchRequest(const Request& request, RequestError error,
+                            ConnectionState& connection, std::string& reply);
@@ -10,31 +10,17 @@
 using namespace boost::asio;
 using nlohmann::json;
 
-RequestHandler::RequestHandler(ip::tcp::socket& socket,
-                               const std::string& request_type,
-                               uint64_t user_id)
-    : socket_(socket), request_type_(request_type), user_id_(user_id) {}
+RequestHandler::RequestHandler(ServerConnection& connection,
+                               const std::string& request_type)
+    : connection_(connection), request_type_(request_type) {}
 
 void RequestHandler::Handle() { PrintResult(SendRequest()); }
 
-nlohmann::json RequestHandler::ReadResponse() {
-    streambuf buff;
-    read_until(socket_, buff, "\0");
-    std::istream input(&buff);
-    std::string line(std::istreambuf_iterator<char>(input), {});
-    json response = json::parse(std::move(line));
-    return response;
-}
-
-json IdOnlyRequestHandler::SendRequest() {
+json TypeOnlyRequestHandler::SendRequest() {
     json request;
     request[json_field::TYPE] = request_type_;
-    request[json_field::USER_ID] = user_id_;
-
-    auto request_str = request.dump();
-    write(socket_, buffer(request_str, request_str.size()));
 
-    return ReadResponse();
+    return connection_.Send(request);
 }
 
 void GetQuotesHandler::PrintResult(const json& response) {
@@ -156,7 +142,7 @@ void PostOfferRequest::GatherPrerequisites() {
 
     std::cout << "Enter price: " << '\n';
     SafeIntInput(
-        price_, []([[maybe_unused]] int price) { return true; },
+        price_, [](int price) { return price > 0; },
         "Invalid price. Try again.");
 }
 
@@ -165,16 +151,12 @@ json PostOfferRequest::SendRequest() {
 
     json request;
     request[json_field::TYPE] = requests::POST_OFFER;
-    request[json_field::USER_ID] = user_id_;
     request[json_field::OFFER_SIDE] =
         offer_side_ == 1 ? json_field::BUY : json_field::SELL;
     request[json_field::AMOUNT] = amount_;
     request[json_field::PRICE] = price_;
 
-    auto request_str = request.dump();
-    write(socket_, buffer(request_str, request_str.size()));
-
-    return ReadResponse();
+    return connection_.Send(request);
 }
 
 void PostOfferRequest::PrintResult(const json& response) {
@@ -193,13 +175,9 @@ json CancleOfferRequest::SendRequest() {
 
     json request;
     request[json_field::TYPE] = requests::CANCEL;
-    request[json_field::USER_ID] = user_id_;
     request[json_field::OFFER_ID] = offer_id_;
 
-    auto request_str = request.dump();
-    write(socket_, buffer(request_str, request_str.size()));
-
-    return ReadResponse();
+    return connection_.Send(request);
 }
 
 void CancleOfferRequest::PrintResult(const json& response) {
@@ -212,32 +190,31 @@ void CancleOfferRequest::PrintResult(const json& response) {
 }
 
 std::unique_ptr<RequestHandler> MakeRequest(RequestType type,
-                                            ip::tcp::socket& socket,
-                                            uint64_t user_id) {
+                                            ServerConnection& connection) {
     switch (type) {
         case RequestType::POST_OFFER:
             return std::make_unique<PostOfferRequest>(
-                socket, requests::POST_OFFER, user_id);
+                connection, requests::POST_OFFER);
 
         case RequestType::CANCEL_OFFER:
             return std::make_unique<CancleOfferRequest>(
-                socket, requests::CANCEL, user_id);
+                connection, requests::CANCEL);
 
         case RequestType::GET_QUOTES:
-            return std::make_unique<GetQuotesHandler>(socket, requests::QUOTES,
-                                                      user_id);
+            return std::make_unique<GetQuotesHandler>(
+                connection, requests::QUOTES);
 
         case RequestType::GET_BALANCE:
             return std::make_unique<GetBalanceRequest>(
-                socket, requests::BALANCE, user_id);
+                connection, requests::BALANCE);
 
         case RequestType::GET_ACTIVE:
             return std::make_unique<GetActiveOffersRequest>(
-                socket, requests::ACTIVE_OFFERS, user_id);
+                connection, requests::ACTIVE_OFFERS);
 
         case RequestType::GET_CLOSED:
             return std::make_unique<GetClosedDealsRequest>(
-                socket, requests::CLOSED_DEALS, user_id);
+                connection, requests::CLOSED_DEALS);
     }
 
     return nullptr;
@@ -6,6 +6,7 @@
 #include <unordered_map>
 
 #include "json.h"
+#include "server_connection.h"
 
 enum RequestType {
     POST_OFFER = 1,
@@ -21,8 +22,8 @@ enum RequestType {
 
 class RequestHandler {
    public:
-    RequestHandler(boost::asio::ip::tcp::socket& socket,
-                   const std::string& request_type, uint64_t user_id);
+    RequestHandler(ServerConnection& connection,
+                   const std::string& request_type);
 
     void Handle();
 
@@ -33,19 +34,16 @@ class RequestHandler {
 
     virtual void PrintResult(const nlohmann::json& response) = 0;
 
-    nlohmann::json ReadResponse();
-
    protected:
-    boost::asio::ip::tcp::socket& socket_;
+    ServerConnection& connection_;
     std::string request_type_;
-    uint64_t user_id_;
 };
 
-class IdOnlyRequestHandler : public RequestHandler {
+class TypeOnlyRequestHandler : public RequestHandler {
    public:
     using RequestHandler::RequestHandler;
 
-    virtual ~IdOnlyRequestHandler() = default;
+    virtual ~TypeOnlyRequestHandler() = default;
 
    private:
     nlohmann::json SendRequest() override;
@@ -61,9 +59,9 @@ class WithPrerequisitesRequestHandler : public RequestHandler {
     virtual void GatherPrerequisites() = 0;
 };
 
-class GetQuotesHandler final : public IdOnlyRequestHandler {
+class GetQuotesHandler final : public TypeOnlyRequestHandler {
    public:
-    using IdOnlyRequestHandler::IdOnlyRequestHandler;
+    using TypeOnlyRequestHandler::TypeOnlyRequestHandler;
 
    private:
     void PrintResult(const nlohmann::json& response) override;
@@ -71,25 +69,25 @@ class GetQuotesHandler final : public IdOnlyRequestHandler {
     std::string NullableIntToString(const nlohmann::json& nullable_int);
 };
 
-class GetBalanceRequest final : public IdOnlyRequestHandler {
+class GetBalanceRequest final : public TypeOnlyRequestHandler {
    public:
-    using IdOnlyRequestHandler::IdOnlyRequestHandler;
+    using TypeOnlyRequestHandler::TypeOnlyRequestHandler;
 
    private:
     void PrintResult(const nlohmann::json& response) override;
 };
 
-class GetActiveOffersRequest final : public IdOnlyRequestHandler {
+class GetActiveOffersRequest final : public TypeOnlyRequestHandler {
    public:
-    using IdOnlyRequestHandler::IdOnlyRequestHandler;
+    using TypeOnlyRequestHandler::TypeOnlyRequestHandler;
 
    private:
     void PrintResult(const nlohmann::json& response) override;
 };
 
-class GetClosedDealsRequest final : public IdOnlyRequestHandler {
+class GetClosedDealsRequest final : public TypeOnlyRequestHandler {
    public:
-    using IdOnlyRequestHandler::IdOnlyRequestHandler;
+    using TypeOnlyRequestHandler::TypeOnlyRequestHandler;
 
    private:
     void PrintResult(const nlohmann::json& response) override;
@@ -127,5 +125,5 @@ class CancleOfferRequest final : public WithPrerequisitesRequestHandler {
     int offer_id_;
 };
 
-std::unique_ptr<RequestHandler> MakeRequest(
-    RequestType type, boost::asio::ip::tcp::socket& socket, uint64_t user_id);
+std::unique_ptr<RequestHandler> MakeRequest(RequestType type,
+                                            ServerConnection& connection);
@@ -1,134 +1,321 @@
 #include "serializer.h"
 
+#include <chrono>
 #include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <future>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
 #include <string>
 
 #include "common.h"
 #include "db_manager.h"
-#include "json.h"
+#include "journal.h"
+#include "json_writer.h"
+#include "logger.h"
+#include "metrics.h"
+#include "server_options.h"
+#include "snapshot.h"
 #include "user_data.h"
 
-using nlohmann::json;
+// Market state is rebuilt either from db or from snapshot and journal.
+// Replica starts from its own snapshot and journal if it has them, and from
+// empty market otherwise. Sinks are attached afterwards so that restored
+// state is not persisted again, except for db sink, which also persists
+// journal records that db lacks. Time spent in persistence sinks is
+// accounted separately from matching.
+Serializer::Serializer()
+    : timed_persistence_sinks_(persistence_sinks_), market_(event_sinks_) {
+    const ServerOptions& options = GetServerOptions();
+    SnapshotHeader snapshot{};
+    bool is_restored_from_db = false;
+    if (options.IsReplica()) {
+        if (std::filesystem::exists(options.snapshot_path) ||
+            std::filesystem::exists(options.journal_path)) {
+            snapshot = RestoreFromJournal();
+        }
+    } else if (options.replay_journal) {
+        snapshot = RestoreFromJournal();
+    } else {
+        RestoreFromDB();
+        is_restored_from_db = true;
+    }
+
+    persistence_sinks_.Add(db_event_sink_);
+    event_sinks_.Add(timed_persistence_sinks_);
+    if (is_restored_from_db &&
+        std::filesystem::exists(options.journal_path)) {
+        RestoreJournalTail();
+    }
+
+    journal_ = std::make_unique<Journal>(
+        options.journal_path, snapshot.journal_seq, snapshot.journal_offset);
+    if (journal_->GetLastSeq() < snapshot.journal_seq) {
+        journal_->StartAfter(snapshot.journal_seq);
+    }
+    GetMetrics().active_offers.Set(market_.GetActiveOfferCount());
+    // Journal of replica is filled with records received from primary
+    // until replica is promoted
+    if (!options.IsReplica()) {
+        persistence_sinks_.Add(*journal_);
+    }
+    event_sinks_.Add(metrics_event_sink_);
+}
+
+void Serializer::RestoreFromDB() {
+    UserData::SetNextId(GetDBManager().GetMaxId("User"));
+    Offer::SetNextId(GetDBManager().GetMaxId("Offer"));
+    Deal::SetNextId(GetDBManager().GetMaxId("Deal"));
+    GetDBManager().LoadUsers([this](const UserRecord& user) {
+        market_.RestoreUser(user.id, user.username, user.pw_hash);
+    });
+    GetDBManager().LoadDeals([this](const DealRecord& deal) {
+        market_.RestoreDeal(deal.id, deal.seller_id, deal.buyer_id, deal.price,
+                            deal.amount);
+    });
+    GetDBManager().LoadActiveOffers([this](const OfferRecord& offer) {
+        market_.RestoreOffer(offer.id, offer.owner_id, offer.type, offer.price,
+                             offer.amount);
+    });
+}
+
+// Without it journal would get new records reusing ids of ones it already
+// holds and would no longer replay. Deposits, which db does not store, are
+// restored here as well.
+void Serializer::RestoreJournalTail() {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t count =
+        ReplayJournalTail(GetServerOptions().journal_path, market_);
+    GetDBManager().Flush();
+    if (count != 0) {
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+        Logger(std::cout).Log(
+            LogType::WARNING,
+            std::format("Db was behind journal, applied {} journal records "
+                        "in {} ms",
+                        count, duration.count()));
+    }
+}
+
+SnapshotHeader Serializer::RestoreFromJournal() {
+    const ServerOptions& options = GetServerOptions();
+    Logger logger(std::cout);
+    bool has_snapshot = std::filesystem::exists(options.snapshot_path);
+    SnapshotHeader header{};
+    if (has_snapshot) {
+        auto start = std::chrono::steady_clock::now();
+        MappedSnapshot snapshot(options.snapshot_path);
+        market_.RestoreSnapshot(snapshot.GetView());
+        header = snapshot.GetView().header;
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+        logger.Log(LogType::INFO,
+                   std::format("Loaded snapshot at journal record {} in {} ms",
+                               header.journal_seq, duration.count()));
+    }
 
-std::string Serializer::RegisterUser(const std::string& username,
-                                     size_t pw_hash) {
-    json registration_confirmation;
+    // Journal may be missing only when snapshot covers everything
+    if (!has_snapshot || std::filesystem::exists(options.journal_path)) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t count = ReplayJournal(options.journal_path, market_,
+                                       header.journal_seq,
+                                       header.journal_offset);
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+        logger.Log(LogType::INFO,
+                   std::format("Replayed {} records from journal in {} ms",
+                               count, duration.count()));
+    }
+
+    return header;
+}
+
+std::optional<uint64_t> Serializer::RegisterUser(
+    const std::string& username, size_t pw_hash, Protocol protocol,
+    const std::optional<bool>& compression, std::string& reply) {
     auto user_id = market_.RegisterUser(username, pw_hash);
-    registration_confirmation[json_field::TYPE] = requests::REG_CONFIRMATION;
-    registration_confirmation[json_field::SUCCESS] = user_id.has_value();
-    if (user_id.has_value()) {
-        registration_confirmation[json_field::USER_ID] = *user_id;
+    StageTimer timer(RequestStage::SERIALIZE);
+    std::optional<bool> accepted_compression =
+        user_id.has_value() ? compression : std::nullopt;
+    if (protocol == Protocol::BINARY) {
+        EncodeAuthReply(user_id, accepted_compression, reply);
     } else {
-        registration_confirmation[json_field::USER_ID] = nullptr;
+        WriteAuthReply(requests::REG_CONFIRMATION, user_id,
+                       accepted_compression, reply);
     }
-
-    return registration_confirmation.dump();
+    return user_id;
 }
 
-std::string Serializer::Login(const std::string& username, size_t pw_hash) {
-    json response;
-    auto user_id = GetDBManager().GetUserId(username, pw_hash);
-    response[json_field::TYPE] = requests::LOGIN;
-    response[json_field::SUCCESS] = user_id.has_value();
-    if (user_id.has_value()) {
-        response[json_field::USER_ID] = *user_id;
+std::optional<uint64_t> Serializer::Login(
+    const std::string& username, size_t pw_hash, Protocol protocol,
+    const std::optional<bool>& compression, std::string& reply) {
+    auto user_id = market_.Login(username, pw_hash);
+    StageTimer timer(RequestStage::SERIALIZE);
+    std::optional<bool> accepted_compression =
+        user_id.has_value() ? compression : std::nullopt;
+    if (protocol == Protocol::BINARY) {
+        EncodeAuthReply(user_id, accepted_compression, reply);
     } else {
-        response[json_field::USER_ID] = nullptr;
+        WriteAuthReply(requests::LOGIN, user_id, accepted_compression, reply);
     }
+    return user_id;
+}
 
-    return response.dump();
+void Serializer::WriteAuthReply(const std::string& type,
+                                const std::optional<uint64_t>& user_id,
+                                const std::optional<bool>& compression,
+                                std::string& reply) {
+    JsonWriter writer(reply);
+    writer.BeginObject();
+    if (compression.has_value()) {
+        writer.Key(json_field::COMPRESSION);
+        writer.Bool(*compression);
+    }
+    writer.Key(json_field::SUCCESS);
+    writer.Bool(user_id.has_value());
+    writer.Key(json_field::TYPE);
+    writer.String(type);
+    writer.Key(json_field::USER_ID);
+    writer.Optional(user_id);
+    writer.EndObject();
 }
 
-std::string Serializer::GetActiveOffers(uint64_t user_id) const {
-    json response;
+// Json arrays are written one after another, so offers are walked once for
+// every side
+void Serializer::GetActiveOffers(uint64_t user_id, Protocol protocol,
+                                 std::string& reply) const {
     const std::set<std::shared_ptr<Offer>, std::less<>>& active_offers =
         market_.GetActiveOffers(user_id);
-    response[json_field::TYPE] = requests::ACTIVE_OFFERS;
-    response[json_field::BUY] = json::array();
-    response[json_field::SELL] = json::array();
-    for (const auto& offer : active_offers) {
-        response[OfferTypeToString(offer->GetType())].push_back(
-            json({{json_field::OFFER_ID, offer->GetId()},
-                  {json_field::PRICE, offer->GetPrice()},
-                  {json_field::AMOUNT, offer->GetAmount()}}));
+    StageTimer timer(RequestStage::SERIALIZE);
+    if (protocol == Protocol::BINARY) {
+        EncodeListSize(active_offers.size(), reply);
+        for (const auto& offer : active_offers) {
+            EncodeOfferEntry(offer->GetId(), offer->GetType(),
+                             offer->GetPrice(), offer->GetAmount(), reply);
+        }
+        return;
     }
-
-    return response.dump();
+    JsonWriter writer(reply);
+    writer.BeginObject();
+    for (OfferType type : {OfferType::BUY, OfferType::SELL}) {
+        writer.Key(OfferTypeToString(type));
+        writer.BeginArray();
+        for (const auto& offer : active_offers) {
+            if (offer->GetType() != type) {
+                continue;
+            }
+            writer.BeginObject();
+            writer.Key(json_field::AMOUNT);
+            writer.Integer(offer->GetAmount());
+            writer.Key(json_field::OFFER_ID);
+            writer.Integer(offer->GetId());
+            writer.Key(json_field::PRICE);
+            writer.Integer(offer->GetPrice());
+            writer.EndObject();
+        }
+        writer.EndArray();
+    }
+    writer.Key(json_field::TYPE);
+    writer.String(requests::ACTIVE_OFFERS);
+    writer.EndObject();
 }
 
-std::string Serializer::GetClosedDeals(uint64_t user_id) const {
-    json response;
+void Serializer::GetClosedDeals(uint64_t user_id, Protocol protocol,
+                                std::string& reply) const {
     const std::set<std::shared_ptr<Deal>, std::less<>>& closed_deals =
         market_.GetClosedDeals(user_id);
-    response[json_field::TYPE] = requests::CLOSED_DEALS;
-    response[json_field::BUY] = json::array();
-    response[json_field::SELL] = json::array();
-    response[json_field::BUY_SELL] = json::array();
-    for (const auto& deal : closed_deals) {
-        if (deal->GetBuyer() == deal->GetSeller()) {
-            response[json_field::BUY_SELL].push_back(
-                {{json_field::PRICE, deal->GetPrice()},
-                 {json_field::AMOUNT, deal->GetAmount()}});
-            continue;
+    auto get_side = [user_id](const Deal& deal) {
+        if (deal.GetBuyer() == deal.GetSeller()) {
+            return DealSide::BUY_SELL;
+        }
+        return deal.GetBuyer() == user_id ? DealSide::BUY : DealSide::SELL;
+    };
+    StageTimer timer(RequestStage::SERIALIZE);
+    if (protocol == Protocol::BINARY) {
+        EncodeListSize(closed_deals.size(), reply);
+        for (const auto& deal : closed_deals) {
+            EncodeDealEntry(get_side(*deal), deal->GetPrice(),
+                            deal->GetAmount(), reply);
         }
-        response[deal->GetBuyer() == user_id ? json_field::BUY
-                                             : json_field::SELL]
-            .push_back(json({{json_field::PRICE, deal->GetPrice()},
-                             {json_field::AMOUNT, deal->GetAmount()}}));
+        return;
     }
-
-    return response.dump();
+    JsonWriter writer(reply);
+    writer.BeginObject();
+    // Sides in order of their json keys
+    for (DealSide side :
+         {DealSide::BUY, DealSide::BUY_SELL, DealSide::SELL}) {
+        writer.Key(side == DealSide::BUY        ? json_field::BUY
+                   : side == DealSide::BUY_SELL ? json_field::BUY_SELL
+                                                : json_field::SELL);
+        writer.BeginArray();
+        for (const auto& deal : closed_deals) {
+            if (get_side(*deal) != side) {
+                continue;
+            }
+            writer.BeginObject();
+            writer.Key(json_field::AMOUNT);
+            writer.Integer(deal->GetAmount());
+            writer.Key(json_field::PRICE);
+            writer.Integer(deal->GetPrice());
+            writer.EndObject();
+        }
+        writer.EndArray();
+    }
+    writer.Key(json_field::TYPE);
+    writer.String(requests::CLOSED_DEALS);
+    writer.EndObject();
 }
 
-std::string Serializer::GetBalance(uint64_t user_id) const {
-    json response;
+void Serializer::GetBalance(uint64_t user_id, Protocol protocol,
+                            std::string& reply) const {
     Balance balance = market_.GetUserBalance(user_id);
-    response[json_field::TYPE] = requests::BALANCE;
-    response[json_field::USD] = balance.usd;
-    response[json_field::RUB] = balance.rub;
-
-    return response.dump();
+    StageTimer timer(RequestStage::SERIALIZE);
+    if (protocol == Protocol::BINARY) {
+        EncodeBalanceReply(balance.usd, balance.rub, reply);
+        return;
+    }
+    JsonWriter writer(reply);
+    writer.BeginObject();
+    writer.Key(json_field::RUB);
+    writer.Integer(balance.rub);
+    writer.Key(json_field::TYPE);
+    writer.String(requests::BALANCE);
+    writer.Key(json_field::USD);
+    writer.Integer(balance.usd);
+    writer.EndObject();
 }
 
-std::string Serializer::OfferTypeToString(OfferType offer_type) {
-    switch (offer_type) {
-        case OfferType::BUY:
-            return json_field::BUY;
-            break;
-        case OfferType::SELL:
-            return json_field::SELL;
-            break;
-    }
-    return "";
+const std::string& Serializer::OfferTypeToString(OfferType offer_type) {
+    return offer_type == OfferType::BUY ? json_field::BUY : json_field::SELL;
 }
 
-std::string Serializer::GetQuotes() {
-    json response;
+void Serializer::GetQuotes(Protocol protocol, std::string& reply) {
     std::optional<int> quote = market_.GetQuote();
     AskBidQuotesInfo ask_bid_quotes_info = market_.GetAskBidQuotes();
-    response[json_field::TYPE] = requests::QUOTES;
-    if (quote.has_value()) {
-        response[json_field::QUOTE] = *quote;
-    } else {
-        response[json_field::QUOTE] = nullptr;
-    }
-    if (ask_bid_quotes_info.ask_quote.has_value()) {
-        response[json_field::ASK_QUOTE] = *ask_bid_quotes_info.ask_quote;
-    } else {
-        response[json_field::ASK_QUOTE] = nullptr;
-    }
-    if (ask_bid_quotes_info.bid_quote.has_value()) {
-        response[json_field::BID_QUOTE] = *ask_bid_quotes_info.bid_quote;
-    } else {
-        response[json_field::BID_QUOTE] = nullptr;
+    StageTimer timer(RequestStage::SERIALIZE);
+    if (protocol == Protocol::BINARY) {
+        EncodeQuotesReply(quote, ask_bid_quotes_info.ask_quote,
+                          ask_bid_quotes_info.bid_quote,
+                          ask_bid_quotes_info.spread, reply);
+        return;
     }
-    if (ask_bid_quotes_info.spread.has_value()) {
-        response[json_field::SPREAD] = *ask_bid_quotes_info.spread;
-    } else {
-        response[json_field::SPREAD] = nullptr;
-    }
-
-    return response.dump();
+    JsonWriter writer(reply);
+    writer.BeginObject();
+    writer.Key(json_field::ASK_QUOTE);
+    writer.Optional(ask_bid_quotes_info.ask_quote);
+    writer.Key(json_field::BID_QUOTE);
+    writer.Optional(ask_bid_quotes_info.bid_quote);
+    writer.Key(json_field::QUOTE);
+    writer.Optional(quote);
+    writer.Key(json_field::SPREAD);
+    writer.Optional(ask_bid_quotes_info.spread);
+    writer.Key(json_field::TYPE);
+    writer.String(requests::QUOTES);
+    writer.EndObject();
 }
 
 void Serializer::PostOffer(uint64_t user_id, OfferType offer_type, int price,
@@ -136,15 +323,103 @@ void Serializer::PostOffer(uint64_t user_id, OfferType offer_type, int price,
     market_.PostOffer(user_id, offer_type, price, amount);
 }
 
-std::string Serializer::CancelOffer(uint64_t user_id, uint64_t offer_id) {
-    json response;
+void Serializer::CancelOffer(uint64_t user_id, uint64_t offer_id,
+                             Protocol protocol, std::string& reply) {
     bool is_deleted = market_.RemoveOffer(user_id, offer_id);
-    response[json_field::TYPE] = requests::CANCEL;
-    response[json_field::SUCCESS] = is_deleted;
+    StageTimer timer(RequestStage::SERIALIZE);
+    if (protocol == Protocol::BINARY) {
+        EncodeSuccessReply(is_deleted, reply);
+        return;
+    }
+    JsonWriter writer(reply);
+    writer.BeginObject();
+    writer.Key(json_field::SUCCESS);
+    writer.Bool(is_deleted);
+    writer.Key(json_field::TYPE);
+    writer.String(requests::CANCEL);
+    writer.EndObject();
+}
+
+void Serializer::GetMetricsReport(std::string& reply) const {
+    GetMetrics().WritePrometheus(reply);
+    reply += std::format(
+        "# HELP market_book_levels Price levels in order book, emptied "
+        "levels are counted until purged\n"
+        "# TYPE market_book_levels gauge\n"
+        "market_book_levels{{side=\"buy\"}} {}\n"
+        "market_book_levels{{side=\"sell\"}} {}\n",
+        market_.GetBookLevels(OfferType::BUY),
+        market_.GetBookLevels(OfferType::SELL));
+}
 
-    return response.dump();
+void Serializer::Flush() { journal_->Flush(); }
+
+void Serializer::FlushJournalBuffer() { journal_->FlushBuffer(); }
+
+// Journal is synced first, otherwise after crash it could end before the
+// record snapshot claims to include.
+void Serializer::SaveSnapshot() {
+    Logger logger(std::cout);
+    if (snapshot_write_.valid() &&
+        snapshot_write_.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready) {
+        logger.Log(LogType::WARNING,
+                   "Previous snapshot is still being written, skipping");
+        return;
+    }
+
+    journal_->Flush();
+    MarketSnapshot snapshot = MakeSnapshot();
+    snapshot_write_ = std::async(
+        std::launch::async,
+        [snapshot = std::move(snapshot),
+         path = GetServerOptions().snapshot_path]() {
+            Logger logger(std::cout);
+            try {
+                WriteSnapshot(snapshot.GetView(), path);
+                logger.Log(LogType::INFO,
+                           std::format("Wrote snapshot at journal record {}",
+                                       snapshot.header.journal_seq));
+            } catch (const std::exception& error) {
+                logger.Log(LogType::ERROR, error.what());
+            }
+        });
 }
 
+MarketSnapshot Serializer::MakeSnapshot() const {
+    MarketSnapshot snapshot = market_.MakeSnapshot();
+    snapshot.header.journal_seq = journal_->GetLastSeq();
+    snapshot.header.journal_offset = journal_->GetSize();
+    return snapshot;
+}
+
+uint64_t Serializer::GetLastSeq() const { return journal_->GetLastSeq(); }
+
+void Serializer::SetJournalListener(JournalListener* listener) {
+    journal_->SetListener(listener);
+}
+
+void Serializer::RestoreReplicatedSnapshot(const SnapshotView& snapshot) {
+    if (journal_->GetLastSeq() != 0) {
+        throw std::runtime_error("Snapshot is accepted only by empty replica");
+    }
+    market_.RestoreSnapshot(snapshot);
+    GetMetrics().active_offers.Set(market_.GetActiveOfferCount());
+    db_event_sink_.OnSnapshotRestored(snapshot);
+    // Offset in journal of primary means nothing for journal of replica
+    SnapshotView local_snapshot = snapshot;
+    local_snapshot.header.journal_offset = journal_->GetSize();
+    WriteSnapshot(local_snapshot, GetServerOptions().snapshot_path);
+    journal_->StartAfter(snapshot.header.journal_seq);
+}
+
+void Serializer::ApplyReplicatedRecord(const JournalRecord& record) {
+    journal_->AppendReplicated(record);
+    ApplyJournalRecord(market_, record);
+}
+
+void Serializer::Promote() { persistence_sinks_.Add(*journal_); }
+
 Serializer& GetSerializer() {
     static Serializer responder;
     return responder;
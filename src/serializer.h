@@ -1,35 +1,111 @@
 #pragma once
 
 #include <cstdint>
+#include <future>
+#include <memory>
+#include <optional>
 #include <string>
 
+#include "binary_protocol.h"
+#include "db_event_sink.h"
+#include "journal.h"
 #include "market.h"
+#include "market_events.h"
+#include "metrics_event_sink.h"
 #include "offer.h"
+#include "snapshot.h"
 
+// Replies are appended to the given buffer as json text or payload of binary
+// message, depending on protocol of connection
 class Serializer {
    public:
-    std::string RegisterUser(const std::string& username, size_t pw_hash);
+    Serializer();
 
-    std::string Login(const std::string& username, size_t pw_hash);
+    // Return id of user if authentication succeeded. Compression is written
+    // to reply if it was requested and authentication succeeded.
+    std::optional<uint64_t> RegisterUser(
+        const std::string& username, size_t pw_hash, Protocol protocol,
+        const std::optional<bool>& compression, std::string& reply);
 
-    std::string GetActiveOffers(uint64_t user_id) const;
+    std::optional<uint64_t> Login(const std::string& username, size_t pw_hash,
+                                  Protocol protocol,
+                                  const std::optional<bool>& compression,
+                                  std::string& reply);
 
-    std::string GetClosedDeals(uint64_t user_id) const;
+    void GetActiveOffers(uint64_t user_id, Protocol protocol,
+                         std::string& reply) const;
 
-    std::string GetBalance(uint64_t user_id) const;
+    void GetClosedDeals(uint64_t user_id, Protocol protocol,
+                        std::string& reply) const;
 
-    std::string GetQuotes();
+    void GetBalance(uint64_t user_id, Protocol protocol,
+                    std::string& reply) const;
+
+    void GetQuotes(Protocol protocol, std::string& reply);
 
     void PostOffer(uint64_t user_id, OfferType offer_type, int price,
                    size_t amount);
 
-    std::string CancelOffer(uint64_t user_id, uint64_t offer_id);
+    void CancelOffer(uint64_t user_id, uint64_t offer_id, Protocol protocol,
+                     std::string& reply);
+
+    // Request metrics and order book depth in Prometheus text format
+    void GetMetricsReport(std::string& reply) const;
+
+    // Syncs command journal to disk
+    void Flush();
+
+    // Writes buffered journal records to file without syncing it
+    void FlushJournalBuffer();
+
+    // Takes snapshot of market and writes it in background. Does nothing if
+    // previous snapshot is still being written.
+    void SaveSnapshot();
+
+    // Snapshot of market tagged with the last journal record
+    MarketSnapshot MakeSnapshot() const;
+
+    uint64_t GetLastSeq() const;
+
+    void SetJournalListener(JournalListener* listener);
+
+    // Replica side of replication. Snapshot is accepted only by empty
+    // replica and is stored to its db, records must follow the last applied
+    // one.
+    void RestoreReplicatedSnapshot(const SnapshotView& snapshot);
+
+    void ApplyReplicatedRecord(const JournalRecord& record);
+
+    // Replica starts journaling its own commands
+    void Promote();
 
    private:
-    static std::string OfferTypeToString(OfferType offer_type);
+    void RestoreFromDB();
+
+    // Applies journal records that db lacks and all deposits to market
+    // restored from db, writes the former to db
+    void RestoreJournalTail();
+
+    // Loads snapshot if there is one and replays journal records after it.
+    // Returns header of snapshot, zeroed if there is none.
+    SnapshotHeader RestoreFromJournal();
+
+    static void WriteAuthReply(const std::string& type,
+                               const std::optional<uint64_t>& user_id,
+                               const std::optional<bool>& compression,
+                               std::string& reply);
+
+    static const std::string& OfferTypeToString(OfferType offer_type);
 
    private:
+    DBEventSink db_event_sink_;
+    std::unique_ptr<Journal> journal_;
+    MarketEventSinkList persistence_sinks_;
+    TimedEventSink timed_persistence_sinks_;
+    MetricsEventSink metrics_event_sink_;
+    MarketEventSinkList event_sinks_;
     Market market_;
+    std::future<void> snapshot_write_;
 };
 
 Serializer& GetSerializer();
@@ -1,36 +1,227 @@
 #include "server.h"
 
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
 #include <boost/asio/placeholders.hpp>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <filesystem>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
-#include "common.h"
-#include "session.h"
+#include "capture.h"
+#include "db_manager.h"
+#include "logger.h"
+#include "serializer.h"
+#include "server_options.h"
 
 using boost::asio::ip::tcp;
+using boost::asio::local::stream_protocol;
+
+// Socket file is left by previous run if it was not stopped cleanly. It
+// is removed only if nobody accepts on it, startup fails if the path is
+// in use or is not a socket.
+static void RemoveStaleUnixSocket(const std::string& path) {
+    std::filesystem::file_status status = std::filesystem::symlink_status(path);
+    if (!std::filesystem::exists(status)) {
+        return;
+    }
+    if (!std::filesystem::is_socket(status)) {
+        throw std::runtime_error("Not a socket: " + path);
+    }
+    boost::asio::io_service io_service;
+    stream_protocol::socket socket(io_service);
+    boost::system::error_code error;
+    socket.connect(stream_protocol::endpoint(path), error);
+    if (error != boost::asio::error::connection_refused) {
+        throw std::runtime_error("Unix socket is in use: " + path);
+    }
+    std::filesystem::remove(path);
+}
+
+// Session limit is lowered to what file descriptor limit allows, so that
+// clients over it wait in listen backlog instead of failing accept. Reserve
+// covers db, journal, snapshot, replicas and sockets being accepted.
+static int GetSessionLimit(int max_sessions) {
+    static constexpr rlim_t reserved_descriptors = 64;
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 ||
+        limit.rlim_cur == RLIM_INFINITY ||
+        limit.rlim_cur >= static_cast<rlim_t>(max_sessions) +
+                              reserved_descriptors) {
+        return max_sessions;
+    }
+    int session_limit = static_cast<int>(
+        std::max<rlim_t>(limit.rlim_cur, reserved_descriptors + 1) -
+        reserved_descriptors);
+    std::cout << "Open file limit " << limit.rlim_cur
+              << " allows only " << session_limit << " of "
+              << max_sessions << " sessions" << std::endl;
+    return session_limit;
+}
 
 Server::Server(boost::asio::io_service& io_service)
     : io_service_(io_service),
-      acceptor_(io_service, tcp::endpoint(tcp::v4(), port)) {
+      flush_timer_(io_service),
+      snapshot_timer_(io_service),
+      snapshot_signals_(io_service, SIGUSR1),
+      promote_signals_(io_service) {
+    // Startup log is written before messages below
+    Logger::Flush();
     std::cout << "Server started." << '\n';
-    std::cout << "Listening port: " << port << std::endl;
-    Session* session = new Session(io_service_);
-    acceptor_.async_accept(session->GetSocket(),
-                           boost::bind(&Server::HandleAccept, this, session,
-                                       boost::asio::placeholders::error));
+    const ServerOptions& options = GetServerOptions();
+    if (options.IsReplica()) {
+        std::cout << "Replica of " << options.primary_host << ':'
+                  << options.primary_port << std::endl;
+        replication_client_ = std::make_unique<ReplicationClient>(
+            io_service_, options.primary_host, options.primary_port);
+        promote_signals_.add(SIGUSR2);
+        WaitPromoteSignal();
+    } else {
+        StartServing();
+    }
+    ScheduleFlush();
+    ScheduleSnapshot();
+    WaitSnapshotSignal();
 }
 
-Server::~Server() { std::cout << "\nServer shutdown" << std::endl; }
+void Server::StartServing() {
+    const ServerOptions& options = GetServerOptions();
+    tcp::endpoint endpoint(tcp::v4(), options.port);
+    auto session_limit = std::make_shared<SessionLimit>(
+        GetSessionLimit(options.max_sessions));
+    if (options.io_threads == 0) {
+        listeners_.push_back(std::make_unique<Listener>(
+            io_service_, io_service_, endpoint, false, session_limit));
+    } else {
+        for (int i = 0; i < options.io_threads; ++i) {
+            auto& io_service = *io_thread_services_.emplace_back(
+                std::make_unique<boost::asio::io_service>());
+            listeners_.push_back(std::make_unique<Listener>(
+                io_service, io_service_, endpoint, true, session_limit));
+        }
+    }
+    if (!options.unix_socket_path.empty()) {
+        RemoveStaleUnixSocket(options.unix_socket_path);
+        boost::asio::io_service& io_service =
+            io_thread_services_.empty() ? io_service_
+                                        : *io_thread_services_.front();
+        listeners_.push_back(std::make_unique<Listener>(
+            io_service, io_service_,
+            stream_protocol::endpoint(options.unix_socket_path), false,
+            session_limit));
+        is_unix_socket_bound_ = true;
+    }
+    for (auto& io_service : io_thread_services_) {
+        io_threads_.emplace_back([&io_service] {
+            // Keeps running while accepting is paused
+            auto work = boost::asio::make_work_guard(*io_service);
+            io_service->run();
+        });
+    }
+    std::cout << "Listening port: " << options.port << std::endl;
+    if (is_unix_socket_bound_) {
+        std::cout << "Listening Unix socket: " << options.unix_socket_path
+                  << std::endl;
+    }
+
+    if (options.replication_port != 0) {
+        replication_server_ = std::make_unique<ReplicationServer>(
+            io_service_, options.replication_port);
+        GetSerializer().SetJournalListener(replication_server_.get());
+    }
+}
 
-void Server::HandleAccept(Session* new_session,
-                          const boost::system::error_code& error) {
+Server::~Server() {
+    StopIoThreads();
+    if (is_unix_socket_bound_) {
+        std::error_code error;
+        std::filesystem::remove(GetServerOptions().unix_socket_path, error);
+    }
+    Logger::Flush();
+    std::cout << "\nServer shutdown" << std::endl;
+}
+
+void Server::StopIoThreads() {
+    if (io_threads_.empty()) {
+        return;
+    }
+    for (auto& io_service : io_thread_services_) {
+        io_service->stop();
+    }
+    for (auto& thread : io_threads_) {
+        thread.join();
+    }
+    io_service_.restart();
+    io_service_.poll();
+    // Pools are gone before io_service destroys handlers holding sessions
+    listeners_.clear();
+    io_thread_services_.clear();
+}
+
+void Server::ScheduleFlush() {
+    flush_timer_.expires_after(DBManager::max_batch_delay);
+    flush_timer_.async_wait(boost::bind(&Server::HandleFlush, this,
+                                        boost::asio::placeholders::error));
+}
+
+void Server::HandleFlush(const boost::system::error_code& error) {
     if (!error) {
-        new_session->Start();
-        new_session = new Session(io_service_);
-        acceptor_.async_accept(
-            new_session->GetSocket(),
-            boost::bind(&Server::HandleAccept, this, new_session,
-                        boost::asio::placeholders::error));
-    } else {
-        delete new_session;
+        GetDBManager().FlushExpired();
+        GetSerializer().Flush();
+        if (RequestCapture* capture = GetRequestCapture()) {
+            capture->Flush();
+        }
+        ScheduleFlush();
+    }
+}
+
+void Server::ScheduleSnapshot() {
+    int interval = GetServerOptions().snapshot_interval;
+    if (interval == 0) {
+        return;
+    }
+    snapshot_timer_.expires_after(std::chrono::seconds(interval));
+    snapshot_timer_.async_wait(boost::bind(&Server::HandleSnapshot, this,
+                                           boost::asio::placeholders::error));
+}
+
+void Server::HandleSnapshot(const boost::system::error_code& error) {
+    if (!error) {
+        GetSerializer().SaveSnapshot();
+        ScheduleSnapshot();
+    }
+}
+
+void Server::WaitSnapshotSignal() {
+    snapshot_signals_.async_wait(
+        boost::bind(&Server::HandleSnapshotSignal, this,
+                    boost::asio::placeholders::error));
+}
+
+void Server::HandleSnapshotSignal(const boost::system::error_code& error) {
+    if (!error) {
+        GetSerializer().SaveSnapshot();
+        WaitSnapshotSignal();
+    }
+}
+
+void Server::WaitPromoteSignal() {
+    promote_signals_.async_wait(
+        boost::bind(&Server::HandlePromoteSignal, this,
+                    boost::asio::placeholders::error));
+}
+
+void Server::HandlePromoteSignal(const boost::system::error_code& error) {
+    if (!error) {
+        replication_client_->Stop();
+        GetSerializer().Promote();
+        std::cout << "Replica promoted to primary" << std::endl;
+        StartServing();
     }
 }
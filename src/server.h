@@ -1,19 +1,64 @@
 #pragma once
 
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <memory>
+#include <thread>
+#include <vector>
 
-#include "session.h"
+#include "listener.h"
+#include "replication.h"
 
 class Server {
    public:
     Server(boost::asio::io_service& io_service);
 
-    void HandleAccept(Session* new_session,
-                      const boost::system::error_code& error);
-
     ~Server();
 
+   private:
+    // Starts accepting clients and replicas. Replica does it only after it
+    // is promoted.
+    void StartServing();
+
+    // Stops I/O threads. Requests they passed to market thread hold their
+    // sessions, so these are handled before sessions are destroyed.
+    void StopIoThreads();
+
+    // Periodically flushes batched db writes and command journal
+    void ScheduleFlush();
+
+    void HandleFlush(const boost::system::error_code& error);
+
+    // Snapshots are written every snapshot_interval seconds if it is set
+    // and whenever SIGUSR1 is received
+    void ScheduleSnapshot();
+
+    void HandleSnapshot(const boost::system::error_code& error);
+
+    void WaitSnapshotSignal();
+
+    void HandleSnapshotSignal(const boost::system::error_code& error);
+
+    // Replica is promoted to primary on SIGUSR2
+    void WaitPromoteSignal();
+
+    void HandlePromoteSignal(const boost::system::error_code& error);
+
    private:
     boost::asio::io_service& io_service_;
-    boost::asio::ip::tcp::acceptor acceptor_;
+    boost::asio::steady_timer flush_timer_;
+    boost::asio::steady_timer snapshot_timer_;
+    boost::asio::signal_set snapshot_signals_;
+    boost::asio::signal_set promote_signals_;
+    std::unique_ptr<ReplicationServer> replication_server_;
+    std::unique_ptr<ReplicationClient> replication_client_;
+    // Clients are served either on io_service_ by single listener or by
+    // listener per I/O thread. Unix socket listener is added to the first
+    // of them.
+    std::vector<std::unique_ptr<boost::asio::io_service>> io_thread_services_;
+    std::vector<std::unique_ptr<Listener>> listeners_;
+    std::vector<std::thread> io_threads_;
+    // Socket file is removed at shutdown only if this server created it
+    bool is_unix_socket_bound_ = false;
 };
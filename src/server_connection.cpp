@@ -0,0 +1,80 @@
+#include "server_connection.h"
+
+#include <boost/asio/write.hpp>
+#include <stdexcept>
+#include <string_view>
+
+#include "common.h"
+#include "request.h"
+
+using boost::asio::ip::tcp;
+using nlohmann::json;
+
+ServerConnection::ServerConnection(tcp::socket&& socket)
+    : socket_(std::move(socket)) {}
+
+bool ServerConnection::UseBinaryProtocol() {
+    json reply = Send({{json_field::TYPE, requests::PROTOCOL},
+                       {json_field::PROTOCOL, protocols::BINARY}});
+    if (!reply.is_object() || !reply.at(json_field::SUCCESS)) {
+        return false;
+    }
+    protocol_ = Protocol::BINARY;
+    return true;
+}
+
+json ServerConnection::Send(const json& request) {
+    if (protocol_ == Protocol::JSON) {
+        boost::asio::write(socket_, boost::asio::buffer(request.dump()));
+        return ReadJsonReply();
+    }
+    std::string message;
+    AppendBinaryRequest(request, message);
+    boost::asio::write(socket_, boost::asio::buffer(message));
+    return ReadBinaryReply();
+}
+
+// Json replies are not framed, reply is complete once it is valid json.
+// Compressed reply is message of binary protocol.
+json ServerConnection::ReadJsonReply() {
+    if (input_.empty()) {
+        ReadSome();
+    }
+    if (static_cast<uint8_t>(input_[0]) & compressed_message_flag) {
+        RequestKind kind;
+        return json::parse(ReadMessage(kind));
+    }
+    while (!json::accept(input_)) {
+        ReadSome();
+    }
+    json reply = json::parse(input_);
+    input_.clear();
+    return reply;
+}
+
+json ServerConnection::ReadBinaryReply() {
+    RequestKind kind;
+    std::string payload = ReadMessage(kind);
+    return DecodeBinaryReply(kind, payload);
+}
+
+std::string ServerConnection::ReadMessage(RequestKind& kind) {
+    std::string_view payload;
+    size_t size;
+    while ((size = DecodeBinaryMessage(input_, kind, payload)) == 0) {
+        ReadSome();
+    }
+    std::string message;
+    if (!TakeCompressionFlag(kind)) {
+        message = payload;
+    } else if (!DecompressPayload(payload, message)) {
+        throw std::runtime_error("Malformed compressed reply");
+    }
+    input_.erase(0, size);
+    return message;
+}
+
+void ServerConnection::ReadSome() {
+    size_t size = socket_.read_some(boost::asio::buffer(data_));
+    input_.append(data_, size);
+}
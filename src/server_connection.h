@@ -0,0 +1,39 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <string>
+
+#include "binary_protocol.h"
+#include "json.h"
+
+// Connection of client to server. Requests and replies are json in both
+// protocols, in binary protocol they are converted when they are sent and
+// received. Compressed replies are restored.
+class ServerConnection {
+   public:
+    explicit ServerConnection(boost::asio::ip::tcp::socket&& socket);
+
+    // Switches connection to binary protocol. Returns false if server does
+    // not support it.
+    bool UseBinaryProtocol();
+
+    // Sends request and waits for reply to it
+    nlohmann::json Send(const nlohmann::json& request);
+
+   private:
+    nlohmann::json ReadJsonReply();
+
+    nlohmann::json ReadBinaryReply();
+
+    // Reads whole message of binary protocol and returns its payload
+    std::string ReadMessage(RequestKind& kind);
+
+    void ReadSome();
+
+   private:
+    boost::asio::ip::tcp::socket socket_;
+    Protocol protocol_ = Protocol::JSON;
+    std::string input_;
+    enum { max_length = 4096 };
+    char data_[max_length];
+};
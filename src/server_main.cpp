@@ -3,22 +3,33 @@
 #include <exception>
 #include <iostream>
 
-#include "db_manager.h"
+#include "capture.h"
 #include "offer.h"
+#include "serializer.h"
 #include "server.h"
+#include "server_options.h"
 #include "user_data.h"
 
-std::atomic<uint64_t> Offer::offer_id_ = GetDBManager().GetMaxId("Offer");
-std::atomic<uint64_t> Deal::deal_id_ = GetDBManager().GetMaxId("Deal");
-std::atomic<uint64_t> UserData::user_id_ = GetDBManager().GetMaxId("User");
+// Counters are set when market state is restored
+std::atomic<uint64_t> Offer::offer_id_ = 0;
+std::atomic<uint64_t> Deal::deal_id_ = 0;
+std::atomic<uint64_t> UserData::user_id_ = 0;
 
 boost::asio::io_service io_service;
 
 void signal_handler(int) { io_service.stop(); }
 
-int main() {
+int main(int argc, char** argv) {
+    if (!ParseServerOptions(argc, argv, GetServerOptions())) {
+        PrintServerUsage();
+        return 1;
+    }
+
     std::signal(SIGINT, signal_handler);
     try {
+        // Market state is restored from db before accepting connections
+        GetSerializer();
+        GetRequestCapture();
         Server server(io_service);
         io_service.run();
     } catch (std::exception& er) {
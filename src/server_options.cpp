@@ -0,0 +1,127 @@
+#include "server_options.h"
+
+#include <iostream>
+#include <limits>
+#include <string>
+#include <sys/un.h>
+
+#include "option_parsing.h"
+
+static constexpr int max_io_threads = 256;
+// Path with terminating zero must fit sockaddr_un
+static constexpr size_t max_unix_socket_path =
+    sizeof(sockaddr_un::sun_path) - 1;
+
+bool ParseServerOptions(int argc, char** argv, ServerOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--port" && i + 1 < argc) {
+            if (!ParseNumber(argv[++i], 1, max_port, options.port)) {
+                return false;
+            }
+        } else if (arg == "--replication-port" && i + 1 < argc) {
+            if (!ParseNumber(argv[++i], 0, max_port,
+                             options.replication_port)) {
+                return false;
+            }
+        } else if (arg == "--replica-of" && i + 1 < argc) {
+            if (!ParseAddress(argv[++i], options.primary_host,
+                              options.primary_port)) {
+                return false;
+            }
+        } else if (arg == "--replay") {
+            options.replay_journal = true;
+        } else if (arg == "--journal" && i + 1 < argc) {
+            options.journal_path = argv[++i];
+        } else if (arg == "--snapshot" && i + 1 < argc) {
+            options.snapshot_path = argv[++i];
+        } else if (arg == "--capture" && i + 1 < argc) {
+            options.capture_path = argv[++i];
+        } else if (arg == "--snapshot-interval" && i + 1 < argc) {
+            if (!ParseNumber(argv[++i], 0, std::numeric_limits<int>::max(),
+                             options.snapshot_interval)) {
+                return false;
+            }
+        } else if (arg == "--compression-threshold" && i + 1 < argc) {
+            if (!ParseNumber(argv[++i], 0, std::numeric_limits<int>::max(),
+                             options.compression_threshold)) {
+                return false;
+            }
+        } else if (arg == "--max-sessions" && i + 1 < argc) {
+            if (!ParseNumber(argv[++i], 1, std::numeric_limits<int>::max(),
+                             options.max_sessions)) {
+                return false;
+            }
+        } else if (arg == "--io-threads" && i + 1 < argc) {
+            if (!ParseNumber(argv[++i], 0, max_io_threads,
+                             options.io_threads)) {
+                return false;
+            }
+        } else if (arg == "--send-buffer" && i + 1 < argc) {
+            if (!ParseNumber(argv[++i], 0, std::numeric_limits<int>::max(),
+                             options.send_buffer_size)) {
+                return false;
+            }
+        } else if (arg == "--receive-buffer" && i + 1 < argc) {
+            if (!ParseNumber(argv[++i], 0, std::numeric_limits<int>::max(),
+                             options.receive_buffer_size)) {
+                return false;
+            }
+        } else if (arg == "--unix-socket" && i + 1 < argc) {
+            options.unix_socket_path = argv[++i];
+            if (options.unix_socket_path.empty() ||
+                options.unix_socket_path.size() > max_unix_socket_path) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void PrintServerUsage() {
+    std::cout << "Usage: server.out [options]\n"
+                 "    --port <port>     port for clients (default 5555)\n"
+                 "    --journal <path>  command journal file "
+                 "(default db/market.journal)\n"
+                 "    --replay          rebuild market from snapshot and "
+                 "journal instead of database\n"
+                 "    --snapshot <path> market snapshot file "
+                 "(default db/market.snapshot)\n"
+                 "    --snapshot-interval <sec>\n"
+                 "                      write snapshot periodically, also "
+                 "on SIGUSR1 (default 0, disabled)\n"
+                 "    --capture <path>  record received requests for "
+                 "replay.out\n"
+                 "    --replication-port <port>\n"
+                 "                      accept replicas on port "
+                 "(default 0, disabled)\n"
+                 "    --replica-of <host:port>\n"
+                 "                      run as hot standby of primary, "
+                 "SIGUSR2 promotes it\n"
+                 "    --compression-threshold <bytes>\n"
+                 "                      compress replies from this size "
+                 "when client asks (default 512)\n"
+                 "    --max-sessions <count>\n"
+                 "                      clients served at once, others wait "
+                 "to be accepted (default 10000)\n"
+                 "    --io-threads <n>  serve connections on n threads with "
+                 "SO_REUSEPORT listener each,\n"
+                 "                      market stays on main thread "
+                 "(default 0, all on main thread)\n"
+                 "    --send-buffer <bytes>\n"
+                 "    --receive-buffer <bytes>\n"
+                 "                      socket buffer sizes of clients "
+                 "(default 0, system defaults)\n"
+                 "    --unix-socket <path>\n"
+                 "                      also accept local clients on Unix "
+                 "domain socket"
+              << std::endl;
+}
+
+ServerOptions& GetServerOptions() {
+    static ServerOptions options;
+    return options;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+
+#include "common.h"
+
+// Options of server.out, set from command line at startup
+struct ServerOptions {
+    // Port for client connections
+    int port = ::port;
+    // Append-only journal of commands accepted by market
+    std::string journal_path = "db/market.journal";
+    // Rebuild market from journal instead of database
+    bool replay_journal = false;
+    // Binary snapshot of market, replay starts from it when it exists
+    std::string snapshot_path = "db/market.snapshot";
+    // Seconds between periodic snapshots, 0 disables them
+    int snapshot_interval = 0;
+    // JSONL file to record received requests to, empty disables capture
+    std::string capture_path;
+    // Port for replica connections, 0 disables replication
+    int replication_port = 0;
+    // Address of primary, set only for replica
+    std::string primary_host;
+    int primary_port = 0;
+    // Replies of connections with compression are compressed from this size
+    int compression_threshold = 512;
+    // Connections served at once, further ones wait until some is closed
+    int max_sessions = 10000;
+    // Threads serving connections, each with own listener on port. Market
+    // stays on main thread. 0 serves everything on main thread.
+    int io_threads = 0;
+    // SO_SNDBUF and SO_RCVBUF of client sockets, 0 keeps system defaults
+    int send_buffer_size = 0;
+    int receive_buffer_size = 0;
+    // Unix domain socket for local clients in addition to port, empty
+    // disables it
+    std::string unix_socket_path;
+
+    bool IsReplica() const { return !primary_host.empty(); }
+};
+
+// Returns false if arguments are invalid
+bool ParseServerOptions(int argc, char** argv, ServerOptions& options);
+
+void PrintServerUsage();
+
+ServerOptions& GetServerOptions();
@@ -1,85 +1,190 @@
 #include "session.h"
 
 #include <boost/asio/buffer.hpp>
+#include <boost/asio/dispatch.hpp>
 #include <boost/asio/placeholders.hpp>
 #include <boost/asio/write.hpp>
+#include <chrono>
 #include <string>
+#include <string_view>
 
-#include "common.h"
-#include "json.h"
-#include "offer.h"
-#include "serializer.h"
+#include "capture.h"
+#include "metrics.h"
+#include "request_dispatch.h"
+#include "server_options.h"
 
 using namespace boost::asio;
-using nlohmann::json;
 
-Session::Session(io_service& io_service) : socket_(io_service) {}
+Session::Session(boost::asio::io_service& io_service,
+                 boost::asio::io_service& market_io_service)
+    : socket_(io_service), market_io_service_(market_io_service) {}
 
 void Session::Start() {
+    started_ = true;
+    GetMetrics().active_sessions.Add(1);
+    StartRead();
+}
+
+static void ResetBuffer(std::string& buffer) {
+    if (buffer.capacity() > Session::max_pooled_buffer_size) {
+        std::string().swap(buffer);
+    } else {
+        buffer.clear();
+    }
+}
+
+void Session::Reset() {
+    boost::system::error_code error;
+    socket_.close(error);
+    if (started_) {
+        GetMetrics().active_sessions.Add(-1);
+        started_ = false;
+    }
+    connection_ = ConnectionState{};
+    request_kind_ = RequestKind::UNKNOWN;
+    ResetBuffer(reply_);
+    ResetBuffer(compressed_reply_);
+    ResetBuffer(input_);
+}
+
+void Session::StartRead() {
     socket_.async_read_some(
         buffer(data_, max_length),
-        boost::bind(&Session::HandleRead, this, placeholders::error,
-                    placeholders::bytes_transferred));
+        boost::bind(&Session::HandleRead, shared_from_this(),
+                    placeholders::error, placeholders::bytes_transferred));
 }
 
+// Input is handled inline when connection is served on market thread
 void Session::HandleRead(const boost::system::error_code& error,
                          size_t bytes_transferred) {
     if (!error) {
-        data_[bytes_transferred] = '\0';
-
-        json request = json::parse(data_);
-        auto request_type = request[json_field::TYPE];
-        std::string reply;
-        if (request_type == requests::REGISTRATION) {
-            reply = GetSerializer().RegisterUser(request[json_field::USERNAME],
-                                                 request[json_field::PW_HASH]);
-        } else if (request_type == requests::LOGIN) {
-            reply = GetSerializer().Login(request[json_field::USERNAME],
-                                          request[json_field::PW_HASH]);
-        } else if (request_type == requests::BALANCE) {
-            reply = GetSerializer().GetBalance(request[json_field::USER_ID]);
-        } else if (request_type == requests::ACTIVE_OFFERS) {
-            reply =
-                GetSerializer().GetActiveOffers(request[json_field::USER_ID]);
-        } else if (request_type == requests::CLOSED_DEALS) {
-            reply =
-                GetSerializer().GetClosedDeals(request[json_field::USER_ID]);
-        } else if (request_type == requests::POST_OFFER) {
-            reply = "\"Offer was posted.\"";
-            OfferType offer_type =
-                request.at(json_field::OFFER_SIDE) == json_field::BUY
-                    ? OfferType::BUY
-                    : OfferType::SELL;
-            GetSerializer().PostOffer(request.at(json_field::USER_ID),
-                                      offer_type, request.at(json_field::PRICE),
-                                      request.at(json_field::AMOUNT));
-        } else if (request_type == requests::QUOTES) {
-            reply = GetSerializer().GetQuotes();
-        } else if (request_type == requests::CANCEL) {
-            reply =
-                GetSerializer().CancelOffer(request.at(json_field::USER_ID),
-                                            request.at(json_field::OFFER_ID));
-        } else {
-            reply = "\"ERROR: Unknown request type\"";
-        }
+        dispatch(market_io_service_,
+                 boost::bind(&Session::HandleInput, shared_from_this(),
+                             bytes_transferred));
+    }
+}
 
-        async_write(socket_, buffer(reply, reply.size()),
-                    boost::bind(&Session::HandleWrite, this,
-                                boost::asio::placeholders::error));
+// Json request is expected in one read, binary messages are accumulated until
+// they are complete. Malformed requests are answered with error, only binary
+// message over size limit closes connection. Session is released when no
+// further operation is started.
+void Session::HandleInput(size_t bytes_transferred) {
+    reply_.clear();
+    if (connection_.protocol == Protocol::BINARY) {
+        input_.append(data_, bytes_transferred);
+        HandleBinaryInput();
+        if (ExceedsBinaryMessageSize(input_)) {
+            return;
+        }
+        if (reply_.empty()) {
+            StartRead();
+            return;
+        }
     } else {
-        delete this;
+        auto parse_start = std::chrono::steady_clock::now();
+        Request request;
+        RequestError request_error =
+            ParseJsonRequest({data_, bytes_transferred}, request);
+        HandleRequest(request, request_error, parse_start);
+    }
+
+    write_start_ = std::chrono::steady_clock::now();
+    async_write(socket_, buffer(reply_, reply_.size()),
+                boost::bind(&Session::HandleWrite, shared_from_this(),
+                            boost::asio::placeholders::error));
+}
+
+void Session::HandleBinaryInput() {
+    std::string_view input = input_;
+    RequestKind kind;
+    std::string_view payload;
+    while (size_t size = DecodeBinaryMessage(input, kind, payload)) {
+        auto parse_start = std::chrono::steady_clock::now();
+        Request request;
+        RequestError error = DecodeBinaryRequest(kind, payload, request);
+        HandleRequest(request, error, parse_start);
+        input.remove_prefix(size);
+    }
+    input_.erase(0, input_.size() - input.size());
+}
+
+// Nested persistence and serialization times are taken out of matching time
+// of handler. Requests act on behalf of user authenticated on connection,
+// whatever user client names.
+void Session::HandleRequest(Request& request, RequestError error,
+                            std::chrono::steady_clock::time_point parse_start) {
+    request_kind_ = request.kind;
+    RecordLatency(RequestStage::PARSE, parse_start);
+    request.user_id = connection_.user_id.value_or(0);
+
+    auto match_start = std::chrono::steady_clock::now();
+    GetMetrics().TakeNestedTime(RequestStage::PERSIST);
+    GetMetrics().TakeNestedTime(RequestStage::SERIALIZE);
+    // Header of binary reply is written before payload and completed after
+    // it. Reply is made with settings connection had before request.
+    ConnectionState reply_connection = connection_;
+    size_t message_offset = reply_.size();
+    if (reply_connection.protocol == Protocol::BINARY) {
+        BeginBinaryMessage(reply_);
+    }
+    RequestKind reply_kind =
+        DispatchRequest(request, error, connection_, reply_);
+    if (reply_connection.protocol == Protocol::BINARY) {
+        EndBinaryMessage(reply_kind, message_offset, reply_);
+    }
+    if (reply_connection.compression) {
+        CompressReply(reply_kind, reply_connection.protocol, message_offset);
+    }
+    auto persist_time = GetMetrics().TakeNestedTime(RequestStage::PERSIST);
+    auto serialize_time = GetMetrics().TakeNestedTime(RequestStage::SERIALIZE);
+    GetMetrics().RecordLatency(request_kind_, RequestStage::MATCH,
+                               std::chrono::steady_clock::now() - match_start -
+                                   persist_time - serialize_time);
+    if (persist_time.count() > 0) {
+        GetMetrics().RecordLatency(request_kind_, RequestStage::PERSIST,
+                                   persist_time);
+    }
+    if (serialize_time.count() > 0) {
+        GetMetrics().RecordLatency(request_kind_, RequestStage::SERIALIZE,
+                                   serialize_time);
+    }
+
+    // Rejected requests do not reach market and are not replayed
+    RequestCapture* capture = GetRequestCapture();
+    if (capture != nullptr && error == RequestError::NONE &&
+        reply_kind == request.kind) {
+        capture->Write(RequestToJson(request));
+    }
+}
+
+// Small replies are left as they are, compressing them saves next to nothing
+void Session::CompressReply(RequestKind kind, Protocol protocol,
+                            size_t offset) {
+    StageTimer timer(RequestStage::SERIALIZE);
+    size_t payload_offset =
+        offset + (protocol == Protocol::BINARY ? binary_header_size : 0);
+    std::string_view payload = std::string_view(reply_).substr(payload_offset);
+    if (payload.size() <
+        static_cast<size_t>(GetServerOptions().compression_threshold)) {
+        return;
+    }
+    compressed_reply_.clear();
+    if (AppendCompressedMessage(kind, payload, compressed_reply_)) {
+        reply_.replace(offset, std::string::npos, compressed_reply_);
     }
 }
 
 void Session::HandleWrite(const boost::system::error_code& error) {
     if (!error) {
-        socket_.async_read_some(
-            buffer(data_, max_length),
-            boost::bind(&Session::HandleRead, this, placeholders::error,
-                        placeholders::bytes_transferred));
-    } else {
-        delete this;
+        RecordLatency(RequestStage::WRITE, write_start_);
+        StartRead();
     }
 }
 
-ip::tcp::socket& Session::GetSocket() { return socket_; }
+void Session::RecordLatency(RequestStage stage,
+                            std::chrono::steady_clock::time_point start) {
+    GetMetrics().RecordLatency(request_kind_, stage,
+                               std::chrono::steady_clock::now() - start);
+}
+
+generic::stream_protocol::socket& Session::GetSocket() { return socket_; }
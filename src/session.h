@@ -1,25 +1,74 @@
 #pragma once
 
 #include <boost/asio.hpp>
-#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
 #include <boost/bind/bind.hpp>
+#include <chrono>
+#include <memory>
 #include <string>
 
-class Session {
+#include "binary_protocol.h"
+#include "metrics.h"
+#include "request.h"
+#include "request_dispatch.h"
+
+// Connection with client over TCP or Unix domain socket, kept alive by its
+// pending asynchronous operations
+class Session : public std::enable_shared_from_this<Session> {
    public:
-    Session(boost::asio::io_service& io_service);
+    // Buffers grown larger by big requests or replies are not kept in pool
+    static constexpr size_t max_pooled_buffer_size = 64 << 10;
+
+    // Connection is served on io_service, its requests are handled on
+    // market_io_service
+    Session(boost::asio::io_service& io_service,
+            boost::asio::io_service& market_io_service);
 
     void Start();
 
+    // Closes connection and clears state for reuse with next client
+    void Reset();
+
     void HandleRead(const boost::system::error_code& error,
                     size_t bytes_transferred);
 
     void HandleWrite(const boost::system::error_code& error);
 
-    boost::asio::ip::tcp::socket& GetSocket();
+    boost::asio::generic::stream_protocol::socket& GetSocket();
+
+   private:
+    void StartRead();
+
+    void HandleInput(size_t bytes_transferred);
+
+    // Handles requests of every complete binary message in input
+    void HandleBinaryInput();
+
+    // Appends reply to request in protocol of connection, or error reply if
+    // request failed parsing. User of request is set to user of connection.
+    void HandleRequest(Request& request, RequestError error,
+                       std::chrono::steady_clock::time_point parse_start);
+
+    // Replaces reply message that starts at offset with compressed one
+    void CompressReply(RequestKind kind, Protocol protocol, size_t offset);
+
+    // Records latency of stage that started at given time
+    void RecordLatency(RequestStage stage,
+                       std::chrono::steady_clock::time_point start);
 
    private:
-    boost::asio::ip::tcp::socket socket_;
+    boost::asio::generic::stream_protocol::socket socket_;
+    boost::asio::io_service& market_io_service_;
+    bool started_ = false;
+    ConnectionState connection_;
+    RequestKind request_kind_ = RequestKind::UNKNOWN;
+    std::chrono::steady_clock::time_point write_start_;
+    // Reply must outlive asynchronous write
+    std::string reply_;
+    // Kept between replies to reuse its memory
+    std::string compressed_reply_;
+    // Binary messages may be split between reads
+    std::string input_;
     enum { max_length = 4096 };
     char data_[max_length];
 };
@@ -0,0 +1,94 @@
+#include "session_pool.h"
+
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/post.hpp>
+#include <utility>
+
+SessionLimit::SessionLimit(size_t max_sessions)
+    : max_sessions_(max_sessions) {}
+
+bool SessionLimit::TryAcquire(std::function<void()> on_release) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (active_count_ == max_sessions_) {
+        waiters_.push_back(std::move(on_release));
+        return false;
+    }
+    ++active_count_;
+    return true;
+}
+
+// Waiters are woken outside of lock, they acquire again
+void SessionLimit::Release() {
+    std::vector<std::function<void()>> waiters;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --active_count_;
+        waiters.swap(waiters_);
+    }
+    for (auto& waiter : waiters) {
+        waiter();
+    }
+}
+
+size_t SessionLimit::GetActiveCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return active_count_;
+}
+
+SessionPool::SessionPool(boost::asio::io_service& io_service,
+                         boost::asio::io_service& market_io_service,
+                         std::shared_ptr<SessionLimit> limit,
+                         std::function<void()> on_release)
+    : io_service_(io_service),
+      market_io_service_(market_io_service),
+      limit_(std::move(limit)),
+      on_release_(std::move(on_release)) {}
+
+std::shared_ptr<Session> SessionPool::Acquire() {
+    // Waiter may outlive pool, so it does not capture this
+    auto on_release = [&io_service = io_service_, pool = weak_from_this()] {
+        boost::asio::post(io_service, [pool] {
+            if (auto locked_pool = pool.lock()) {
+                locked_pool->on_release_();
+            }
+        });
+    };
+    if (!limit_->TryAcquire(std::move(on_release))) {
+        return nullptr;
+    }
+    std::unique_ptr<Session> session;
+    if (free_sessions_.empty()) {
+        session = std::make_unique<Session>(io_service_, market_io_service_);
+    } else {
+        session = std::move(free_sessions_.back());
+        free_sessions_.pop_back();
+    }
+    ++active_count_;
+
+    return std::shared_ptr<Session>(
+        session.release(), [pool = weak_from_this()](Session* session) {
+            std::unique_ptr<Session> released(session);
+            auto locked_pool = pool.lock();
+            if (!locked_pool) {
+                return;
+            }
+            // Runs inline on thread of pool. If io_service is stopped,
+            // handler is destroyed together with session.
+            boost::asio::dispatch(
+                locked_pool->io_service_,
+                [pool, released = std::move(released)]() mutable {
+                    if (auto locked_pool = pool.lock()) {
+                        locked_pool->Release(std::move(released));
+                    }
+                });
+        });
+}
+
+size_t SessionPool::GetActiveCount() const { return active_count_; }
+
+void SessionPool::Release(std::unique_ptr<Session> session) {
+    session->Reset();
+    free_sessions_.push_back(std::move(session));
+    --active_count_;
+    limit_->Release();
+}
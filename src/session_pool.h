@@ -0,0 +1,64 @@
+#pragma once
+
+#include <boost/asio/io_service.hpp>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "session.h"
+
+// Limits sessions in use by all pools sharing it, pools run on different
+// I/O threads
+class SessionLimit {
+   public:
+    explicit SessionLimit(size_t max_sessions);
+
+    // Returns false if max_sessions sessions are in use, on_release is then
+    // called once on thread releasing one of them
+    bool TryAcquire(std::function<void()> on_release);
+
+    void Release();
+
+    size_t GetActiveCount() const;
+
+   private:
+    mutable std::mutex mutex_;
+    size_t max_sessions_;
+    size_t active_count_ = 0;
+    std::vector<std::function<void()>> waiters_;
+};
+
+// Recycles sessions of closed connections together with memory of their
+// buffers. Session is owned by its pending asynchronous operations and
+// returns to pool when the last of them completes. Pool is used only on
+// thread of its io_service, sessions released elsewhere are passed there.
+// Sessions that outlive pool, e.g. held by handlers of stopped io_service,
+// are deleted.
+class SessionPool : public std::enable_shared_from_this<SessionPool> {
+   public:
+    // on_release is called on thread of pool after Acquire returned nullptr
+    // and a session of any pool sharing limit is released
+    SessionPool(boost::asio::io_service& io_service,
+                boost::asio::io_service& market_io_service,
+                std::shared_ptr<SessionLimit> limit,
+                std::function<void()> on_release);
+
+    // Returns nullptr if limit is reached
+    std::shared_ptr<Session> Acquire();
+
+    // Sessions of this pool in use
+    size_t GetActiveCount() const;
+
+   private:
+    void Release(std::unique_ptr<Session> session);
+
+   private:
+    boost::asio::io_service& io_service_;
+    boost::asio::io_service& market_io_service_;
+    std::shared_ptr<SessionLimit> limit_;
+    std::function<void()> on_release_;
+    size_t active_count_ = 0;
+    std::vector<std::unique_ptr<Session>> free_sessions_;
+};
@@ -0,0 +1,179 @@
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static constexpr uint32_t snapshot_magic = 0x31535846;  // "FXS1"
+static constexpr uint32_t snapshot_version = 2;
+// Header of version 1 ends before journal offset
+static constexpr size_t snapshot_v1_header_size =
+    offsetof(SnapshotHeader, journal_offset);
+
+template <typename T>
+static bool WriteArray(std::FILE* file, std::span<const T> array) {
+    return std::fwrite(array.data(), sizeof(T), array.size(), file) ==
+           array.size();
+}
+
+template <typename T>
+static void AppendArray(std::string& buffer, std::span<const T> array) {
+    buffer.append(reinterpret_cast<const char*>(array.data()),
+                  array.size_bytes());
+}
+
+static SnapshotHeader MakeFileHeader(const SnapshotView& snapshot) {
+    SnapshotHeader header = snapshot.header;
+    header.magic = snapshot_magic;
+    header.version = snapshot_version;
+    header.user_count = snapshot.users.size();
+    header.offer_count = snapshot.offers.size();
+    header.deal_count = snapshot.deals.size();
+    header.usernames_size = snapshot.usernames.size();
+    return header;
+}
+
+// Takes array of count records from beginning of data. Returns false if
+// data is too short.
+template <typename T>
+static bool TakeArray(std::string_view& data, uint64_t count,
+                      std::span<const T>& array) {
+    if (count > data.size() / sizeof(T)) {
+        return false;
+    }
+    array = {reinterpret_cast<const T*>(data.data()), count};
+    data.remove_prefix(count * sizeof(T));
+    return true;
+}
+
+SnapshotView ParseSnapshot(std::string_view data) {
+    SnapshotView view;
+    if (reinterpret_cast<uintptr_t>(data.data()) % alignof(uint64_t) != 0) {
+        throw std::runtime_error("Snapshot is not aligned");
+    }
+    if (data.size() < snapshot_v1_header_size) {
+        throw std::runtime_error("Unknown snapshot format");
+    }
+    std::memcpy(&view.header, data.data(), snapshot_v1_header_size);
+    const SnapshotHeader& header = view.header;
+    size_t header_size =
+        header.version == 1 ? snapshot_v1_header_size : sizeof(SnapshotHeader);
+    if (header.magic != snapshot_magic || header.version == 0 ||
+        header.version > snapshot_version || data.size() < header_size) {
+        throw std::runtime_error("Unknown snapshot format");
+    }
+    std::memcpy(&view.header, data.data(), header_size);
+    data.remove_prefix(header_size);
+
+    if (!TakeArray(data, header.user_count, view.users) ||
+        !TakeArray(data, header.offer_count, view.offers) ||
+        !TakeArray(data, header.deal_count, view.deals) ||
+        data.size() != header.usernames_size) {
+        throw std::runtime_error("Snapshot is truncated");
+    }
+    view.usernames = data;
+
+    for (const SnapshotUser& user : view.users) {
+        if (user.username_offset > header.usernames_size ||
+            user.username_size > header.usernames_size - user.username_offset) {
+            throw std::runtime_error("Snapshot is corrupted");
+        }
+    }
+
+    return view;
+}
+
+SnapshotView MarketSnapshot::GetView() const {
+    return {.header = header,
+            .users = users,
+            .offers = offers,
+            .deals = deals,
+            .usernames = usernames};
+}
+
+void EncodeSnapshot(const SnapshotView& snapshot, std::string& buffer) {
+    SnapshotHeader header = MakeFileHeader(snapshot);
+    buffer.reserve(buffer.size() + sizeof(header) +
+                   snapshot.users.size_bytes() + snapshot.offers.size_bytes() +
+                   snapshot.deals.size_bytes() + snapshot.usernames.size());
+    buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    AppendArray(buffer, snapshot.users);
+    AppendArray(buffer, snapshot.offers);
+    AppendArray(buffer, snapshot.deals);
+    buffer += snapshot.usernames;
+}
+
+void WriteSnapshot(const SnapshotView& snapshot, const std::string& path) {
+    SnapshotHeader header = MakeFileHeader(snapshot);
+
+    // File is synced before rename, otherwise after crash rename could be
+    // persisted while data is not
+    std::string tmp_path = path + ".tmp";
+    std::FILE* file = std::fopen(tmp_path.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("Unable to open snapshot " + tmp_path);
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+              WriteArray(file, snapshot.users) &&
+              WriteArray(file, snapshot.offers) &&
+              WriteArray(file, snapshot.deals) &&
+              std::fwrite(snapshot.usernames.data(), 1,
+                          snapshot.usernames.size(),
+                          file) == snapshot.usernames.size() &&
+              std::fflush(file) == 0 && fdatasync(fileno(file)) == 0;
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok) {
+        std::filesystem::remove(tmp_path);
+        throw std::runtime_error("Unable to write snapshot " + tmp_path);
+    }
+    std::filesystem::rename(tmp_path, path);
+}
+
+MappedSnapshot::MappedSnapshot(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open snapshot " + path);
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        throw std::runtime_error("Unable to open snapshot " + path);
+    }
+    size_ = file_stat.st_size;
+    if (size_ == 0) {
+        close(fd);
+        throw std::runtime_error("Unknown snapshot format " + path);
+    }
+
+    // Whole file is read once during restore, so it is populated up front
+    // instead of faulting page by page
+    data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data_ == MAP_FAILED) {
+        throw std::runtime_error("Unable to map snapshot " + path);
+    }
+
+    try {
+        view_ = ParseSnapshot(
+            std::string_view(static_cast<const char*>(data_), size_));
+    } catch (const std::runtime_error& error) {
+        munmap(data_, size_);
+        throw std::runtime_error(error.what() + (" " + path));
+    }
+}
+
+MappedSnapshot::~MappedSnapshot() { munmap(data_, size_); }
+
+const SnapshotView& MappedSnapshot::GetView() const { return view_; }
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Snapshot is a full copy of market state tagged with sequence number of
+// the last journal record it includes and offset of the next record in
+// journal. Recovery loads snapshot and reads journal from that offset.
+//
+// File layout is header followed by arrays of fixed size records (users,
+// offers, deals) and blob of usernames referenced by users. Offers are
+// stored in queue order of both order books, deals are stored once even
+// though they belong to two users. Record sizes are multiples of 8, so
+// arrays of mapped file are properly aligned and are used in place.
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t journal_seq;
+    uint64_t next_user_id;
+    uint64_t next_offer_id;
+    uint64_t next_deal_id;
+    uint64_t user_count;
+    uint64_t offer_count;
+    uint64_t deal_count;
+    uint64_t usernames_size;
+    int32_t quote;
+    uint8_t has_quote;
+    uint8_t padding[3];
+    // Added in version 2, 0 if unknown
+    uint64_t journal_offset;
+};
+
+struct SnapshotUser {
+    uint64_t id;
+    uint64_t pw_hash;
+    int64_t usd;
+    int64_t rub;
+    uint64_t username_offset;
+    uint64_t username_size;
+};
+
+struct SnapshotOffer {
+    uint64_t id;
+    uint64_t owner_id;
+    uint64_t amount;
+    int32_t price;
+    uint8_t type;
+    uint8_t padding[3];
+};
+
+struct SnapshotDeal {
+    uint64_t id;
+    uint64_t seller_id;
+    uint64_t buyer_id;
+    uint64_t amount;
+    int32_t price;
+    uint8_t padding[4];
+};
+
+static_assert(sizeof(SnapshotHeader) == 88);
+static_assert(sizeof(SnapshotUser) == 48);
+static_assert(sizeof(SnapshotOffer) == 32);
+static_assert(sizeof(SnapshotDeal) == 40);
+
+// Read-only view of snapshot, either built in memory or mapped from file
+struct SnapshotView {
+    SnapshotHeader header{};
+    std::span<const SnapshotUser> users;
+    std::span<const SnapshotOffer> offers;
+    std::span<const SnapshotDeal> deals;
+    std::string_view usernames;
+};
+
+struct MarketSnapshot {
+    SnapshotHeader header{};
+    std::vector<SnapshotUser> users;
+    std::vector<SnapshotOffer> offers;
+    std::vector<SnapshotDeal> deals;
+    std::string usernames;
+
+    SnapshotView GetView() const;
+};
+
+// Writes snapshot to temporary file and renames it over path, so that
+// existing snapshot is never left half written
+void WriteSnapshot(const SnapshotView& snapshot, const std::string& path);
+
+// Appends snapshot in file format to buffer, e.g. to send it to replica
+void EncodeSnapshot(const SnapshotView& snapshot, std::string& buffer);
+
+// Returns view of snapshot in file format stored in data. Data must be
+// aligned to 8 bytes. Throws std::runtime_error if it is not a valid
+// snapshot.
+SnapshotView ParseSnapshot(std::string_view data);
+
+// Snapshot file mapped to memory. Records are not copied or parsed, view
+// points into mapping and is valid while object exists.
+class MappedSnapshot {
+   public:
+    // Throws std::runtime_error if file is not a valid snapshot
+    explicit MappedSnapshot(const std::string& path);
+
+    MappedSnapshot(const MappedSnapshot&) = delete;
+
+    MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+    ~MappedSnapshot();
+
+    const SnapshotView& GetView() const;
+
+   private:
+    void* data_ = nullptr;
+    size_t size_ = 0;
+    SnapshotView view_;
+};
@@ -4,23 +4,18 @@
 #include <memory>
 #include <string>
 
-#ifndef TEST
-#include "db_manager.h"
-#endif  // !TEST
-
-UserData::UserData(const std::string& username, size_t pw_hash)
-    : id_(GenerateId()), username_(username), balance_({.usd = 0, .rub = 0}) {
-#ifndef TEST
-    GetDBManager().AddUser(id_, username_, pw_hash);
-#endif  // !TEST
-}
+UserData::UserData(const std::string& username)
+    : UserData(GenerateId(), username) {}
+
+UserData::UserData(uint64_t id, const std::string& username)
+    : id_(id), username_(username), balance_({.usd = 0, .rub = 0}) {}
 
 void UserData::AddOffer(const std::shared_ptr<Offer>& offer) {
-    active_offers_.insert(offer);
+    active_offers_.insert(active_offers_.end(), offer);
 }
 
 void UserData::AddDeal(const std::shared_ptr<Deal>& deal) {
-    closed_deals_.insert(deal);
+    closed_deals_.insert(closed_deals_.end(), deal);
 }
 
 bool UserData::RemoveActiveOffer(uint64_t offer_id) {
@@ -63,6 +58,12 @@ void UserData::WithdrawRUB(size_t withdraw_amount) {
     balance_.rub -= withdraw_amount;
 }
 
+void UserData::SetBalance(Balance balance) { balance_ = balance; }
+
+uint64_t UserData::GetNextId() { return user_id_; }
+
+void UserData::SetNextId(uint64_t next_id) { user_id_ = next_id; }
+
 uint64_t UserData::GenerateId() { return user_id_++; }
 
 size_t UserDataHasher::operator()(const UserData& user_data) {
@@ -73,13 +74,3 @@ size_t UserDataHasher::operator()(uint64_t user_id) {
     return hash_type{}(user_id);
 }
 
-std::optional<UserData> CreateUser(const std::string& username,
-                                   size_t pw_hash) {
-#ifndef TEST
-    if (GetDBManager().UsernameExist(username)) {
-        return std::nullopt;
-    }
-#endif  // !TEST
-
-    return UserData(username, pw_hash);
-}
@@ -9,6 +9,11 @@
 
 #include "offer.h"
 
+enum class Currency : uint8_t {
+    USD,
+    RUB,
+};
+
 struct Balance {
     int usd;
     int rub;
@@ -18,7 +23,9 @@ struct Balance {
 
 class UserData {
    public:
-    UserData(const std::string& username, size_t pw_hash);
+    UserData(const std::string& username);
+
+    UserData(uint64_t id, const std::string& username);
 
     void AddOffer(const std::shared_ptr<Offer>& offer);
 
@@ -43,6 +50,14 @@ class UserData {
 
     void WithdrawRUB(size_t withdraw_amount);
 
+    void SetBalance(Balance balance);
+
+    // Id counter is shared by all instances. Reset is used when market
+    // state is rebuilt from journal or snapshot.
+    static uint64_t GetNextId();
+
+    static void SetNextId(uint64_t next_id);
+
    private:
     static uint64_t GenerateId();
 
@@ -63,5 +78,3 @@ struct UserDataHasher {
     std::size_t operator()(const UserData& user_data);
     std::size_t operator()(uint64_t id);
 };
-
-std::optional<UserData> CreateUser(const std::string& username, size_t pw_hash);
@@ -1,12 +1,36 @@
 #define CATCH_CONFIG_MAIN
 
+#include <sqlite3.h>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
 #include <boost/uuid/uuid.hpp>
 #include <catch2/catch_all.hpp>
+#include <cstddef>
 #include <cstdint>
+#include <filesystem>
+#include <fstream>
 #include <optional>
 #include <set>
-
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "../src/binary_protocol.h"
+#include "../src/common.h"
+#include "../src/db_manager.h"
+#include "../src/history.h"
+#include "../src/journal.h"
+#include "../src/json_writer.h"
+#include "../src/logger.h"
+#include "../src/lz4.h"
 #include "../src/market.h"
+#include "../src/metrics.h"
+#include "../src/request.h"
+#include "../src/session_pool.h"
+#include "../src/snapshot.h"
 
 using namespace std;
 
@@ -31,6 +55,20 @@ TEST_CASE("Register User", "[market]") {
     REQUIRE(market.GetClosedDeals(*user_id1) == expected_close_deals);
 }
 
+TEST_CASE("Login and duplicate registration", "[market]") {
+    Market market;
+    const auto user_id = market.RegisterUser("user1", 42);
+    market.RestoreUser(100, "user2", 7);
+
+    REQUIRE_FALSE(market.RegisterUser("user1", 0).has_value());
+    REQUIRE_FALSE(market.RegisterUser("user2", 0).has_value());
+    REQUIRE(market.Login("user1", 42) == user_id);
+    REQUIRE(market.Login("user2", 7) == 100);
+    REQUIRE_FALSE(market.Login("user1", 0).has_value());
+    REQUIRE_FALSE(market.Login("user3", 42).has_value());
+    REQUIRE(market.GetUserBalance(100).usd == 0);
+}
+
 TEST_CASE("Deposit currency", "[market]") {
     Market market;
     const auto user_id = market.RegisterUser("user1", 0);
@@ -297,6 +335,26 @@ TEST_CASE("Get quotes") {
         REQUIRE(market.GetQuote() == expected_quote);
         REQUIRE(market.GetAskBidQuotes() == expected_ask_bid_quotes);
     }
+
+    SECTION("Canceled best offers") {
+        Market market;
+        auto user_id1 = market.RegisterUser("user1", 0);
+
+        uint64_t offer_id1 =
+            market.PostOffer(*user_id1, OfferType::SELL, 70, 10);
+        uint64_t offer_id2 =
+            market.PostOffer(*user_id1, OfferType::SELL, 70, 10);
+        market.PostOffer(*user_id1, OfferType::SELL, 60, 10);
+        market.RemoveOffer(*user_id1, offer_id1);
+        market.RemoveOffer(*user_id1, offer_id2);
+
+        AskBidQuotesInfo expected_ask_bid_quotes = {.ask_quote = std::nullopt,
+                                                    .bid_quote = 60,
+                                                    .spread = std::nullopt};
+
+        REQUIRE(market.GetAskBidQuotes() == expected_ask_bid_quotes);
+        REQUIRE(market.GetBookLevels(OfferType::SELL) == 1);
+    }
 }
 
 TEST_CASE("Offer rejection") {
@@ -409,3 +467,1000 @@ TEST_CASE("Offer rejection") {
         REQUIRE(market.GetAskBidQuotes() == expected_ask_bid_quotes);
     }
 }
+
+struct RecordingEventSink final : public MarketEventSink {
+    void OnUserRegistered(uint64_t user_id, const std::string&,
+                          size_t) override {
+        registered_users.push_back(user_id);
+    }
+
+    void OnDeposit(uint64_t, Currency, size_t) override {}
+
+    void OnOfferAccepted(const Offer& offer) override {
+        accepted_offers.push_back(offer.GetId());
+    }
+
+    void OnTrade(const Deal& deal, const Offer&, const Offer&) override {
+        trades.push_back(deal.GetId());
+    }
+
+    void OnOfferCanceled(uint64_t, uint64_t offer_id) override {
+        canceled_offers.push_back(offer_id);
+    }
+
+    vector<uint64_t> registered_users;
+    vector<uint64_t> accepted_offers;
+    vector<uint64_t> trades;
+    vector<uint64_t> canceled_offers;
+};
+
+TEST_CASE("Market events") {
+    RecordingEventSink sink;
+    Market market(sink);
+    auto user_id1 = market.RegisterUser("user1", 0);
+    auto user_id2 = market.RegisterUser("user2", 0);
+    REQUIRE(sink.registered_users == vector<uint64_t>{*user_id1, *user_id2});
+
+    auto offer_id1 = market.PostOffer(*user_id1, OfferType::SELL, 60, 10);
+    auto offer_id2 = market.PostOffer(*user_id1, OfferType::SELL, 61, 10);
+    auto offer_id3 = market.PostOffer(*user_id2, OfferType::BUY, 61, 15);
+    REQUIRE(sink.accepted_offers ==
+            vector<uint64_t>{offer_id1, offer_id2, offer_id3});
+    REQUIRE(sink.trades.size() == 2);
+
+    REQUIRE(market.RemoveOffer(*user_id1, offer_id2));
+    REQUIRE_FALSE(market.RemoveOffer(*user_id1, offer_id1));
+    REQUIRE(sink.canceled_offers == vector<uint64_t>{offer_id2});
+}
+
+TEST_CASE("Restore market state") {
+    Market market;
+    market.RestoreUser(0, "user1", 0);
+    market.RestoreUser(1, "user2", 0);
+    market.RestoreDeal(0, 0, 1, 60, 10);
+    market.RestoreDeal(1, 1, 0, 65, 5);
+    market.RestoreOffer(1000, 0, OfferType::SELL, 70, 10);
+    market.RestoreOffer(1001, 1, OfferType::SELL, 70, 10);
+    market.RestoreOffer(1002, 1, OfferType::BUY, 50, 3);
+
+    Balance expected_balance1 = {.usd = -5, .rub = 275};
+    Balance expected_balance2 = {.usd = 5, .rub = -275};
+    AskBidQuotesInfo expected_ask_bid_quotes = {
+        .ask_quote = 50, .bid_quote = 70, .spread = 20};
+
+    REQUIRE(market.GetUserBalance(0) == expected_balance1);
+    REQUIRE(market.GetUserBalance(1) == expected_balance2);
+    REQUIRE(market.GetClosedDeals(0).size() == 2);
+    REQUIRE(market.GetActiveOffers(1).size() == 2);
+    REQUIRE(market.GetQuote() == 65);
+    REQUIRE(market.GetAskBidQuotes() == expected_ask_bid_quotes);
+
+    // Offer restored first keeps time priority
+    market.PostOffer(1, OfferType::BUY, 70, 10);
+    REQUIRE(market.GetActiveOffers(0).empty());
+    REQUIRE(market.GetActiveOffers(1).size() == 2);
+}
+
+TEST_CASE("Journal replay") {
+    auto path = filesystem::temp_directory_path() / "test_market.journal";
+    filesystem::remove(path);
+
+    Market market;
+    optional<uint64_t> user_id1;
+    optional<uint64_t> user_id2;
+    {
+        Journal journal(path);
+        MarketEventSinkList sinks;
+        sinks.Add(journal);
+        Market journaled_market(sinks);
+
+        user_id1 = journaled_market.RegisterUser("user1", 1);
+        user_id2 = journaled_market.RegisterUser("user2", 2);
+        journaled_market.DepositUSD(*user_id1, 100);
+        journaled_market.PostOffer(*user_id1, OfferType::SELL, 60, 10);
+        auto offer_id =
+            journaled_market.PostOffer(*user_id1, OfferType::SELL, 61, 10);
+        journaled_market.RemoveOffer(*user_id1, offer_id);
+        journaled_market.PostOffer(*user_id2, OfferType::BUY, 65, 15);
+        REQUIRE(journal.GetLastSeq() == 7);
+    }
+
+    REQUIRE(ReplayJournal(path, market) == 7);
+
+    Balance expected_balance1 = {.usd = 90, .rub = 600};
+    Balance expected_balance2 = {.usd = 10, .rub = -600};
+    AskBidQuotesInfo expected_ask_bid_quotes = {
+        .ask_quote = 65, .bid_quote = std::nullopt, .spread = std::nullopt};
+
+    REQUIRE(market.Login("user2", 2) == user_id2);
+    REQUIRE(market.GetUserBalance(*user_id1) == expected_balance1);
+    REQUIRE(market.GetUserBalance(*user_id2) == expected_balance2);
+    REQUIRE(market.GetActiveOffers(*user_id1).empty());
+    REQUIRE(market.GetActiveOffers(*user_id2).size() == 1);
+    REQUIRE(market.GetQuote() == 60);
+    REQUIRE(market.GetAskBidQuotes() == expected_ask_bid_quotes);
+
+    // Torn record at the end is dropped when journal is reopened
+    auto size = filesystem::file_size(path);
+    {
+        ofstream file(path, ios::app | ios::binary);
+        file << "torn";
+    }
+    REQUIRE(Journal(path).GetLastSeq() == 7);
+    REQUIRE(filesystem::file_size(path) == size);
+
+    filesystem::remove(path);
+}
+
+TEST_CASE("Journal tail replay") {
+    auto path = filesystem::temp_directory_path() / "test_market.journal";
+    filesystem::remove(path);
+
+    optional<uint64_t> user_id1;
+    optional<uint64_t> user_id2;
+    uint64_t offer_id1;
+    uint64_t offer_id2;
+    uint64_t next_deal_id;
+    {
+        Journal journal(path);
+        MarketEventSinkList sinks;
+        sinks.Add(journal);
+        Market journaled_market(sinks);
+
+        user_id1 = journaled_market.RegisterUser("user1", 1);
+        user_id2 = journaled_market.RegisterUser("user2", 2);
+        offer_id1 = journaled_market.PostOffer(*user_id1, OfferType::SELL, 60,
+                                               10);
+        offer_id2 = journaled_market.PostOffer(*user_id1, OfferType::SELL, 61,
+                                               10);
+        journaled_market.DepositRUB(*user_id1, 50);
+        journaled_market.RemoveOffer(*user_id1, offer_id2);
+        next_deal_id = Deal::GetNextId();
+
+        // Commands db has not committed
+        journaled_market.PostOffer(*user_id2, OfferType::BUY, 60, 4);
+        journaled_market.DepositUSD(*user_id2, 100);
+        journaled_market.RemoveOffer(*user_id1, offer_id1);
+        journaled_market.PostOffer(*user_id2, OfferType::BUY, 65, 3);
+    }
+
+    // State restored from db holding commands up to the first cancel,
+    // without the deposit
+    Market market;
+    market.RestoreUser(*user_id1, "user1", 1);
+    market.RestoreUser(*user_id2, "user2", 2);
+    market.RestoreOffer(offer_id1, *user_id1, OfferType::SELL, 60, 10);
+    UserData::SetNextId(*user_id2 + 1);
+    Offer::SetNextId(offer_id2 + 1);
+    Deal::SetNextId(next_deal_id);
+
+    // Deposits are not stored in db, ones before the tail are applied too
+    REQUIRE(ReplayJournalTail(path, market) == 4);
+    Balance expected_balance1 = {.usd = -4, .rub = 290};
+    Balance expected_balance2 = {.usd = 104, .rub = -240};
+    REQUIRE(market.GetUserBalance(*user_id1) == expected_balance1);
+    REQUIRE(market.GetUserBalance(*user_id2) == expected_balance2);
+    REQUIRE(market.GetActiveOffers(*user_id1).empty());
+    REQUIRE(market.GetActiveOffers(*user_id2).size() == 1);
+    REQUIRE(market.GetQuote() == 60);
+
+    // Db that caught up lacks only deposits
+    Market caught_up_market;
+    caught_up_market.RestoreUser(*user_id1, "user1", 1);
+    caught_up_market.RestoreUser(*user_id2, "user2", 2);
+    caught_up_market.RestoreDeal(next_deal_id, *user_id1, *user_id2, 60, 4);
+    caught_up_market.RestoreOffer(offer_id2 + 2, *user_id2, OfferType::BUY,
+                                  65, 3);
+    UserData::SetNextId(*user_id2 + 1);
+    Offer::SetNextId(offer_id2 + 3);
+    Deal::SetNextId(next_deal_id + 1);
+    REQUIRE(ReplayJournalTail(path, caught_up_market) == 0);
+    REQUIRE(caught_up_market.GetUserBalance(*user_id1) == expected_balance1);
+    REQUIRE(caught_up_market.GetUserBalance(*user_id2) == expected_balance2);
+
+    filesystem::remove(path);
+}
+
+TEST_CASE("Journal replay from offset") {
+    auto path = filesystem::temp_directory_path() / "test_market.journal";
+    filesystem::remove(path);
+
+    Market market;
+    MarketSnapshot snapshot;
+    uint64_t last_seq;
+    {
+        Journal journal(path);
+        MarketEventSinkList sinks;
+        sinks.Add(journal);
+        Market journaled_market(sinks);
+
+        auto user_id1 = journaled_market.RegisterUser("user1", 1);
+        auto user_id2 = journaled_market.RegisterUser("user2", 2);
+        journaled_market.PostOffer(*user_id1, OfferType::SELL, 60, 10);
+        snapshot = journaled_market.MakeSnapshot();
+        snapshot.header.journal_seq = journal.GetLastSeq();
+        snapshot.header.journal_offset = journal.GetSize();
+
+        journaled_market.PostOffer(*user_id2, OfferType::BUY, 60, 4);
+        journaled_market.DepositRUB(*user_id2, 100);
+        last_seq = journal.GetLastSeq();
+        journal.Flush();
+        REQUIRE(journal.GetSize() == filesystem::file_size(path));
+    }
+    uint64_t seq = snapshot.header.journal_seq;
+    uint64_t offset = snapshot.header.journal_offset;
+
+    // Wrong offset falls back to reading from the first record
+    market.RestoreSnapshot(snapshot.GetView());
+    REQUIRE(ReplayJournal(path, market, seq, offset + 1) == 2);
+    REQUIRE(market.GetQuote() == 60);
+
+    // Records before offset are not read: replay from the first record
+    // stops at the damaged one
+    {
+        fstream file(path, ios::in | ios::out | ios::binary);
+        file.seekp(offset - 1);
+        file.put('\xff');
+    }
+    Market restored;
+    restored.RestoreSnapshot(snapshot.GetView());
+    REQUIRE(ReplayJournal(path, restored, seq, offset) == 2);
+    REQUIRE(restored.GetQuote() == 60);
+    REQUIRE(Journal(path, seq, offset).GetLastSeq() == last_seq);
+    REQUIRE(Journal(path, last_seq, filesystem::file_size(path))
+                .GetLastSeq() == last_seq);
+
+    filesystem::remove(path);
+}
+
+TEST_CASE("Snapshot round trip") {
+    auto path = filesystem::temp_directory_path() / "test_market.snapshot";
+
+    Market market;
+    auto user_id1 = market.RegisterUser("user1", 1);
+    auto user_id2 = market.RegisterUser("user2", 2);
+    auto user_id3 = market.RegisterUser("user3", 3);
+    market.DepositUSD(*user_id1, 100);
+    market.PostOffer(*user_id1, OfferType::SELL, 60, 10);
+    market.PostOffer(*user_id2, OfferType::BUY, 60, 4);
+    market.PostOffer(*user_id1, OfferType::SELL, 62, 5);
+    market.PostOffer(*user_id3, OfferType::SELL, 62, 5);
+    auto offer_id = market.PostOffer(*user_id3, OfferType::BUY, 50, 5);
+    market.RemoveOffer(*user_id3, offer_id);
+    market.PostOffer(*user_id2, OfferType::BUY, 55, 3);
+
+    MarketSnapshot snapshot = market.MakeSnapshot();
+    snapshot.header.journal_seq = 42;
+    snapshot.header.journal_offset = 4096;
+    WriteSnapshot(snapshot.GetView(), path);
+
+    // Version 1 has no journal offset
+    string encoded;
+    EncodeSnapshot(snapshot.GetView(), encoded);
+    uint32_t version = 1;
+    encoded.replace(offsetof(SnapshotHeader, version), sizeof(version),
+                    reinterpret_cast<const char*>(&version), sizeof(version));
+    encoded.erase(offsetof(SnapshotHeader, journal_offset), sizeof(uint64_t));
+    SnapshotView old_view = ParseSnapshot(encoded);
+    REQUIRE(old_view.header.journal_seq == 42);
+    REQUIRE(old_view.header.journal_offset == 0);
+    REQUIRE(old_view.offers.size() == 4);
+
+    Market restored;
+    {
+        MappedSnapshot mapped(path);
+        const SnapshotView& loaded = mapped.GetView();
+        REQUIRE(loaded.header.journal_seq == 42);
+        REQUIRE(loaded.header.journal_offset == 4096);
+        REQUIRE(loaded.users.size() == 3);
+        REQUIRE(loaded.offers.size() == 4);
+        REQUIRE(loaded.deals.size() == 1);
+        restored.RestoreSnapshot(loaded);
+    }
+    filesystem::resize_file(path, filesystem::file_size(path) - 1);
+    REQUIRE_THROWS_AS(MappedSnapshot(path), runtime_error);
+    filesystem::remove(path);
+
+    REQUIRE(restored.Login("user3", 3) == user_id3);
+    for (auto user_id : {*user_id1, *user_id2, *user_id3}) {
+        REQUIRE(restored.GetUserBalance(user_id) ==
+                market.GetUserBalance(user_id));
+        REQUIRE(restored.GetActiveOffers(user_id).size() ==
+                market.GetActiveOffers(user_id).size());
+        REQUIRE(restored.GetClosedDeals(user_id).size() ==
+                market.GetClosedDeals(user_id).size());
+    }
+    REQUIRE(restored.GetQuote() == market.GetQuote());
+    REQUIRE(restored.GetAskBidQuotes() == market.GetAskBidQuotes());
+
+    // Time priority of restored offers is kept: user1 sold at 62 first
+    restored.PostOffer(*user_id2, OfferType::BUY, 62, 11);
+    Balance expected_balance1 = {.usd = 85, .rub = 240 + 360 + 310};
+    REQUIRE(restored.GetUserBalance(*user_id1) == expected_balance1);
+    REQUIRE(restored.GetActiveOffers(*user_id1).empty());
+    REQUIRE(restored.GetActiveOffers(*user_id3).size() == 1);
+}
+
+TEST_CASE("Replicated journal") {
+    auto primary_path =
+        filesystem::temp_directory_path() / "test_primary.journal";
+    auto replica_path =
+        filesystem::temp_directory_path() / "test_replica.journal";
+    filesystem::remove(primary_path);
+    filesystem::remove(replica_path);
+
+    struct RecordCollector final : public JournalListener {
+        void OnRecordAppended(const JournalRecord&,
+                              std::string_view frame) override {
+            JournalRecord record;
+            REQUIRE(DecodeJournalRecord(frame, record) == frame.size());
+            records.push_back(record);
+        }
+
+        vector<JournalRecord> records;
+    };
+
+    RecordCollector collector;
+    Journal primary_journal(primary_path);
+    primary_journal.SetListener(&collector);
+    MarketEventSinkList sinks;
+    sinks.Add(primary_journal);
+    Market primary(sinks);
+
+    auto user_id1 = primary.RegisterUser("user1", 1);
+    auto user_id2 = primary.RegisterUser("user2", 2);
+    primary.PostOffer(*user_id1, OfferType::SELL, 60, 10);
+    MarketSnapshot snapshot = primary.MakeSnapshot();
+    snapshot.header.journal_seq = primary_journal.GetLastSeq();
+    collector.records.clear();
+
+    primary.DepositRUB(*user_id2, 1000);
+    auto offer_id = primary.PostOffer(*user_id2, OfferType::BUY, 50, 5);
+    primary.RemoveOffer(*user_id2, offer_id);
+    primary.PostOffer(*user_id2, OfferType::BUY, 65, 4);
+    REQUIRE(collector.records.size() == 4);
+
+    // Id counters are shared, replica takes them from snapshot
+    Market replica;
+    replica.RestoreSnapshot(snapshot.GetView());
+    {
+        Journal replica_journal(replica_path);
+        replica_journal.StartAfter(snapshot.header.journal_seq);
+        for (const JournalRecord& record : collector.records) {
+            replica_journal.AppendReplicated(record);
+            ApplyJournalRecord(replica, record);
+        }
+        REQUIRE(replica_journal.GetLastSeq() == primary_journal.GetLastSeq());
+        REQUIRE_THROWS_AS(
+            replica_journal.AppendReplicated(collector.records.back()),
+            runtime_error);
+    }
+
+    for (auto user_id : {*user_id1, *user_id2}) {
+        REQUIRE(replica.GetUserBalance(user_id) ==
+                primary.GetUserBalance(user_id));
+        REQUIRE(replica.GetActiveOffers(user_id).size() ==
+                primary.GetActiveOffers(user_id).size());
+    }
+    REQUIRE(replica.GetQuote() == 60);
+
+    // Restarted replica recovers from snapshot and its own journal
+    Market restarted;
+    restarted.RestoreSnapshot(snapshot.GetView());
+    REQUIRE(ReplayJournal(replica_path, restarted,
+                          snapshot.header.journal_seq) == 4);
+    REQUIRE(restarted.GetUserBalance(*user_id2) ==
+            primary.GetUserBalance(*user_id2));
+
+    filesystem::remove(primary_path);
+    filesystem::remove(replica_path);
+}
+
+static void RemoveDb(const filesystem::path& path) {
+    for (const char* suffix : {"", "-wal", "-shm"}) {
+        filesystem::remove(path.string() + suffix);
+    }
+}
+
+static void ExecuteSql(const filesystem::path& path, const string& query) {
+    sqlite3* db;
+    REQUIRE(sqlite3_open(path.c_str(), &db) == SQLITE_OK);
+    REQUIRE(sqlite3_exec(db, query.c_str(), NULL, NULL, NULL) == SQLITE_OK);
+    sqlite3_close(db);
+}
+
+// Values of column in rows of query result
+static vector<string> QuerySql(const filesystem::path& path,
+                               const string& query, int column = 0) {
+    sqlite3* db;
+    sqlite3_stmt* stmt;
+    REQUIRE(sqlite3_open(path.c_str(), &db) == SQLITE_OK);
+    REQUIRE(sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, NULL) ==
+            SQLITE_OK);
+    vector<string> rows;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        rows.emplace_back(
+            reinterpret_cast<const char*>(sqlite3_column_text(stmt, column)));
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+
+    return rows;
+}
+
+TEST_CASE("DB schema migration") {
+    auto path = filesystem::temp_directory_path() / "test_market.db";
+    RemoveDb(path);
+
+    // Db written before schema versions, offers have no state columns
+    ExecuteSql(path,
+               "CREATE TABLE User (ID INT PRIMARY KEY NOT NULL,"
+               "  USERNAME TEXT NOT NULL, PW_HASH INT NOT NULL);"
+               "CREATE TABLE Deal (ID INT PRIMARY KEY NOT NULL,"
+               "  SELLER_ID INT NOT NULL, BUYER_ID INT NOT NULL,"
+               "  AMOUNT INT NOT NULL, PRICE INT NOT NULL);"
+               "CREATE TABLE Offer (ID INT PRIMARY KEY NOT NULL,"
+               "  OWNER_ID INT NOT NULL, TYPE BOOL NOT NULL,"
+               "  AMOUNT INT NOT NULL, PRICE INT NOT NULL);"
+               "CREATE TABLE SchemaVersion (VERSION INT NOT NULL);"
+               "INSERT INTO SchemaVersion VALUES(1);"
+               "INSERT INTO User VALUES(0, 'user1', 1);"
+               "INSERT INTO Offer VALUES(0, 0, 0, 10, 60);");
+
+    std::ostringstream log;
+    {
+        DBManager db_manager(log, path.string());
+        auto offers = db_manager.GetUserOffers(0);
+        REQUIRE(offers.size() == 1);
+        REQUIRE(offers[0].type == OfferType::SELL);
+        REQUIRE(offers[0].amount == 10);
+
+        // State of old offers is unknown, they are not restored
+        size_t active_count = 0;
+        db_manager.LoadActiveOffers(
+            [&active_count](const OfferRecord&) { ++active_count; });
+        REQUIRE(active_count == 0);
+
+        db_manager.AddOffer(1, 0, OfferType::BUY, 5, 50);
+        db_manager.Flush();
+    }
+    Logger::Flush();
+    REQUIRE(log.str().find("DB schema migrated to version 2") !=
+            string::npos);
+    REQUIRE(log.str().find("DB schema migrated to version 3") !=
+            string::npos);
+    REQUIRE(QuerySql(path, "SELECT MAX(VERSION) FROM SchemaVersion;") ==
+            vector<string>{"3"});
+    REQUIRE(QuerySql(path, "SELECT ID FROM Offer WHERE ACTIVE;") ==
+            vector<string>{"1"});
+
+    // Migrated db is opened as is
+    log.str("");
+    {
+        DBManager db_manager(log, path.string());
+        REQUIRE(db_manager.GetUserOffers(0).size() == 2);
+    }
+    Logger::Flush();
+    REQUIRE(log.str().find("migrated") == string::npos);
+
+    // Db of newer version is refused
+    ExecuteSql(path, "UPDATE SchemaVersion SET VERSION = 99;");
+    REQUIRE_THROWS_AS(DBManager(log, path.string()), runtime_error);
+    Logger::Flush();
+
+    RemoveDb(path);
+}
+
+TEST_CASE("DB history queries") {
+    auto path = filesystem::temp_directory_path() / "test_market.db";
+    RemoveDb(path);
+
+    std::ostringstream log;
+    {
+        DBManager db_manager(log, path.string());
+        db_manager.AddUser(0, "user1", 1);
+        db_manager.AddUser(1, "user2", 2);
+        db_manager.AddOffer(0, 0, OfferType::SELL, 10, 60);
+        db_manager.AddOffer(1, 1, OfferType::BUY, 4, 60);
+        db_manager.AddOffer(2, 0, OfferType::BUY, 3, 60);
+        db_manager.UpdateOffer(0, 3);
+        db_manager.UpdateOffer(1, 0);
+        db_manager.AddDeal(0, 0, 1, 4, 60);
+        // Self-trade: user is both seller and buyer
+        db_manager.AddDeal(1, 0, 0, 3, 60);
+        db_manager.UpdateOffer(0, 0);
+        db_manager.UpdateOffer(2, 0);
+
+        auto offers = db_manager.GetUserOffers(0);
+        REQUIRE(offers.size() == 2);
+        REQUIRE(offers[0].id == 0);
+        REQUIRE(offers[0].amount == 10);
+        REQUIRE(offers[1].id == 2);
+        REQUIRE(db_manager.GetUserOffers(1).size() == 1);
+        REQUIRE(db_manager.GetUserOffers(2).empty());
+
+        auto deals = db_manager.GetUserDeals(0);
+        REQUIRE(deals.size() == 2);
+        REQUIRE(deals[0].id == 0);
+        REQUIRE(deals[1].id == 1);
+        deals = db_manager.GetUserDeals(1);
+        REQUIRE(deals.size() == 1);
+        REQUIRE(deals[0].id == 0);
+
+        std::ostringstream output;
+        PrintUserHistory(db_manager, 0, output);
+        REQUIRE(output.str() ==
+                "{\"BUY\":[{\"AMOUNT\":3,\"OFFER_ID\":2,\"PRICE\":60}],"
+                "\"SELL\":[{\"AMOUNT\":10,\"OFFER_ID\":0,\"PRICE\":60}],"
+                "\"TYPE\":\"Active\"}\n"
+                "{\"BUY\":[],"
+                "\"BUY-SELL\":[{\"AMOUNT\":3,\"DEAL_ID\":1,\"PRICE\":60}],"
+                "\"SELL\":[{\"AMOUNT\":4,\"DEAL_ID\":0,\"PRICE\":60}],"
+                "\"TYPE\":\"Deal\"}\n");
+    }
+    Logger::Flush();
+
+    // Lookups by user are served by indexes instead of table scans, queries
+    // are the same as in DBManager
+    auto plan = QuerySql(path,
+                         "EXPLAIN QUERY PLAN "
+                         "SELECT ID, OWNER_ID, TYPE, AMOUNT, PRICE FROM Offer "
+                         "WHERE OWNER_ID = 0 ORDER BY ID;",
+                         3);
+    REQUIRE(plan.size() == 1);
+    REQUIRE(plan[0].find("USING INDEX OfferOwnerIndex") != string::npos);
+    plan = QuerySql(path,
+                    "EXPLAIN QUERY PLAN "
+                    "SELECT ID, SELLER_ID, BUYER_ID, AMOUNT, PRICE FROM Deal "
+                    "WHERE SELLER_ID = 0 "
+                    "UNION ALL "
+                    "SELECT ID, SELLER_ID, BUYER_ID, AMOUNT, PRICE FROM Deal "
+                    "WHERE BUYER_ID = 0 AND SELLER_ID != 0 "
+                    "ORDER BY ID;",
+                    3);
+    string plan_text;
+    for (const string& row : plan) {
+        REQUIRE(row.find("SCAN") == string::npos);
+        plan_text += row + '\n';
+    }
+    REQUIRE(plan_text.find("USING INDEX DealSellerIndex") != string::npos);
+    REQUIRE(plan_text.find("USING INDEX DealBuyerIndex") != string::npos);
+
+    RemoveDb(path);
+}
+
+TEST_CASE("Latency histogram") {
+    using Histogram = LatencyHistogram;
+
+    // Small values are exact, larger ones are bounded by relative error
+    REQUIRE(Histogram::GetBucketIndex(7) == 7);
+    REQUIRE(Histogram::GetBucketUpperBound(Histogram::GetBucketIndex(7)) == 7);
+    for (uint64_t value : {16ull, 17ull, 1000ull, 123456789ull}) {
+        uint64_t upper_bound =
+            Histogram::GetBucketUpperBound(Histogram::GetBucketIndex(value));
+        REQUIRE(upper_bound >= value);
+        REQUIRE(upper_bound - value <= value / Histogram::sub_bucket_count);
+    }
+    REQUIRE(Histogram::GetBucketIndex(UINT64_MAX) ==
+            Histogram::bucket_count - 1);
+
+    Histogram histogram;
+    REQUIRE(histogram.GetQuantile(0.5) == 0);
+    for (uint64_t value = 1; value <= 1000; ++value) {
+        histogram.Record(value);
+    }
+    REQUIRE(histogram.GetCount() == 1000);
+    REQUIRE(histogram.GetSum() == 500500);
+    REQUIRE(histogram.GetQuantile(0.5) >= 500);
+    REQUIRE(histogram.GetQuantile(0.5) <= 500 + 500 / 16);
+    REQUIRE(histogram.GetQuantile(0.999) >= 999);
+    REQUIRE(histogram.GetQuantile(1) >= 1000);
+}
+
+TEST_CASE("Asynchronous logger") {
+    std::ostringstream output;
+    Logger logger(output);
+    logger.Log(LogType::INFO, "first");
+    logger.Log<LogType::WARNING>("second {}", 2);
+    // Filtered at compile time with default level
+    logger.Log<LogType::DEBUG>("third {}", 3);
+    std::thread([&logger] { logger.Log(LogType::ERROR, "other thread"); })
+        .join();
+    Logger::Flush();
+
+    std::string log = output.str();
+    REQUIRE(log.find(" | INFO | first;\n") != std::string::npos);
+    REQUIRE(log.find(" | WARNING | second 2;\n") != std::string::npos);
+    REQUIRE(log.find("third") == std::string::npos);
+    REQUIRE(log.find("| ERROR | other thread;\n") != std::string::npos);
+    REQUIRE(Logger::GetDroppedCount() == 0);
+}
+
+TEST_CASE("Binary protocol") {
+    Request post_offer{.kind = RequestKind::POST_OFFER,
+                       .offer_type = OfferType::SELL,
+                       .price = 5,
+                       .amount = 30};
+    Request login{
+        .kind = RequestKind::LOGIN, .pw_hash = 12345, .username = "user"};
+    std::string input;
+    AppendBinaryRequest(post_offer, input);
+    AppendBinaryRequest(login, input);
+    Request parsed;
+    REQUIRE(ParseRequest(RequestToJson(post_offer), parsed) ==
+            RequestError::NONE);
+    REQUIRE(parsed == post_offer);
+
+    // Messages are decoded only once they are complete
+    RequestKind kind;
+    std::string_view payload;
+    REQUIRE(DecodeBinaryMessage(
+                std::string_view(input).substr(0, binary_header_size + 3),
+                kind, payload) == 0);
+    size_t size = DecodeBinaryMessage(input, kind, payload);
+    Request request;
+    REQUIRE(DecodeBinaryRequest(kind, payload, request) == RequestError::NONE);
+    REQUIRE(request == post_offer);
+    REQUIRE(DecodeBinaryMessage(std::string_view(input).substr(size), kind,
+                                payload) == input.size() - size);
+    REQUIRE(DecodeBinaryRequest(kind, payload, request) == RequestError::NONE);
+    REQUIRE(request == login);
+    REQUIRE(DecodeBinaryRequest(kind, payload.substr(1), request) ==
+            RequestError::MALFORMED);
+
+    // Strings must be utf-8 to be representable in json protocol
+    for (std::string username :
+         {"\xff", "\xc0\xaf", "\xed\xa0\x80", "\xe2\x82"}) {
+        std::string message;
+        AppendBinaryRequest(
+            Request{.kind = RequestKind::REGISTRATION, .username = username},
+            message);
+        REQUIRE(DecodeBinaryMessage(message, kind, payload) == message.size());
+        REQUIRE(DecodeBinaryRequest(kind, payload, request) ==
+                RequestError::MALFORMED);
+    }
+    std::string message;
+    AppendBinaryRequest(Request{.kind = RequestKind::LOGIN,
+                                .username = "\xd0\xbf\xf0\x9f\x98\x80"},
+                        message);
+    REQUIRE(DecodeBinaryMessage(message, kind, payload) == message.size());
+    REQUIRE(DecodeBinaryRequest(kind, payload, request) == RequestError::NONE);
+
+    // Replies are decoded to json of json protocol
+    std::string reply;
+    EncodeListSize(2, reply);
+    EncodeDealEntry(DealSide::BUY, 10, 1, reply);
+    EncodeDealEntry(DealSide::BUY_SELL, 11, 2, reply);
+    REQUIRE(DecodeBinaryReply(RequestKind::CLOSED_DEALS, reply) ==
+            nlohmann::json::parse(
+                R"({"TYPE":"Deal","BUY":[{"PRICE":10,"AMOUNT":1}],"SELL":[],
+                    "BUY-SELL":[{"PRICE":11,"AMOUNT":2}]})"));
+    reply.clear();
+    EncodeQuotesReply(10, std::nullopt, 9, std::nullopt, reply);
+    REQUIRE(DecodeBinaryReply(RequestKind::QUOTES, reply) ==
+            nlohmann::json::parse(R"({"TYPE":"Quotes","QUOTE":10,
+                "ASK_QUOTE":null,"BID_QUOTE":9,"SPREAD":null})"));
+    reply.pop_back();
+    REQUIRE_THROWS(DecodeBinaryReply(RequestKind::QUOTES, reply));
+}
+
+TEST_CASE("Hot request parsing") {
+    for (const char* message :
+         {R"({"TYPE":"PostOffer","USER_ID":3,"OFFER_SIDE":"BUY","PRICE":10,
+              "AMOUNT":5})",
+          R"( { "OFFER_ID" : 18446744073709551615, "TYPE" : "Cancel",
+              "USER_ID" : 0 } )",
+          R"({"TYPE":"Quotes","USER_ID":1})",
+          R"({"TYPE":"Cancel","OFFER_ID":2})"}) {
+        Request request;
+        REQUIRE(ParseHotRequest(message, request));
+        Request parsed;
+        REQUIRE(ParseRequest(nlohmann::json::parse(message), parsed) ==
+                RequestError::NONE);
+        REQUIRE(request == parsed);
+    }
+
+    // Everything else is left to json parser
+    for (const char* message :
+         {R"({"TYPE":"Log","USERNAME":"user","PW_HASH":1})",
+          R"({"TYPE":"Cancel","USER_ID":1})",
+          R"({"TYPE":"Cancel","USER_ID":1,"OFFER_ID":1.5})",
+          R"({"TYPE":"Cancel","USER_ID":-1,"OFFER_ID":1})",
+          R"({"TYPE":"Cancel","USER_ID":01,"OFFER_ID":1})",
+          R"({"TYPE":"Cancel","USER_ID":1,"USER_ID":2,"OFFER_ID":1})",
+          R"({"TYPE":"Quotes"} x)",
+          R"({"TYPE":"Quotes","EXTRA":[]})",
+          R"({"TYPE":"PostOffer","USER_ID":3,"OFFER_SIDE":"BUY",
+              "PRICE":3000000000,"AMOUNT":5})",
+          R"({"TYPE":"PostOffer","OFFER_SIDE":"HOLD","PRICE":1,"AMOUNT":5})",
+          R"({"TYPE":"PostOffer","OFFER_SIDE":"BUY","PRICE":1,"AMOUNT":0})"}) {
+        Request request;
+        REQUIRE_FALSE(ParseHotRequest(message, request));
+    }
+}
+
+TEST_CASE("Request kind lookup") {
+    for (size_t kind = 0; kind < static_cast<size_t>(RequestKind::UNKNOWN);
+         ++kind) {
+        REQUIRE(GetRequestKind(GetRequestKindName(
+                    static_cast<RequestKind>(kind))) ==
+                static_cast<RequestKind>(kind));
+    }
+    for (const char* type : {"", "R", "Regs", "reg", "Unknown", "Post"}) {
+        REQUIRE(GetRequestKind(type) == RequestKind::UNKNOWN);
+    }
+}
+
+TEST_CASE("User requests") {
+    for (RequestKind kind : {RequestKind::REGISTRATION, RequestKind::LOGIN,
+                             RequestKind::QUOTES, RequestKind::METRICS,
+                             RequestKind::PROTOCOL, RequestKind::UNKNOWN}) {
+        REQUIRE_FALSE(IsUserRequest(kind));
+    }
+    REQUIRE(IsUserRequest(RequestKind::BALANCE));
+    REQUIRE(IsUserRequest(RequestKind::CANCEL));
+
+    // User is known from connection, captured requests keep it
+    Request balance;
+    REQUIRE(ParseJsonRequest(R"({"TYPE":"Balance"})", balance) ==
+            RequestError::NONE);
+    REQUIRE(balance.kind == RequestKind::BALANCE);
+    REQUIRE(balance.user_id == 0);
+    balance.user_id = 5;
+    REQUIRE(RequestToJson(balance).at(json_field::USER_ID) == 5);
+    Request parsed;
+    REQUIRE(ParseRequest(RequestToJson(balance), parsed) == RequestError::NONE);
+    REQUIRE(parsed == balance);
+    Request quotes{.kind = RequestKind::QUOTES};
+    REQUIRE_FALSE(RequestToJson(quotes).contains(json_field::USER_ID));
+}
+
+TEST_CASE("Request validation") {
+    const std::vector<std::pair<std::string, RequestError>> messages = {
+        {"", RequestError::MALFORMED},
+        {R"({"TYPE":"Balance")", RequestError::MALFORMED},
+        {R"(["Balance"])", RequestError::MALFORMED},
+        {R"({"TYPE":5})", RequestError::INVALID_FIELD},
+        {R"({"TYPE":"Withdraw"})", RequestError::UNKNOWN_TYPE},
+        {R"({"TYPE":"Log","USERNAME":"user"})", RequestError::INVALID_FIELD},
+        {R"({"TYPE":"Log","USERNAME":"user","PW_HASH":-1})",
+         RequestError::INVALID_FIELD},
+        {R"({"TYPE":"Cancel","OFFER_ID":"1"})", RequestError::INVALID_FIELD},
+        {R"({"TYPE":"PostOffer","OFFER_SIDE":"BUY","PRICE":1.5,"AMOUNT":1})",
+         RequestError::INVALID_FIELD},
+        {R"({"TYPE":"PostOffer","OFFER_SIDE":"BUY","PRICE":-1,"AMOUNT":1})",
+         RequestError::INVALID_FIELD},
+        {R"({"TYPE":"PostOffer","OFFER_SIDE":"BUY","PRICE":1,"AMOUNT":-1})",
+         RequestError::INVALID_FIELD},
+        {R"({"TYPE":"PostOffer","OFFER_SIDE":"SELL","PRICE":1,
+             "AMOUNT":1,"USER_ID":"x"})",
+         RequestError::NONE},
+    };
+    for (const auto& [message, expected_error] : messages) {
+        Request request{.kind = RequestKind::METRICS};
+        REQUIRE(ParseJsonRequest(message, request) == expected_error);
+        if (expected_error != RequestError::NONE) {
+            // Request is left as it was
+            REQUIRE(request == Request{.kind = RequestKind::METRICS});
+        }
+    }
+
+    Request request;
+    REQUIRE(DecodeBinaryRequest(RequestKind::PROTOCOL, "", request) ==
+            RequestError::UNKNOWN_TYPE);
+    REQUIRE(DecodeBinaryRequest(static_cast<RequestKind>(200), "", request) ==
+            RequestError::UNKNOWN_TYPE);
+    std::string message;
+    AppendBinaryRequest(
+        Request{.kind = RequestKind::POST_OFFER, .price = 10, .amount = 0},
+        message);
+    RequestKind kind;
+    std::string_view payload;
+    DecodeBinaryMessage(message, kind, payload);
+    REQUIRE(DecodeBinaryRequest(kind, payload, request) ==
+            RequestError::INVALID_FIELD);
+    REQUIRE_THROWS_AS(
+        AppendBinaryRequest(nlohmann::json::parse(R"({"TYPE":"Cancel"})"),
+                            message),
+        std::invalid_argument);
+    REQUIRE(GetRequestErrorText(RequestError::NOT_AUTHENTICATED) ==
+            "ERROR: Not authenticated");
+}
+
+TEST_CASE("Json writer") {
+    std::string text = "prefix";
+    JsonWriter writer(text);
+    writer.BeginObject();
+    writer.Key("A");
+    writer.BeginArray();
+    for (int value : {-1, 0, 7}) {
+        writer.BeginObject();
+        writer.Key("V");
+        writer.Integer(value);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.Key("B");
+    writer.BeginArray();
+    writer.EndArray();
+    writer.Key("C");
+    writer.String("quote \" slash \\ tab \t bell \a \x1f");
+    writer.Key("D");
+    writer.Optional(std::optional<uint64_t>());
+    writer.Key("E");
+    writer.Optional(std::optional<uint64_t>(UINT64_MAX));
+    writer.Key("F");
+    writer.Bool(false);
+    writer.EndObject();
+
+    nlohmann::json expected = {
+        {"A", {{{"V", -1}}, {{"V", 0}}, {{"V", 7}}}},
+        {"B", nlohmann::json::array()},
+        {"C", "quote \" slash \\ tab \t bell \a \x1f"},
+        {"D", nullptr},
+        {"E", UINT64_MAX},
+        {"F", false}};
+    REQUIRE(text == "prefix" + expected.dump());
+}
+
+// Reference block is output of LZ4_compress_default of liblz4 1.9.4 for the
+// text, LZ4_decompress_safe of the same version accepts block of bundled
+// compressor. Text has long literals, overlapping match and long matches.
+TEST_CASE("LZ4 compatibility") {
+    std::string text = "Literals longer than fifteen bytes, " +
+                       std::string(40, '=');
+    for (int i = 0; i < 3; ++i) {
+        text += R"({"AMOUNT":1,"PRICE":10},{"AMOUNT":2,"PRICE":10},)";
+    }
+    text += "end";
+    std::string reference_block(
+        "\xff\x16\x4c\x69\x74\x65\x72\x61\x6c\x73\x20\x6c"
+        "\x6f\x6e\x67\x65\x72\x20\x74\x68\x61\x6e\x20\x66"
+        "\x69\x66\x74\x65\x65\x6e\x20\x62\x79\x74\x65\x73"
+        "\x2c\x20\x3d\x01\x00\x14\xf6\x09\x7b\x22\x41\x4d"
+        "\x4f\x55\x4e\x54\x22\x3a\x31\x2c\x22\x50\x52\x49"
+        "\x43\x45\x22\x3a\x31\x30\x7d\x2c\x18\x00\x1f\x32"
+        "\x18\x00\x04\x0f\x30\x00\x41\x50\x7d\x2c\x65\x6e"
+        "\x64",
+        85);
+
+    std::string restored;
+    REQUIRE(Lz4Decompress(reference_block, text.size(), restored));
+    REQUIRE(restored == text);
+
+    std::string block;
+    Lz4Compress(text, block);
+    REQUIRE(block == reference_block);
+}
+
+TEST_CASE("Reply compression") {
+    std::string text;
+    for (int i = 0; i < 200; ++i) {
+        text += R"({"AMOUNT":)" + std::to_string(i % 7) + R"(,"PRICE":10},)";
+    }
+
+    std::string message = "prefix";
+    REQUIRE(AppendCompressedMessage(RequestKind::CLOSED_DEALS, text, message));
+    RequestKind kind;
+    std::string_view payload;
+    REQUIRE(DecodeBinaryMessage(std::string_view(message).substr(6), kind,
+                                payload) == message.size() - 6);
+    REQUIRE(TakeCompressionFlag(kind));
+    REQUIRE(kind == RequestKind::CLOSED_DEALS);
+    REQUIRE(payload.size() < text.size() / 4);
+    std::string restored;
+    REQUIRE(DecompressPayload(payload, restored));
+    REQUIRE(restored == text);
+
+    // Compressed block of other size or cut short is rejected
+    std::string block;
+    Lz4Compress(text, block);
+    restored.clear();
+    REQUIRE_FALSE(Lz4Decompress(block, text.size() - 1, restored));
+    REQUIRE_FALSE(Lz4Decompress(block, text.size() + 1, restored));
+    REQUIRE_FALSE(Lz4Decompress(block.substr(0, block.size() - 1),
+                                text.size(), restored));
+    REQUIRE(restored.empty());
+
+    std::string short_text = "Offer was posted.";
+    message.clear();
+    REQUIRE_FALSE(
+        AppendCompressedMessage(RequestKind::POST_OFFER, short_text, message));
+    REQUIRE(message.empty());
+
+    Request login{.kind = RequestKind::LOGIN,
+                  .pw_hash = 5,
+                  .username = "user",
+                  .compression = compressions::LZ4};
+    AppendBinaryRequest(login, message);
+    REQUIRE(DecodeBinaryMessage(message, kind, payload) == message.size());
+    Request decoded;
+    REQUIRE(DecodeBinaryRequest(kind, payload, decoded) == RequestError::NONE);
+    REQUIRE(decoded == login);
+    REQUIRE(ParseRequest(RequestToJson(login), decoded) == RequestError::NONE);
+    REQUIRE(decoded == login);
+}
+
+// Runs handlers of io_service until none is ready
+static void RunReady(boost::asio::io_service& io_service) {
+    io_service.restart();
+    while (io_service.poll() != 0) {
+    }
+}
+
+// Serves one end of connected Unix socket pair by session, the other end
+// is returned as client
+static boost::asio::local::stream_protocol::socket ConnectSession(
+    boost::asio::io_service& io_service, Session& session) {
+    boost::asio::local::stream_protocol::socket client(io_service);
+    boost::asio::local::stream_protocol::socket server(io_service);
+    boost::asio::local::connect_pair(client, server);
+    session.GetSocket() = std::move(server);
+    session.Start();
+    return client;
+}
+
+static std::string Exchange(boost::asio::io_service& io_service,
+                            boost::asio::local::stream_protocol::socket& client,
+                            std::string_view message) {
+    boost::asio::write(client, boost::asio::buffer(message));
+    RunReady(io_service);
+    char reply[4096];
+    return std::string(reply, client.read_some(boost::asio::buffer(reply)));
+}
+
+TEST_CASE("Session pool") {
+    boost::asio::io_service io_service;
+    auto limit = std::make_shared<SessionLimit>(2);
+    int release_count = 0;
+    auto pool = std::make_shared<SessionPool>(io_service, io_service, limit,
+                                              [&] { ++release_count; });
+
+    std::shared_ptr<Session> first = pool->Acquire();
+    std::shared_ptr<Session> second = pool->Acquire();
+    REQUIRE(first);
+    REQUIRE(second);
+    REQUIRE(pool->Acquire() == nullptr);
+    REQUIRE(pool->GetActiveCount() == 2);
+    REQUIRE(limit->GetActiveCount() == 2);
+
+    // Session switched to binary protocol keeps partial message in input
+    auto client = ConnectSession(io_service, *first);
+    REQUIRE(Exchange(io_service, client,
+                     R"({"TYPE":"Protocol","PROTOCOL":"binary"})") ==
+            R"({"SUCCESS":true,"TYPE":"Protocol"})");
+    boost::asio::write(client, boost::asio::buffer("\x05\x00", 2));
+    RunReady(io_service);
+
+    // Session returns to pool when client disconnects, waiting pool is told
+    Session* released = first.get();
+    first.reset();
+    RunReady(io_service);
+    REQUIRE(release_count == 0);
+    client.close();
+    RunReady(io_service);
+    REQUIRE(release_count == 1);
+    REQUIRE(pool->GetActiveCount() == 1);
+    REQUIRE(limit->GetActiveCount() == 1);
+
+    // It is reused for next client with state of connection reset
+    std::shared_ptr<Session> reused = pool->Acquire();
+    REQUIRE(reused.get() == released);
+    REQUIRE_FALSE(reused->GetSocket().is_open());
+    client = ConnectSession(io_service, *reused);
+    REQUIRE(Exchange(io_service, client, "garbage") ==
+            R"("ERROR: Malformed request")");
+
+    // Session released by one pool resumes other pool sharing limit
+    int other_release_count = 0;
+    auto other = std::make_shared<SessionPool>(
+        io_service, io_service, limit, [&] { ++other_release_count; });
+    REQUIRE(other->Acquire() == nullptr);
+    second.reset();
+    RunReady(io_service);
+    REQUIRE(other_release_count == 1);
+    REQUIRE(release_count == 1);
+    REQUIRE(other->Acquire());
+    client.close();
+    RunReady(io_service);
+}